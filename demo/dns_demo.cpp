@@ -89,7 +89,7 @@ int main() {
 
     using HPGTP::Logic::DnsQueryDisposition;
     // bounce_fd = -1: response is built and send fails → ReplySendFailed (not Replied).
-    const DnsQueryDisposition hit = dns.process_query(pkt, -1);
+    const DnsQueryDisposition hit = dns.process_query(pkt, -1, -1);
     assert(hit == DnsQueryDisposition::ReplySendFailed &&
            "Static hit must classify as ReplySendFailed when bounce fd is invalid");
 
@@ -97,7 +97,7 @@ int main() {
 
     auto frame2 = make_dns_query("unknown.test");
     auto pkt2   = Net::ParsedPacket::parse(std::span<uint8_t>(frame2.data(), frame2.size()));
-    const DnsQueryDisposition miss = dns.process_query(pkt2, -1);
+    const DnsQueryDisposition miss = dns.process_query(pkt2, -1, -1);
     assert(miss == DnsQueryDisposition::NotHandled &&
            "Unknown hostname should be NotHandled (forward to upstream)");
 
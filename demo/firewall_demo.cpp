@@ -85,6 +85,23 @@ int main() {
         std::println("[PASS] Blocked IP enforcement verified.");
     }
 
+    // ── 5. Idle expiry through the timer wheel ────────────────────────────────
+    {
+        auto out = make_tcp_frame(lan, srv, 50001, 443, 0x0010);  // ACK → ESTABLISHED
+        auto opk = Net::ParsedPacket::parse(std::span<uint8_t>{out});
+        fw.track_outbound(opk);
+        auto in  = make_tcp_frame(srv, lan, 443, 50001, 0x0010);
+        auto ipk = Net::ParsedPacket::parse(std::span<uint8_t>{in});
+
+        for (int t = 0; t < 200; ++t) { fw.tick(); fw.cleanup(); }
+        fw.track_outbound(opk);  // refresh: the armed timer must re-arm, not expire
+        for (int t = 0; t < 200; ++t) { fw.tick(); fw.cleanup(); }
+        assert(fw.check_inbound(ipk) && "refreshed entry must survive its first deadline");
+        for (int t = 0; t < 301; ++t) { fw.tick(); fw.cleanup(); }
+        assert(!fw.check_inbound(ipk) && "idle ESTABLISHED entry must expire after 300 ticks");
+        std::println("[PASS] Conntrack entries expire by timer wheel, refresh re-arms.");
+    }
+
     std::println("=== Done ===");
     return 0;
 }
@@ -1,23 +1,31 @@
-// nat_demo: verify SNAT rewrite on a hand-crafted outbound packet
+// nat_demo: verify SNAT/DNAT rewrites on hand-crafted packets, and the external
+// port bookkeeping behind them (port mappings, pools, full cone)
 //
 // Build via CMake (from build/ directory):
 //   cmake .. && make nat_demo
 // Run (no root required — pure in-memory test):
 //   ./nat_demo
 #include "NatEngine.hpp"
+#include "Config.hpp"
+#include "FragmentTable.hpp"
 #include "Headers.hpp"
+#include "Telemetry.hpp"
 
 namespace Net = HPGTP::Net;
 
 #include <cstring>
+#include <memory>
 #include <print>
+#include <set>
 #include <netinet/in.h>
 #include <cassert>
 
-// Build a minimal Ethernet+IPv4+UDP frame in a byte array
+using HPGTP::Logic::NatEngine;
+
+// Build a minimal Ethernet+IPv4+UDP (or TCP) frame in a byte array
 static std::array<uint8_t, 56> make_udp_frame(
     uint32_t src_ip, uint32_t dst_ip,
-    uint16_t sport,  uint16_t dport)
+    uint16_t sport,  uint16_t dport, uint8_t proto = 17)
 {
     std::array<uint8_t, 56> buf{};
 
@@ -32,11 +40,20 @@ static std::array<uint8_t, 56> make_udp_frame(
     ip->id       = 0;
     ip->frag_off = 0;
     ip->ttl      = 64;
-    ip->protocol = 17;  // UDP
+    ip->protocol = proto;
     ip->check    = 0;
     ip->saddr    = Net::IPv4Net{src_ip};
     ip->daddr    = Net::IPv4Net{dst_ip};
 
+    if (proto == 6) {   // TCP header (20 bytes, data offset 5) at offset 34
+        ip->tot_len = htons(40);
+        auto* tcp = reinterpret_cast<Net::TCPHeader*>(&buf[34]);
+        tcp->source = htons(sport);
+        tcp->dest   = htons(dport);
+        tcp->res1_doff_flags = htons(0x5010);  // ACK
+        return buf;
+    }
+
     // UDP header (8 bytes) at offset 34
     auto* udp = reinterpret_cast<Net::UDPHeader*>(&buf[34]);
     udp->source = htons(sport);
@@ -47,10 +64,38 @@ static std::array<uint8_t, 56> make_udp_frame(
     return buf;
 }
 
+// Source and destination ports sit at the same offsets in UDP and TCP.
+static uint16_t frame_port(const std::array<uint8_t, 56>& f, size_t which) {
+    uint16_t p;
+    std::memcpy(&p, &f[34 + 2 * which], 2);
+    return ntohs(p);
+}
+
+// LAN → WAN through SNAT: the external source port (0 = not translated).
+static uint16_t snat(NatEngine& nat, uint32_t src, uint32_t dst, uint16_t sport, uint16_t dport,
+                     uint8_t proto = 17, size_t worker = 0) {
+    auto f = make_udp_frame(src, dst, sport, dport, proto);
+    auto p = Net::ParsedPacket::parse(std::span<uint8_t>(f));
+    return nat.process_outbound(p, worker) ? frame_port(f, 0) : 0;
+}
+
+// WAN → LAN through DNAT: the LAN destination (ip NBO, port) it was mapped to, if any.
+static bool dnat(NatEngine& nat, uint32_t src, uint32_t dst, uint16_t sport, uint16_t dport,
+                 uint8_t proto = 17, uint32_t* lan_ip = nullptr, uint16_t* lan_port = nullptr) {
+    auto f = make_udp_frame(src, dst, sport, dport, proto);
+    auto p = Net::ParsedPacket::parse(std::span<uint8_t>(f));
+    if (!nat.process_inbound(p)) return false;
+    if (lan_ip)   *lan_ip   = p.ipv4->daddr.raw();
+    if (lan_port) *lan_port = frame_port(f, 1);
+    return true;
+}
+
 int main() {
     std::println("=== NAT Engine Demo ===");
 
-    HPGTP::Logic::NatEngine nat;
+    // Several MB of session tables: keep it off the stack.
+    auto nat_ptr = std::make_unique<NatEngine>();
+    NatEngine& nat = *nat_ptr;
 
     // WAN IP: 203.0.113.1 (TEST-NET-3, RFC 5737)
     const uint32_t wan_raw = htonl(0xCB007101);  // 203.0.113.1 in NBO
@@ -86,6 +131,231 @@ int main() {
     assert(rpkt.ipv4->daddr == Net::IPv4Net{lan_raw} && "daddr must be restored to LAN IP");
 
     std::println("[PASS] Inbound DNAT reverse rewrite verified.");
+
+    // Port allocation: preservation, one port per live flow, a pool per protocol
+    {
+        auto eng = std::make_unique<NatEngine>();
+        eng->set_wan_ip(Net::IPv4Net{wan_raw});
+        const uint32_t host_a = htonl(0xC0A80164);  // 192.168.1.100
+        const uint32_t host_b = htonl(0xC0A80165);  // 192.168.1.101
+        const uint32_t remote = htonl(0x01010101);
+
+        // A free LAN source port inside the NAT range is kept as it is.
+        assert(snat(*eng, host_a, remote, 30000, 3478) == 30000);
+        // Another host with the same source port: UDP 30000 is taken, TCP 30000 is not.
+        const uint16_t other = snat(*eng, host_b, remote, 30000, 3478);
+        assert(other != 0 && other != 30000 && "two live flows never share a port");
+        assert(snat(*eng, host_b, remote, 30000, 443, 6) == 30000 && "TCP has its own pool");
+        assert(eng->ports_in_use(17) == 2 && eng->ports_in_use(6) == 1);
+    }
+    std::println("[PASS] Source port kept when free; UDP and TCP pools are separate.");
+
+    // A flow that moves to another upstream worker (cpu fanout, rollover) keeps its port
+    {
+        auto eng = std::make_unique<NatEngine>();
+        eng->set_wan_ip(Net::IPv4Net{wan_raw});
+        eng->set_upstream_workers(2);
+        const uint32_t host   = htonl(0xC0A80166);  // 192.168.1.102
+        const uint32_t remote = htonl(0x01010101);
+        const uint16_t ext = snat(*eng, host, remote, 5000, 3478, 17, 0);
+        assert(ext != 0 && snat(*eng, host, remote, 5000, 3478, 17, 1) == ext);
+        assert(eng->ports_in_use(17) == 1 && "found in worker 0's shard, not mapped again");
+    }
+    std::println("[PASS] A flow seen by a second upstream worker keeps its mapping.");
+
+    // Draining a shard: every flow gets its own port until the pool runs dry
+    {
+        auto eng = std::make_unique<NatEngine>();
+        eng->set_wan_ip(Net::IPv4Net{wan_raw});
+        // As many workers as shards: worker 0 allocates from its one shard only.
+        eng->set_upstream_workers(HPGTP::Config::MAX_WORKERS_PER_DIRECTION);
+        const uint32_t remote = htonl(0x01010101);
+        auto& exhausted = HPGTP::Telemetry::instance().nat_port_exhausted;
+        const uint64_t before = exhausted.load();
+
+        // Source port 5000 is outside the NAT range, so each flow takes a pooled port.
+        // A flow whose session probe window is full is refused without using a port
+        // and is not counted.
+        std::set<uint16_t> ports;
+        uint32_t host = 0x0A000001;   // 10.0.0.1 upwards
+        while (exhausted.load() == before) {
+            assert(host < 0x0A000001 + NatEngine::port_capacity());
+            const size_t in_use = eng->ports_in_use(17);
+            if (uint16_t ext = snat(*eng, htonl(host++), remote, 5000, 3478))
+                assert(ports.insert(ext).second && "two live flows never share a port");
+            else
+                assert(eng->ports_in_use(17) == in_use);
+        }
+        assert(exhausted.load() == before + 1 && "one refused flow, counted once");
+        assert(ports.size() == eng->ports_in_use(17));
+    }
+    std::println("[PASS] Live flows hold distinct ports; a drained pool counts port_pool_exhausted.");
+
+    // Full cone (NAT_CONE_DEVICE) against symmetric mapping and filtering
+    {
+        auto eng = std::make_unique<NatEngine>();
+        eng->set_wan_ip(Net::IPv4Net{wan_raw});
+        const uint32_t console = htonl(0xC0A80132);  // 192.168.1.50, full cone
+        const uint32_t laptop  = htonl(0xC0A80133);  // 192.168.1.51, symmetric
+        const uint32_t peer_1  = htonl(0x01010101);
+        const uint32_t peer_2  = htonl(0x02020202);
+        const uint32_t peer_3  = htonl(0x03030303);  // never contacted
+        const uint32_t peer_4  = htonl(0x04040404);
+        HPGTP::Config::add_nat_cone_device(Net::IPv4Net{console});
+        eng->set_upstream_workers(2);
+
+        // One external port for the LAN endpoint, whatever the destination, and
+        // whichever upstream worker hash fanout hands the flow to.
+        const uint16_t cone = snat(*eng, console, peer_1, 40000, 3478);
+        assert(cone != 0 && snat(*eng, console, peer_2, 40000, 3479) == cone);
+        assert(snat(*eng, console, peer_4, 40000, 3480, 17, 1) == cone);
+        assert(eng->ports_in_use(17) == 1);
+
+        // Any remote host reaches it, including one the console never sent to.
+        auto probe = make_udp_frame(peer_3, wan_raw, 5555, cone);
+        assert(eng->accepts_any_remote(Net::ParsedPacket::parse(std::span<uint8_t>(probe))));
+        uint32_t ip = 0; uint16_t port = 0;
+        assert(dnat(*eng, peer_3, wan_raw, 5555, cone, 17, &ip, &port));
+        assert(ip == console && port == 40000);
+
+        // The symmetric flow only takes replies from the host and port it sent to.
+        const uint16_t sym = snat(*eng, laptop, peer_1, 40001, 3478);
+        assert(sym != 0 && snat(*eng, laptop, peer_2, 40001, 3479) != sym);
+        probe = make_udp_frame(peer_3, wan_raw, 5555, sym);
+        assert(!eng->accepts_any_remote(Net::ParsedPacket::parse(std::span<uint8_t>(probe))));
+        assert(!dnat(*eng, peer_3, wan_raw, 5555, sym));
+        assert(dnat(*eng, peer_1, wan_raw, 3478, sym, 17, &ip, &port));
+        assert(ip == laptop && port == 40001);
+
+        HPGTP::Config::NAT_CONE_DEVICE_COUNT = 0;
+    }
+    std::println("[PASS] Full-cone device: one port, open to any host; symmetric flow filtered.");
+
+    // Port mappings inside the NAT range hold their port out of the session pools
+    {
+        auto eng = std::make_unique<NatEngine>();
+        eng->set_wan_ip(Net::IPv4Net{wan_raw});
+        const uint32_t server = htonl(0xC0A80114);  // 192.168.1.20
+        const uint32_t client = htonl(0xC0A80115);  // 192.168.1.21
+        const uint32_t other  = htonl(0xC0A80116);  // 192.168.1.22
+        const uint32_t remote = htonl(0x01010101);
+
+        NatEngine::UpnpRule rule{};
+        rule.ext_port = 20000;
+        rule.int_ip   = Net::IPv4Net{server};
+        rule.int_port = 20000;
+        rule.proto    = 17;
+        assert(eng->add_upnp_rule(rule));
+
+        // A LAN flow whose source port would be preserved as 20000 gets another one.
+        const uint16_t ext = snat(*eng, client, remote, 20000, 3478);
+        assert(ext != 0 && ext != 20000 && "mapped port must not go to a session");
+        uint32_t ip = 0; uint16_t port = 0;
+        assert(dnat(*eng, remote, wan_raw, 3478, 20000, 17, &ip, &port));
+        assert(ip == server && port == 20000 && "mapping keeps its inbound traffic");
+
+        // A port a live session holds is refused to a mapping; the TCP pool is separate.
+        assert(snat(*eng, client, remote, 21000, 3478) == 21000);
+        rule.ext_port = 21000;
+        auto r = eng->add_upnp_rule(rule);
+        assert(!r && r.error() == NatEngine::UpnpError::ConflictInMapping);
+        rule.proto = 6;
+        assert(eng->add_upnp_rule(rule));
+
+        // Once the mapping is deleted its port returns to the pool (on the owner's next tick).
+        assert(eng->remove_upnp_rule(20000, 17));
+        eng->tick();
+        eng->expire_sessions(0);
+        assert(snat(*eng, other, remote, 20000, 3478) == 20000);
+    }
+    std::println("[PASS] Port mappings reserve their external port against NAT sessions.");
+    // IP fragments: the first one goes through NAT, the later ones copy its addresses
+    {
+        auto eng = std::make_unique<NatEngine>();
+        eng->set_wan_ip(Net::IPv4Net{wan_raw});
+        HPGTP::Logic::FragmentTable frags;
+        const uint32_t client = htonl(0xC0A80117);  // 192.168.1.23
+        const uint32_t server = htonl(0x05050505);
+
+        // First fragment: MF set, offset 0, has the UDP header.
+        auto first = make_udp_frame(client, server, 40500, 27015);
+        auto* fip = reinterpret_cast<Net::IPv4Header*>(&first[14]);
+        fip->id = htons(0x1234);
+        fip->frag_off = htons(0x2000);
+        auto fp = Net::ParsedPacket::parse(std::span<uint8_t>(first));
+        assert(fp.fragment == Net::FragmentKind::First);
+        frags.begin(fp.fragment_key);
+        assert(eng->process_outbound(fp));
+        frags.commit(fp, false);
+        const uint16_t ext = frame_port(first, 0);
+
+        // Last fragment: offset 185 (1480 bytes), payload only, addressed as sent.
+        auto later = make_udp_frame(client, server, 40500, 27015);
+        auto* lip = reinterpret_cast<Net::IPv4Header*>(&later[14]);
+        lip->id = htons(0x1234);
+        lip->frag_off = htons(185);
+        auto lp = Net::ParsedPacket::parse(std::span<uint8_t>(later));
+        assert(lp.fragment == Net::FragmentKind::Later && lp.l4_header == nullptr);
+        const auto* e = frags.find(lp.fragment_key);
+        assert(e && e->state == HPGTP::Logic::FragmentTable::State::Committed && !e->lan);
+        HPGTP::Logic::FragmentTable::rewrite(lp, *e);
+        assert(lip->saddr == Net::IPv4Net{wan_raw} && lip->daddr == Net::IPv4Net{server});
+        assert(Net::ipv4_header_checksum(lip) == 0 && "header checksum redone");
+        assert(frame_port(later, 0) == 40500 && "payload is not a port: left alone");
+        assert(ext != 0);
+
+        // A datagram whose first fragment is not forwarded stays Pending; an unknown one
+        // has no entry.
+        lip->id = htons(0x1235);
+        lp = Net::ParsedPacket::parse(std::span<uint8_t>(later));
+        frags.begin(lp.fragment_key);
+        assert(frags.find(lp.fragment_key)->state == HPGTP::Logic::FragmentTable::State::Pending);
+        lip->id = htons(0x1236);
+        lp = Net::ParsedPacket::parse(std::span<uint8_t>(later));
+        assert(!frags.find(lp.fragment_key));
+    }
+    std::println("[PASS] Later IP fragments follow the first fragment's NAT rewrite.");
+
+    // Hairpin: a LAN client on the WAN address of a forward is looped back on the LAN
+    {
+        auto eng = std::make_unique<NatEngine>();
+        eng->set_wan_ip(Net::IPv4Net{wan_raw});
+        const uint32_t router = htonl(0xC0A80101);  // 192.168.1.1
+        const uint32_t server = htonl(0xC0A80114);  // 192.168.1.20
+        const uint32_t client = htonl(0xC0A80115);  // 192.168.1.21
+
+        NatEngine::UpnpRule rule{};
+        rule.ext_port = 27015;
+        rule.int_ip   = Net::IPv4Net{server};
+        rule.int_port = 27016;
+        rule.proto    = 17;
+        assert(eng->add_upnp_rule(rule));
+
+        // Client → WAN:27015 becomes router:hp → server:27016.
+        auto req = make_udp_frame(client, wan_raw, 50000, 27015);
+        auto rp  = Net::ParsedPacket::parse(std::span<uint8_t>(req));
+        assert(eng->process_hairpin(rp, Net::IPv4Net{router}));
+        assert(rp.ipv4->saddr == Net::IPv4Net{router} && rp.ipv4->daddr == Net::IPv4Net{server});
+        const uint16_t hp = frame_port(req, 0);
+        assert(hp >= 61000 && frame_port(req, 1) == 27016);
+
+        // The server's reply comes back to the client from WAN:27015.
+        auto rsp = make_udp_frame(server, router, 27016, hp);
+        auto sp  = Net::ParsedPacket::parse(std::span<uint8_t>(rsp));
+        assert(eng->process_hairpin(sp, Net::IPv4Net{router}));
+        assert(sp.ipv4->saddr == Net::IPv4Net{wan_raw} && sp.ipv4->daddr == Net::IPv4Net{client});
+        assert(frame_port(rsp, 0) == 27015 && frame_port(rsp, 1) == 50000);
+
+        // No forward on the port, or a reply from the wrong port: not hairpinned.
+        auto miss = make_udp_frame(client, wan_raw, 50000, 27020);
+        auto mp   = Net::ParsedPacket::parse(std::span<uint8_t>(miss));
+        assert(!eng->process_hairpin(mp, Net::IPv4Net{router}));
+        auto stray = make_udp_frame(server, router, 27017, hp);
+        auto tp    = Net::ParsedPacket::parse(std::span<uint8_t>(stray));
+        assert(!eng->process_hairpin(tp, Net::IPv4Net{router}));
+    }
+    std::println("[PASS] Hairpin NAT loops LAN traffic to a forward back to the server.");
+
     std::println("=== Done ===");
     return 0;
 }
@@ -0,0 +1,151 @@
+// pcp_demo: verify the NAT-PMP and PCP responders byte for byte, and the port
+// mappings they leave in the NAT engine
+//
+// Build via CMake (from build/ directory):
+//   cmake .. && make pcp_demo
+// Run (no root required — requests are fed in directly, not over the socket):
+//   ./pcp_demo
+#include "PcpEngine.hpp"
+#include "NatEngine.hpp"
+#include "Headers.hpp"
+
+namespace Net = HPGTP::Net;
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <print>
+#include <vector>
+#include <cassert>
+
+using HPGTP::Logic::NatEngine;
+using HPGTP::Logic::PcpEngine;
+
+static constexpr uint8_t WAN[4]    = {203, 0, 113, 1};
+static constexpr uint8_t CLIENT[4] = {127, 0, 0, 5};
+
+static uint32_t be32(const uint8_t* p) {
+    return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) | (uint32_t{p[2]} << 8) | p[3];
+}
+
+static Net::IPv4Net ip_of(const uint8_t (&a)[4]) {
+    uint32_t raw;
+    std::memcpy(&raw, a, 4);
+    return Net::IPv4Net{raw};
+}
+
+// One request through the responder; the reply must equal `want` except for the
+// epoch at `epoch_off` (seconds since the engine started: checked, then taken as is).
+static void expect_reply(PcpEngine& pcp, const std::vector<uint8_t>& req,
+                         std::vector<uint8_t> want, size_t epoch_off) {
+    std::array<uint8_t, PcpEngine::MAX_DATAGRAM> resp{};
+    const size_t len = pcp.handle_datagram(ip_of(CLIENT), req, resp);
+    assert(len == want.size());
+    if (len == 0) return;
+    assert(be32(&resp[epoch_off]) < 60);
+    std::copy_n(&resp[epoch_off], 4, want.begin() + static_cast<ptrdiff_t>(epoch_off));
+    assert(std::equal(want.begin(), want.end(), resp.begin()));
+}
+
+// PCP common header (24 bytes): version, opcode, lifetime, client address (v4-mapped).
+static std::vector<uint8_t> pcp_header(uint8_t version, uint8_t op, uint32_t lifetime) {
+    std::vector<uint8_t> h = {version, op, 0, 0,
+                              uint8_t(lifetime >> 24), uint8_t(lifetime >> 16),
+                              uint8_t(lifetime >> 8), uint8_t(lifetime),
+                              0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF,
+                              CLIENT[0], CLIENT[1], CLIENT[2], CLIENT[3]};
+    return h;
+}
+
+// PCP response header: code, lifetime, epoch placeholder, 12 reserved bytes.
+static std::vector<uint8_t> pcp_reply_header(uint8_t op, uint8_t code, uint32_t lifetime) {
+    std::vector<uint8_t> h(24, 0);
+    h[0] = 2; h[1] = uint8_t(0x80 | op); h[3] = code;
+    h[4] = uint8_t(lifetime >> 24); h[5] = uint8_t(lifetime >> 16);
+    h[6] = uint8_t(lifetime >> 8);  h[7] = uint8_t(lifetime);
+    return h;
+}
+
+// PCP MAP opcode data (36 bytes): nonce, protocol, internal port, external port + address.
+static std::vector<uint8_t> pcp_map_data(uint8_t proto, uint16_t int_port, uint16_t ext_port,
+                                         const uint8_t* ext_ip) {
+    std::vector<uint8_t> d = {0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xAB, 0xAC,
+                              proto, 0, 0, 0,
+                              uint8_t(int_port >> 8), uint8_t(int_port),
+                              uint8_t(ext_port >> 8), uint8_t(ext_port)};
+    d.resize(36, 0);
+    if (ext_ip) {
+        d[30] = d[31] = 0xFF;
+        std::copy_n(ext_ip, 4, d.begin() + 32);
+    }
+    return d;
+}
+
+static std::vector<uint8_t> cat(std::vector<uint8_t> a, const std::vector<uint8_t>& b) {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+int main() {
+    std::println("=== HPGTP NAT-PMP / PCP Demo ===\n");
+
+    auto nat = std::make_shared<NatEngine>();
+    nat->set_wan_ip(ip_of(WAN));
+    // Loopback as the LAN: the clients below are 127.0.0.x. The handlers run without
+    // the socket, so a failed bind (port in use) does not matter here.
+    PcpEngine pcp(nat, "127.0.0.1", 8);
+
+    // ── NAT-PMP ─────────────────────────────────────────────────────────────────
+    expect_reply(pcp, {0, 0},
+                 {0, 128, 0, 0, 0, 0, 0, 0, WAN[0], WAN[1], WAN[2], WAN[3]}, 4);
+    std::println("[PASS] NAT-PMP external address");
+
+    // UDP 3074 → 3074 for two hours.
+    expect_reply(pcp, {0, 1, 0, 0, 0x0C, 0x02, 0x0C, 0x02, 0, 0, 0x1C, 0x20},
+                 {0, 129, 0, 0, 0, 0, 0, 0, 0x0C, 0x02, 0x0C, 0x02, 0, 0, 0x1C, 0x20}, 4);
+    auto rule = nat->upnp_rule(3074, 17);
+    assert(rule && rule->int_ip == ip_of(CLIENT) && rule->int_port == 3074);
+    std::println("[PASS] NAT-PMP map UDP 3074 → {}:{}", 3074, rule->int_port);
+
+    // Lifetime 0 deletes it: external port and lifetime come back as 0.
+    expect_reply(pcp, {0, 1, 0, 0, 0x0C, 0x02, 0x0C, 0x02, 0, 0, 0, 0},
+                 {0, 129, 0, 0, 0, 0, 0, 0, 0x0C, 0x02, 0, 0, 0, 0, 0, 0}, 4);
+    assert(!nat->upnp_rule(3074, 17));
+    std::println("[PASS] NAT-PMP delete (lifetime 0)");
+
+    expect_reply(pcp, {0, 3}, {0, 131, 0, 5, 0, 0, 0, 0}, 4);
+    expect_reply(pcp, {0, 1, 0, 0, 0x0C, 0x02}, {}, 4);   // truncated map: no reply
+    std::println("[PASS] NAT-PMP unsupported opcode / truncated request");
+
+    // ── PCP ─────────────────────────────────────────────────────────────────────
+    // MAP TCP 25565 for an hour: granted as asked, the WAN address filled in.
+    expect_reply(pcp, cat(pcp_header(2, 1, 3600), pcp_map_data(6, 25565, 25565, nullptr)),
+                 cat(pcp_reply_header(1, 0, 3600), pcp_map_data(6, 25565, 25565, WAN)), 8);
+    rule = nat->upnp_rule(25565, 6);
+    assert(rule && rule->int_ip == ip_of(CLIENT) && rule->int_port == 25565);
+
+    // Renewal without a suggested port keeps the external port the client holds.
+    expect_reply(pcp, cat(pcp_header(2, 1, 7200), pcp_map_data(6, 25565, 0, nullptr)),
+                 cat(pcp_reply_header(1, 0, 7200), pcp_map_data(6, 25565, 25565, WAN)), 8);
+    assert(nat->upnp_rule(25565, 6) && !nat->upnp_rule(25566, 6));
+    std::println("[PASS] PCP MAP TCP 25565 and its renewal");
+
+    // Version 1 (draft PCP): UNSUPP_VERSION, header only, zeroed.
+    expect_reply(pcp, pcp_header(1, 1, 3600), pcp_reply_header(1, 1, 1800), 8);
+
+    // Unknown opcode 3: UNSUPP_OPCODE, the opcode data echoed back.
+    const std::vector<uint8_t> extra = {0xDE, 0xAD, 0xBE, 0xEF};
+    expect_reply(pcp, cat(pcp_header(2, 3, 3600), extra),
+                 cat(pcp_reply_header(3, 4, 1800), extra), 8);
+
+    // Shorter than the header: MALFORMED_REQUEST, padded to a full header.
+    auto short_req = pcp_header(2, 1, 3600);
+    short_req.resize(20);
+    expect_reply(pcp, short_req, pcp_reply_header(1, 3, 1800), 8);
+    expect_reply(pcp, {2, 1, 0}, {}, 8);                  // not even a header start
+    std::println("[PASS] PCP bad version / unsupported opcode / short packet");
+
+    std::println("\nAll NAT-PMP / PCP tests passed.");
+    return 0;
+}
@@ -1,4 +1,4 @@
-// scheduler_demo: verify TokenBucket rate limiting and Shaper queue drain
+// scheduler_demo: verify TokenBucket rate limiting, Shaper queue drain and batch egress
 //
 // Build: make scheduler_demo
 // Run:   ./scheduler_demo   (no root required -- uses fd=-1, send() fails gracefully)
@@ -47,10 +47,15 @@ int main() {
 
         auto front = ring.front();
         assert(front.size() == 64 && front[0] == 0xAA);
+        pkt[0] = 0xBB;
+        ring.push(std::span<const uint8_t>{pkt});
+        assert(ring.peek(1).size() == 64 && ring.peek(1)[0] == 0xBB);
+        assert(ring.peek(2).empty());
+        ring.pop();
         ring.pop();
         assert(ring.empty());
 
-        std::println("[PASS] ZeroAllocRingBuffer: push/front/pop verified.");
+        std::println("[PASS] ZeroAllocRingBuffer: push/front/peek/pop verified.");
     }
 
     // 3. Shaper: enqueue then process_queue (tx_fd = -1, sends will fail)
@@ -68,6 +73,19 @@ int main() {
         std::println("[PASS] Shaper: enqueue + process_queue with invalid fd completed.");
     }
 
+    // 4. sendmmsg batch: a hard error on one frame must not stall the rest --
+    //    every frame gets its own PacketTxTry (all Error on an invalid fd).
+    {
+        using HPGTP::DataPlane::TxFrameOutput;
+        std::array<uint8_t, 60> pkt{};
+        std::array<std::span<const uint8_t>, 3> frames{ pkt, pkt, pkt };
+        std::array<TxFrameOutput::PacketTxTry, 3> results{};
+        results.fill(TxFrameOutput::PacketTxTry::Complete);
+        TxFrameOutput::send_batch_nonblocking(-1, frames, results);
+        for (auto r : results) assert(r == TxFrameOutput::PacketTxTry::Error);
+        std::println("[PASS] TxFrameOutput: sendmmsg batch reports per-frame results.");
+    }
+
     std::println("=== Done ===");
     return 0;
 }
@@ -10,6 +10,7 @@
 #include <future>
 #include <array>
 #include <span>
+#include <vector>
 #include "NetworkUtils.hpp"
 #include "NetworkEngine.hpp"
 #include "Processor.hpp"
@@ -17,10 +18,12 @@
 #include "DnsEngine.hpp"
 #include "DhcpEngine.hpp"
 #include "UpnpEngine.hpp"
+#include "PcpEngine.hpp"
 #include "SystemOptimizer.hpp"
 #include "Telemetry.hpp"
 #include "Scheduler.hpp"
 #include "FirewallEngine.hpp"
+#include "DataPlane.hpp"
 
 // HPGTP: High-Performance Gaming Traffic Prioritizer. Root namespace for all
 // product code (nested: Logic, Net, GUI, Traffic, Engine, ...).
@@ -30,7 +33,7 @@ namespace HPGTP {
 // These are referenced by App's private members and must be layout-complete
 // here.  Their *implementations* live in App.cpp together with the POSIX APIs.
 
-// Zero-heap static hash table (FNV-1a) for IP-to-Shaper mapping.
+// Zero-heap static hash table (Net::hash_u32) for IP-to-Shaper mapping.
 // Template: must remain in the header.
 template<typename T, size_t Capacity = 256>
 class StaticIpMap {
@@ -44,14 +47,10 @@ public:
 private:
     std::array<Entry, Capacity> table{};
 
-    static uint32_t fnv1a_hash(Net::IPv4Net addr) {
-        uint32_t val = addr.raw();
-        uint32_t h   = 2166136261U;
-        h ^= (val & 0xFF);         h *= 16777619U;
-        h ^= ((val >>  8) & 0xFF); h *= 16777619U;
-        h ^= ((val >> 16) & 0xFF); h *= 16777619U;
-        h ^= ((val >> 24) & 0xFF); h *= 16777619U;
-        return h;
+    // Keyed by address alone, so the packet's endpoint hashes (which include the port)
+    // do not apply; one CRC32C step over the address instead.
+    static uint32_t hash_ip(Net::IPv4Net addr) {
+        return Net::hash_u32(0xFFFFFFFFu, addr.raw());
     }
 
 public:
@@ -62,7 +61,7 @@ public:
     }
 
     void insert(Net::IPv4Net ip, T val) {
-        uint32_t h = fnv1a_hash(ip) % Capacity;
+        uint32_t h = hash_ip(ip) % Capacity;
         for (size_t i = 0; i < Capacity; ++i) {
             size_t idx = (h + i) % Capacity;
             if (!table[idx].occupied || table[idx].key == ip) {
@@ -73,7 +72,7 @@ public:
     }
 
     T find(Net::IPv4Net ip) const {
-        uint32_t h = fnv1a_hash(ip) % Capacity;
+        uint32_t h = hash_ip(ip) % Capacity;
         for (size_t i = 0; i < Capacity; ++i) {
             size_t idx = (h + i) % Capacity;
             if (!table[idx].occupied) return nullptr;
@@ -100,12 +99,20 @@ struct QoSConfig {
     }
 };
 
+// Which interface a data-plane worker receives on; selects its pipeline.
+// Value doubles as the Telemetry::direction_metrics index.
+enum class WorkerDirection : uint8_t {
+    Downstream = 0,   // WAN RX → LAN TX
+    Upstream   = 1,   // LAN RX → WAN TX
+};
+
 // Per-thread routing and engine handles passed into each packet worker.
 struct PacketWorkerConfig {
-    int tx_fd{};
-    // Upstream (LAN RX): egress back to LAN for same-subnet hairpin. Downstream: -1.
-    int tx_fd_lan{-1};
+    DataPlane::TxPort tx{};
+    // Upstream (LAN RX): egress back to LAN for same-subnet hairpin. Downstream: fd -1.
+    DataPlane::TxPort tx_lan{};
     int core_id{};
+    WorkerDirection direction{};
     std::shared_ptr<Traffic::Shaper>       route_shaper;
     std::shared_ptr<Logic::NatEngine>      nat_engine;
     std::shared_ptr<Logic::DnsEngine>      dns_engine;
@@ -114,20 +121,22 @@ struct PacketWorkerConfig {
     std::shared_ptr<Logic::DhcpEngine>     dhcp_engine;
     std::shared_ptr<Logic::FirewallEngine> firewall_engine;
     Net::IPv4Net gateway_ip{};
+    std::shared_ptr<Logic::FlowDirectionBoard> flow_board;
+    size_t worker_index{};  // among the workers of this direction (NAT shard owner)
 };
 
 // Application class
 // Public interface: init / start / stop / wait_for_shutdown.
 // All POSIX I/O, packet pipeline, and watchdog implementations are in App.cpp.
 class App {
-    std::unique_ptr<Engine::RawSocketManager> iface_wan;
-    std::unique_ptr<Engine::RawSocketManager> iface_lan;
     std::shared_ptr<Logic::NatEngine>         nat_engine;
     std::shared_ptr<Logic::DnsEngine>         dns_engine;
     std::shared_ptr<Logic::DhcpEngine>        dhcp_engine;
     std::shared_ptr<Logic::FirewallEngine>    firewall_engine;
     std::shared_ptr<Logic::UpnpEngine>        upnp_engine;
+    std::shared_ptr<Logic::PcpEngine>         pcp_engine;
     std::shared_ptr<QoSConfig>                qos_config;
+    std::shared_ptr<Logic::FlowDirectionBoard> flow_board;
     int lan_fd_ = -1;
 
     std::shared_ptr<Traffic::Shaper> global_shaper_dl;
@@ -137,8 +146,6 @@ class App {
     std::shared_ptr<QoSConfig> device_shaper_dl;
     std::shared_ptr<QoSConfig> device_shaper_ul;
 
-    std::thread       worker_downstream;
-    std::thread       worker_upstream;
     std::thread       watchdog;
     std::atomic<bool> running_workers{false};
     std::atomic<bool> running_watchdog{false};
@@ -147,11 +154,33 @@ class App {
     std::atomic<bool>   shutdown_sequence_started_{false};
     std::once_flag      shutdown_notify_once_;
 
+    // Doorbell: the processing thread arms consumer_sleeping right before blocking on
+    // frame_efd; the RX thread writes frame_efd only if it finds the flag armed (and
+    // disarms it), so there is at most one eventfd write per consumer sleep.
+    // release_efd / rx_waiting are the same handshake the other way round: the RX
+    // thread parks on release_efd while its ring is stalled on frames the processing
+    // thread still holds, and is woken by the next release.
     struct WorkerPollSync {
         int frame_efd{-1};
         int stop_efd{-1};
+        int release_efd{-1};
+        alignas(64) std::atomic<bool> consumer_sleeping{false};
+        alignas(64) std::atomic<bool> rx_waiting{false};
+    };
+
+    // One data-plane worker: its own RX ring on the ingress interface, TX rings on the
+    // egress interface(s) (null = send(2)/sendmmsg), and an RX + processing thread pair
+    // pinned to `cpu`. The vector is sized once in init() and never resized while running.
+    struct WorkerSlot {
+        WorkerDirection direction{};
+        int             cpu{};
+        std::unique_ptr<Engine::RawSocketManager> rx;
+        std::unique_ptr<DataPlane::TxRing>        tx_ring;
+        std::unique_ptr<DataPlane::TxRing>        tx_ring_lan;   // upstream only
+        std::thread     thread;
+        WorkerPollSync  poll;
     };
-    std::array<WorkerPollSync, 2> worker_poll_{};
+    std::vector<WorkerSlot> workers_;
     int watchdog_stop_efd_{-1};
 
     std::expected<void, std::string> open_worker_poll_fds_for_start();
@@ -175,9 +204,8 @@ public:
     void wait_for_shutdown();
 
 private:
-    void worker_event_loop(std::unique_ptr<Engine::RawSocketManager> rx_mgr,
-                           PacketWorkerConfig cfg,
-                           WorkerPollSync& poll_sync);
+    void worker_event_loop(WorkerSlot& slot, PacketWorkerConfig cfg);
+    void join_workers();
     void watchdog_loop();
 };
 
@@ -150,6 +150,47 @@ namespace HPGTP::Config {
     inline uint32_t LARGE_PACKET_THRESHOLD_BYTES = 1000;
     inline uint32_t PUNISH_TRIGGER_COUNT = 30;
     inline uint32_t CLEANUP_INTERVAL_PKTS = 10000;
+    // Classifier flow table: furthest a flow may sit from its home slot (Robin Hood
+    // probing). New flows beyond it go untracked and are counted in flow_table_drops.
+    inline uint32_t FLOW_PROBE_LIMIT = 32;
+
+    // AF_PACKET RX ring (read once at App::init). 3 = TPACKET_V3 block ring, 1 = TPACKET_V1
+    // frame ring; V3 falls back to V1 if the kernel rejects it. RX_BLOCK_TIMEOUT_MS bounds how
+    // long a partially filled V3 block is held by the kernel before it is retired to user space.
+    inline uint32_t RX_RING_VERSION     = 3;
+    inline uint32_t RX_BLOCK_TIMEOUT_MS = 1;
+
+    // Egress through an mmap'd PACKET_TX_RING per worker (one send() kick per batch instead of
+    // one per frame); false = plain send(2). TX_QDISC_BYPASS skips the kernel qdisc layer.
+    inline bool TX_RING         = true;
+    inline bool TX_QDISC_BYPASS = false;
+
+    // Data-plane worker topology (read once at App::init). A worker is an RX thread plus a
+    // processing thread pinned to one CPU; downstream workers receive on the WAN interface,
+    // upstream workers on the LAN interface. A CPU list shorter than the worker count is
+    // reused round-robin.
+    static constexpr size_t MAX_WORKERS_PER_DIRECTION = 8;
+    struct WorkerCpuList {
+        std::array<int, MAX_WORKERS_PER_DIRECTION> cpus{};
+        size_t count = 0;
+        int at(size_t i) const { return count ? cpus[i % count] : 0; }
+    };
+    inline uint32_t      WORKERS_DOWNSTREAM = 1;
+    inline uint32_t      WORKERS_UPSTREAM   = 1;
+    inline WorkerCpuList WORKER_CPUS_DOWNSTREAM{{2}, 1};
+    inline WorkerCpuList WORKER_CPUS_UPSTREAM{{3}, 1};
+
+    // How frames are spread over several workers of one direction (PACKET_FANOUT).
+    // Hash = per flow, so flow tables stay worker-local; Cpu = follow NIC RSS/RPS.
+    // RX_FANOUT_ROLLOVER lets a full worker ring spill to its siblings instead of dropping.
+    enum class FanoutMode : uint8_t { Hash, Cpu };
+    inline FanoutMode RX_FANOUT_MODE     = FanoutMode::Hash;
+    inline bool       RX_FANOUT_ROLLOVER = false;
+
+    // Worker idle policy: after draining its queue the processing thread keeps polling for
+    // BUSY_POLL_US before sleeping on its eventfd; the same value is set as SO_BUSY_POLL
+    // (with SO_PREFER_BUSY_POLL) on the RX sockets. 0 = always sleep, no socket busy poll.
+    inline uint32_t BUSY_POLL_US = 50;
 
     // Gaming protocol port whitelist (GUI + config.txt); dataplane reads active buffer only.
     struct PortRange { uint16_t start; uint16_t end; char desc[32]; };
@@ -202,6 +243,27 @@ namespace HPGTP::Config {
         }},
     }};
     inline std::array<size_t, 2> game_port_table_counts{{20, 20}};
+
+    // Ranges compiled to one bit per port (8 KB per buffer) for the dataplane; the
+    // PortRange tables above keep the descriptions for the GUI and config save.
+    // Both are swapped together by game_port_active_idx.
+    struct GamePortBitmap {
+        std::array<uint64_t, 65536 / 64> words{};
+        bool test(uint16_t port) const { return (words[port >> 6] >> (port & 63)) & 1u; }
+    };
+    inline void compile_game_port_bitmap(std::span<const PortRange> ranges, GamePortBitmap& out) {
+        out.words.fill(0);
+        for (const auto& r : ranges)
+            for (uint32_t p = r.start; p <= r.end; ++p)
+                out.words[p >> 6] |= uint64_t{1} << (p & 63);
+    }
+    inline std::array<GamePortBitmap, 2> GAME_PORT_BITMAP_DOUBLE = [] {
+        std::array<GamePortBitmap, 2> b{};
+        for (size_t i = 0; i < 2; ++i)
+            compile_game_port_bitmap(std::span(GAME_PORT_TABLE_DOUBLE[i].data(), game_port_table_counts[i]), b[i]);
+        return b;
+    }();
+
     inline std::atomic<size_t> game_port_active_idx{0};
     inline std::mutex          game_ports_staging_mutex;
     inline std::array<PortRange, MAX_GAME_PORT_RANGES> game_port_staging{};
@@ -277,15 +339,27 @@ namespace HPGTP::Config {
         }
     }
 
-    // Helper: check if port is a game port (hot path — read stable active snapshot only)
+    // NAT mapping behaviour (RFC 4787) for UDP. Flows from a NAT_CONE_DEVICE, or with a
+    // GAME_PORT on either end when NAT_CONE_GAME_PORTS is set, get an endpoint-independent
+    // mapping and filtering ("full cone"): one external port per LAN (ip, port) that any
+    // remote host may send to. Everything else keeps a per-destination mapping. The
+    // device list is read at load only; the data plane reads it without a lock.
+    static constexpr size_t MAX_NAT_CONE_DEVICES = 32;
+    inline std::array<Net::IPv4Net, MAX_NAT_CONE_DEVICES> NAT_CONE_DEVICES;
+    inline size_t NAT_CONE_DEVICE_COUNT = 0;
+    inline std::atomic<bool> NAT_CONE_GAME_PORTS{false};
+
+    inline void add_nat_cone_device(Net::IPv4Net ip) {
+        for (size_t i = 0; i < NAT_CONE_DEVICE_COUNT; ++i)
+            if (NAT_CONE_DEVICES[i] == ip) return;
+        if (NAT_CONE_DEVICE_COUNT < MAX_NAT_CONE_DEVICES)
+            NAT_CONE_DEVICES[NAT_CONE_DEVICE_COUNT++] = ip;
+    }
+
+    // Helper: check if port is a game port (hot path — one bit test on the active bitmap)
     inline bool is_game_port(uint16_t port) {
         size_t ai = game_port_active_idx.load(std::memory_order_acquire);
-        size_t n  = game_port_table_counts[ai];
-        for (size_t i = 0; i < n; ++i) {
-            const auto& r = GAME_PORT_TABLE_DOUBLE[ai][i];
-            if (port >= r.start && port <= r.end) return true;
-        }
-        return false;
+        return GAME_PORT_BITMAP_DOUBLE[ai].test(port);
     }
 
     // Dotted-decimal IPv4 only; rejects invalid octets and non-canonical forms per inet_pton(3).
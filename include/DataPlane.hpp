@@ -1,10 +1,59 @@
 #pragma once
 #include <span>
+#include <array>
 #include <cstddef>
 #include <cstdint>
+#include <expected>
+#include <string>
+#include <string_view>
 
 namespace HPGTP::DataPlane {
 
+// mmap'd PACKET_TX_RING egress on a dedicated AF_PACKET socket bound to one
+// interface. Frames are copied into the next free ring slot and handed to the
+// kernel in bulk by one send() kick per flush. Single owner thread; the POSIX
+// headers stay in DataPlane.cpp.
+class TxRing {
+    int      fd        = -1;
+    uint8_t* ring      = nullptr;
+    size_t   ring_size = 0;
+    uint32_t head      = 0;   // next slot to fill
+    uint32_t pending   = 0;   // slots marked SEND_REQUEST since the last kick
+
+    TxRing(const TxRing&) = delete;
+    TxRing& operator=(const TxRing&) = delete;
+
+public:
+    static constexpr uint32_t FRAME_SIZE  = 2048;
+    static constexpr uint32_t FRAME_NR    = 512;
+    // Kick the kernel after this many staged frames even if the caller has not flushed yet.
+    static constexpr uint32_t FLUSH_BATCH = 32;
+
+    TxRing() = default;
+    ~TxRing();
+
+    std::expected<void, std::string> open(std::string_view iface_name, bool qdisc_bypass);
+    int get_fd() const { return fd; }
+
+    // Copy one frame into the ring. Busy = no free slot (kernel still draining).
+    enum class StageResult : std::uint8_t { Staged = 0, Busy = 1, Error = 2 };
+    [[nodiscard]] StageResult stage(std::span<const uint8_t> pkt) noexcept;
+
+    // One non-blocking send() kick for everything staged since the last flush.
+    void flush() noexcept;
+};
+
+class TxBatch;
+
+// Egress handle carried through the data plane: the ring when one is configured,
+// otherwise the socket, with best-effort frames gathered into a sendmmsg batch
+// when one is attached (one send(2) per frame if neither is set).
+struct TxPort {
+    int      fd    = -1;
+    TxRing*  ring  = nullptr;
+    TxBatch* batch = nullptr;
+};
+
 // Single egress path for raw Ethernet frames from the data plane.
 struct TxFrameOutput {
     enum class PacketTxTry : std::uint8_t { Complete = 0, Busy = 1, Error = 2 };
@@ -12,12 +61,52 @@ struct TxFrameOutput {
     // One non-blocking send(2) attempt (MSG_DONTWAIT). Busy = EAGAIN / ENOBUFS / EWOULDBLOCK.
     [[nodiscard]] static PacketTxTry try_send_packet_nonblocking(int tx_fd,
                                                                   std::span<const uint8_t> pkt) noexcept;
+    // Ring-backed port: Complete once the frame is staged (sent on the next flush).
+    [[nodiscard]] static PacketTxTry try_send_packet_nonblocking(const TxPort& port,
+                                                                  std::span<const uint8_t> pkt) noexcept;
+
+    // sendmmsg(2) with MSG_DONTWAIT over frames[0..n); results[i] receives the per-frame outcome.
+    // A frame the kernel rejects is marked Error and the call resumes after it; on would-block
+    // that frame and every later one are Busy, so Busy is always a suffix of the batch.
+    static void send_batch_nonblocking(int tx_fd, std::span<const std::span<const uint8_t>> frames,
+                                       std::span<PacketTxTry> results) noexcept;
 
     // Non-blocking send; increments drop telemetry on any failure (including would-block).
     static void send_best_effort(int tx_fd, std::span<const uint8_t> pkt,
                                   int core_id, size_t prio_idx);
+    static void send_best_effort(const TxPort& port, std::span<const uint8_t> pkt,
+                                  int core_id, size_t prio_idx);
+
+    // Push out whatever the port has staged (ring kick or sendmmsg batch).
+    static void flush(const TxPort& port);
 
     static void send_stream_blocking(int fd, std::span<const uint8_t> data);
 };
 
+// Per-worker sendmmsg staging for best-effort egress when no TX ring is available.
+// Frames are copied (the RX ring slot they came from is released before the flush)
+// and tagged with (core_id, prio_idx) so drops are still counted per frame.
+class TxBatch {
+public:
+    static constexpr size_t MAX_FRAMES = 32;
+    static constexpr size_t FRAME_MAX  = 2048;
+
+    explicit TxBatch(int tx_fd) : fd(tx_fd) {}
+
+    // Flushes first when the batch is full; oversized frames count as dropped.
+    void stage(std::span<const uint8_t> pkt, int core_id, size_t prio_idx);
+    void flush();
+
+private:
+    struct Slot {
+        uint16_t len  = 0;
+        uint8_t  core = 0;
+        uint8_t  prio = 0;
+        std::array<uint8_t, FRAME_MAX> data;
+    };
+    int    fd;
+    size_t count = 0;
+    std::array<Slot, MAX_FRAMES> slots;
+};
+
 } // namespace HPGTP::DataPlane
@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <expected>
@@ -29,6 +30,8 @@ namespace HPGTP::Logic {
 
     class DhcpEngine {
         Net::SpscRingBuffer<DhcpMessage, 512> request_queue{};
+        // Every upstream worker produces into request_queue; the watchdog is the one consumer.
+        std::atomic_flag request_push_lock_{};
 
         // Watchdog calls process_background_tasks; cap work per tick for fast return.
         static constexpr unsigned kBackgroundTaskBudget = 32;
@@ -44,8 +44,8 @@ namespace HPGTP::Logic {
             std::atomic<bool>         valid{false};
         };
 
-        // Redirect flow state: core 3 records the client's original DNS server IP
-        // before rewriting daddr to upstream; core 2 looks it up after NAT DNAT
+        // Redirect flow state: an upstream worker records the client's original DNS server IP
+        // before rewriting daddr to upstream; a downstream worker looks it up after NAT DNAT
         // has restored (client_ip, client_sport) on the reply, to rewrite saddr
         // back so the resolver accepts the response.
         struct alignas(64) DnsRedirectEntry {
@@ -60,6 +60,8 @@ namespace HPGTP::Logic {
         std::array<DnsCacheEntry, CACHE_SIZE>       cache{};
         std::array<DnsRedirectEntry, REDIRECT_SIZE> redirect_table{};
         Net::SpscRingBuffer<DnsMessage, 1024> response_queue{};
+        // Every downstream worker produces into response_queue; the watchdog is the one consumer.
+        std::atomic_flag response_push_lock_{};
 
         std::atomic<uint32_t> current_tick{0};
 
@@ -80,7 +82,7 @@ namespace HPGTP::Logic {
         // Ethernet+IP+UDP+DNS wire length plus 16 bytes for the appended A record RDATA tail,
         // and the resulting frame length must not exceed 1500 bytes (see implementation checks).
         [[nodiscard]] bool do_bounce(Net::ParsedPacket& pkt, DnsHeader* dns, Net::UDPHeader* udp,
-                                     Net::IPv4Net ip, int bounce_fd) noexcept;
+                                     Net::IPv4Net ip, int bounce_fd, int core_id) noexcept;
         static void rewrite_upstream(Net::ParsedPacket& pkt, Net::UDPHeader* udp,
                                      Net::IPv4Net upstream_ip);
         void record_redirect(Net::IPv4Net client_ip, uint16_t sport_nbo,
@@ -94,8 +96,9 @@ namespace HPGTP::Logic {
         void set_redirect(bool enabled);
         void set_gateway_ip(Net::IPv4Net ip) noexcept;
         void reload_static_records();
+        // core_id: worker core charged with reply-send drops (Telemetry::core_metrics).
         [[nodiscard]] DnsQueryDisposition process_query(Net::ParsedPacket& pkt,
-                                                        int bounce_fd) noexcept;
+                                                        int bounce_fd, int core_id) noexcept;
         void process_response(Net::ParsedPacket& pkt) noexcept;
         void process_background_tasks();
     };
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include "Headers.hpp"
 #include "Config.hpp"
+#include "TimerWheel.hpp"
 
 namespace HPGTP {
 class App;
@@ -40,12 +41,18 @@ namespace HPGTP::Logic {
 
         std::array<ConnTrackEntry, TABLE_SIZE> table{};
         std::atomic<uint32_t> current_tick{0};
+        // Entry expiry, guarded by claim_lock_ (armed on claim, turned by cleanup()).
+        TimerWheel<TABLE_SIZE> conn_timers;
+
+        // Serialises slot claims between upstream workers; lookups stay lock-free.
+        alignas(64) std::atomic_flag claim_lock_{};
+        void lock_claim()   { while (claim_lock_.test_and_set(std::memory_order_acquire)) { } }
+        void unlock_claim() { claim_lock_.clear(std::memory_order_release); }
 
         static constexpr size_t MAX_BLOCKED = 64;
         std::array<Net::IPv4Net, MAX_BLOCKED> blocked_ips;
         std::atomic<uint8_t> blocked_count{0};
 
-        static uint32_t hash_remote(uint32_t remote_ip, uint16_t remote_port, uint8_t proto);
         static uint32_t timeout_for(ConnState s);
         bool is_expired(const ConnTrackEntry& e) const;
         void sync_blocked_ips_locked();
@@ -56,6 +63,10 @@ namespace HPGTP::Logic {
         bool is_blocked_ip(Net::IPv4Net ip) const;
         void track_outbound(const Net::ParsedPacket& pkt);
         bool check_inbound(const Net::ParsedPacket& pkt);
+        // Batch prefetch: pull the home conntrack slot of the matching call
+        void prefetch_outbound(const Net::ParsedPacket& pkt) const noexcept;
+        void prefetch_inbound(const Net::ParsedPacket& pkt) const noexcept;
+        // Expire entries due at the current tick; O(1) per expiry, no table sweep.
         void cleanup();
     };
 }
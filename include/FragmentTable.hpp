@@ -0,0 +1,100 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "Headers.hpp"
+
+namespace HPGTP::Logic {
+
+    // Per-worker memory of fragmented IPv4 datagrams, keyed by (saddr, daddr, id, proto)
+    // as received. The first fragment runs the whole pipeline and leaves here the
+    // addresses it was sent with and its priority; the later fragments carry no ports,
+    // so they take both from here instead of being translated or classified on their
+    // own. No reassembly and no timers (zero allocation): the fragments of a datagram
+    // arrive back to back, so a new datagram simply overwrites the oldest entry in its
+    // probe window. Fragments that arrive before their first fragment are not buffered.
+    //
+    // Not thread-safe: one table per worker. The fragments of a datagram must all reach
+    // the worker that saw its first one, which holds only with RX_FANOUT_MODE=hash and
+    // no rollover: the kernel hashes every fragment on addresses and protocol alone.
+    // With cpu fanout or RX_FANOUT_ROLLOVER a later fragment can land on a sibling that
+    // has no entry for it, and is dropped there while NAT or the firewall is on.
+    class FragmentTable {
+    public:
+        enum class State : uint8_t {
+            Empty = 0,
+            Pending,    // first fragment seen, not (yet) forwarded: drop the rest
+            Committed   // first fragment forwarded: rewrite the rest to saddr/daddr
+        };
+
+        struct Entry {
+            Net::FragmentKey key{};
+            Net::IPv4Net     saddr{};
+            Net::IPv4Net     daddr{};
+            Net::Priority    prio  = Net::Priority::Normal;
+            State            state = State::Empty;
+            bool             lan   = false;  // first fragment went back out the LAN port
+            uint32_t         stamp = 0;   // insertion order; lowest in the window is replaced
+        };
+
+        static constexpr size_t SLOTS = 256;
+        static constexpr size_t PROBE = 8;
+
+        // First fragment: (re)start the entry for its datagram as Pending.
+        Entry& begin(const Net::FragmentKey& key) noexcept {
+            const size_t h = slot_of(key);
+            Entry* victim = nullptr;
+            for (size_t i = 0; i < PROBE; ++i) {
+                Entry& e = slots[(h + i) & (SLOTS - 1)];
+                if (e.state != State::Empty && e.key == key) { victim = &e; break; }
+                if (!victim) { victim = &e; continue; }
+                if (victim->state == State::Empty) continue;   // keep the first free slot
+                if (e.state == State::Empty || static_cast<int32_t>(e.stamp - victim->stamp) < 0)
+                    victim = &e;
+            }
+            *victim = Entry{key, key.saddr, key.daddr, Net::Priority::Normal, State::Pending, false, ++clock};
+            return *victim;
+        }
+
+        [[nodiscard]] Entry* find(const Net::FragmentKey& key) noexcept {
+            const size_t h = slot_of(key);
+            for (size_t i = 0; i < PROBE; ++i) {
+                Entry& e = slots[(h + i) & (SLOTS - 1)];
+                if (e.state != State::Empty && e.key == key) return &e;
+            }
+            return nullptr;
+        }
+
+        // First fragment, after the last address rewrite: record the addresses it
+        // leaves with (lan = sent back out the LAN port) and let the rest follow.
+        void commit(const Net::ParsedPacket& pkt, bool lan) noexcept {
+            if (pkt.fragment != Net::FragmentKind::First) return;
+            if (Entry* e = find(pkt.fragment_key)) {
+                e->saddr = pkt.ipv4->saddr;
+                e->daddr = pkt.ipv4->daddr;
+                e->lan   = lan;
+                e->state = State::Committed;
+            }
+        }
+
+        // Later fragment: give it the first fragment's addresses.
+        static void rewrite(Net::ParsedPacket& pkt, const Entry& e) noexcept {
+            auto* ip = pkt.ipv4;
+            if (ip->saddr == e.saddr && ip->daddr == e.daddr) return;
+            ip->saddr = e.saddr;
+            ip->daddr = e.daddr;
+            ip->check = 0;
+            ip->check = Net::ipv4_header_checksum(ip);
+        }
+
+    private:
+        std::array<Entry, SLOTS> slots{};
+        uint32_t clock = 0;
+
+        static size_t slot_of(const Net::FragmentKey& k) noexcept {
+            const uint32_t h = Net::hash_u32(Net::hash_u32(k.saddr.raw(), k.daddr.raw()),
+                                             (static_cast<uint32_t>(k.protocol) << 16) | k.id);
+            return h & (SLOTS - 1);
+        }
+    };
+}
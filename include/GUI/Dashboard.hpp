@@ -119,13 +119,14 @@ class OverviewPage : public QWidget {
     Q_OBJECT
 public:
     explicit OverviewPage(QWidget* parent = nullptr);
-    void refresh(const Telemetry& tel, const std::array<uint64_t, 4>& last_pkts, const std::array<uint64_t, 4>& last_bytes);
+    void refresh(const Telemetry& tel, const std::array<uint64_t, Telemetry::MAX_CORES>& last_pkts,
+                 const std::array<uint64_t, Telemetry::MAX_CORES>& last_bytes);
     void refresh_info();
 private:
     // Overview section
     RealTimePlot* pps_plot;
     RealTimePlot* bps_plot;
-    QLabel* core_labels[4];
+    QLabel* core_labels[Telemetry::MAX_CORES];
     QLabel* lbl_mode;
     // System info section
     QLabel* lbl_hostname;
@@ -383,8 +384,9 @@ private:
     QProgressBar* testing_progress_ = nullptr;
     int           selftest_tick_    = 0;
     static constexpr int SELFTEST_TICKS = 300; // 5s × 60Hz
-    std::array<uint64_t, 4> last_pkts  = {};
-    std::array<uint64_t, 4> last_bytes = {};
+    std::array<uint64_t, Telemetry::MAX_CORES> last_pkts  = {};
+    std::array<uint64_t, Telemetry::MAX_CORES> last_bytes = {};
+    std::array<uint64_t, 2>                    last_dir_bytes = {};  // [0] DL, [1] UL
     uint64_t ui_tick_   = 0;
     uint64_t plot_tick_ = 0;
     std::chrono::steady_clock::time_point plot_last_tick_ = std::chrono::steady_clock::now();
@@ -4,7 +4,14 @@
 #include <atomic>
 #include <array>
 #include <span>
+#include <algorithm>
+#include <cstring>
 #include "NetworkTypes.hpp"
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
 
 namespace HPGTP::Net {
 
@@ -66,31 +73,171 @@ namespace HPGTP::Net {
     };
 #pragma pack(pop)
 
+    // Software prefetch hints for batch processing. Write intent fetches the line in
+    // exclusive state, so the store that follows does not need a second bus transaction.
+    inline void prefetch_read(const void* p) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(p, 0, 3);
+#else
+        (void)p;
+#endif
+    }
+    inline void prefetch_write(const void* p) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(p, 1, 3);
+#else
+        (void)p;
+#endif
+    }
+
+    // One 32-bit hash step shared by every flow table: a single CRC32C instruction on
+    // ARMv8 (-mcpu=cortex-a76) or SSE4.2, a multiply/xor-shift mix elsewhere.
+    inline uint32_t hash_u32(uint32_t seed, uint32_t v) noexcept {
+#if defined(__ARM_FEATURE_CRC32)
+        return __crc32cw(seed, v);
+#elif defined(__SSE4_2__)
+        return _mm_crc32_u32(seed, v);
+#else
+        uint32_t h = (seed ^ v) * 0x9E3779B1u;
+        h ^= h >> 15; h *= 0x85EBCA77u;
+        h ^= h >> 13;
+        return h;
+#endif
+    }
+
+    // Hash of one transport endpoint. Address and port are taken as they sit on the wire.
+    inline uint32_t endpoint_hash(uint32_t ip_nbo, uint16_t port_nbo, uint8_t proto) noexcept {
+        return hash_u32(hash_u32(0xFFFFFFFFu, ip_nbo), (static_cast<uint32_t>(proto) << 16) | port_nbo);
+    }
+
+    // IPv4 header checksum as stored in `check` (zero it first). A one's-complement sum
+    // does not depend on byte order, so the header words are added as they sit in memory.
+    inline uint16_t ipv4_header_checksum(const IPv4Header* ip) noexcept {
+        const auto*  b   = reinterpret_cast<const uint8_t*>(ip);
+        const size_t ihl = static_cast<size_t>(ip->ver_ihl & 0x0Fu) * 4u;
+        uint32_t     sum = 0;
+        for (size_t i = 0; i + 1 < ihl; i += 2) {
+            uint16_t w;
+            std::memcpy(&w, b + i, 2);
+            sum += w;
+        }
+        while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+        return static_cast<uint16_t>(~sum & 0xFFFF);
+    }
+
     // Zero-copy SPSC lock-free ring buffer (cross-core data from data plane to control plane, no mutex)
+    // Capacity must be a power of two: head/tail run freely and are masked on access, so every
+    // slot is usable. Each side caches the other side's index and reloads the shared atomic only
+    // when the cache says full (producer) or empty (consumer).
     template<typename T, size_t Capacity = 1024>
     class SpscRingBuffer {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                      "SpscRingBuffer capacity must be a power of two");
+        static constexpr size_t MASK = Capacity - 1;
+
         std::array<T, Capacity> buffer{};
+        // Consumer cache line: own index + snapshot of the producer's
         alignas(64) std::atomic<size_t> head{0};
+        size_t tail_cache = 0;
+        // Producer cache line: own index + snapshot of the consumer's
         alignas(64) std::atomic<size_t> tail{0};
+        size_t head_cache = 0;
+
+        size_t free_slots(size_t t) {
+            size_t free = Capacity - (t - head_cache);
+            if (free == 0) {
+                head_cache = head.load(std::memory_order_acquire);
+                free = Capacity - (t - head_cache);
+            }
+            return free;
+        }
+
+        size_t push_from(size_t t, std::span<const T> items, size_t n) {
+            for (size_t i = 0; i < n; ++i) buffer[(t + i) & MASK] = items[i];
+            tail.store(t + n, std::memory_order_release);
+            return n;
+        }
+
     public:
         // Data plane call: push
         bool push(const T& item) {
-            size_t current_tail = tail.load(std::memory_order_relaxed);
-            size_t next_tail = (current_tail + 1) % Capacity;
-            if (next_tail == head.load(std::memory_order_acquire)) return false; // Full, discard
-            buffer[current_tail] = item;
-            tail.store(next_tail, std::memory_order_release);
+            const size_t t = tail.load(std::memory_order_relaxed);
+            if (free_slots(t) == 0) return false; // Full, discard
+            buffer[t & MASK] = item;
+            tail.store(t + 1, std::memory_order_release);
             return true;
         }
 
+        // Producer side: as push(), also reporting whether the queue was empty beforehand
+        // (the consumer may be about to sleep or already asleep). Always reloads head.
+        bool push(const T& item, bool& was_empty) {
+            return push_n(std::span<const T>(&item, 1), was_empty) == 1;
+        }
+
+        // Bulk push: copies as many items as fit, publishes them with one release store.
+        size_t push_n(std::span<const T> items) {
+            const size_t t = tail.load(std::memory_order_relaxed);
+            size_t n = items.size();
+            if (n > Capacity - (t - head_cache)) {
+                head_cache = head.load(std::memory_order_acquire);
+                n = std::min(n, Capacity - (t - head_cache));
+            }
+            return push_from(t, items, n);
+        }
+
+        size_t push_n(std::span<const T> items, bool& was_empty) {
+            const size_t t = tail.load(std::memory_order_relaxed);
+            head_cache = head.load(std::memory_order_acquire);
+            was_empty = head_cache == t;
+            return push_from(t, items, std::min(items.size(), Capacity - (t - head_cache)));
+        }
+
         // Control plane call: pop
         bool pop(T& item) {
-            size_t current_head = head.load(std::memory_order_relaxed);
-            if (current_head == tail.load(std::memory_order_acquire)) return false; // Empty
-            item = buffer[current_head]; 
-            head.store((current_head + 1) % Capacity, std::memory_order_release);
+            const size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail_cache) {
+                tail_cache = tail.load(std::memory_order_acquire);
+                if (h == tail_cache) return false; // Empty
+            }
+            item = buffer[h & MASK];
+            head.store(h + 1, std::memory_order_release);
             return true;
         }
+
+        // Bulk pop: up to out.size() items, released back to the producer with one store.
+        size_t pop_n(std::span<T> out) {
+            const size_t h = head.load(std::memory_order_relaxed);
+            size_t avail = tail_cache - h;
+            if (avail < out.size()) {
+                tail_cache = tail.load(std::memory_order_acquire);
+                avail = tail_cache - h;
+            }
+            const size_t n = std::min(avail, out.size());
+            for (size_t i = 0; i < n; ++i) out[i] = buffer[(h + i) & MASK];
+            if (n) head.store(h + n, std::memory_order_release);
+            return n;
+        }
+
+        // Consumer side: nothing left to pop
+        bool empty() const {
+            return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+        }
+    };
+
+    // One fragmented IPv4 datagram as RFC 791 identifies it: every fragment carries the same
+    // four fields, only the first carries the L4 header.
+    struct FragmentKey {
+        IPv4Net  saddr{};
+        IPv4Net  daddr{};
+        uint16_t id = 0;       // NBO — from wire
+        uint8_t  protocol = 0;
+        bool operator==(const FragmentKey&) const = default;
+    };
+
+    enum class FragmentKind : uint8_t {
+        None = 0,  // not fragmented
+        First,     // offset 0, MF set: has the L4 header
+        Later      // offset > 0: payload only, no ports
     };
 
     // Unified zero-copy packet context parser (single parse path for NAT, DNS, QoS, HeuristicProcessor).
@@ -105,6 +252,29 @@ namespace HPGTP::Net {
         size_t l4_offset = 0;
         void* l4_header = nullptr;
 
+        // TCP/UDP flow hash computed once at parse: source endpoint in the high half,
+        // destination endpoint in the low half (0 for other packets). Tables keyed by
+        // one endpoint take a half; tables keyed by the 4-tuple take tuple_hash().
+        uint64_t flow_hash = 0;
+
+        // Set for IPv4 fragments. A Later fragment has no l4_header (and flow_hash 0) even
+        // when the protocol is TCP/UDP/ICMP: its first bytes are payload, not ports.
+        FragmentKind fragment = FragmentKind::None;
+        FragmentKey  fragment_key{};
+
+        uint32_t src_hash() const { return static_cast<uint32_t>(flow_hash >> 32); }
+        uint32_t dst_hash() const { return static_cast<uint32_t>(flow_hash); }
+        uint32_t tuple_hash() const { return hash_u32(src_hash(), dst_hash()); }
+
+        // Recompute after a stage rewrites addresses or ports (NAT, DNS redirect).
+        void rehash() {
+            if (!ipv4 || (l4_protocol != 6 && l4_protocol != 17) || !l4_header) return;
+            uint16_t ports[2];
+            std::memcpy(ports, l4_header, sizeof(ports)); // source, dest: same offsets in TCP and UDP
+            flow_hash = (static_cast<uint64_t>(endpoint_hash(ipv4->saddr.raw(), ports[0], l4_protocol)) << 32)
+                      | endpoint_hash(ipv4->daddr.raw(), ports[1], l4_protocol);
+        }
+
         Net::UDPHeader* udp() const { return (l4_protocol == 17) ? reinterpret_cast<Net::UDPHeader*>(l4_header) : nullptr; }
         Net::TCPHeader* tcp() const { return (l4_protocol == 6) ? reinterpret_cast<Net::TCPHeader*>(l4_header) : nullptr; }
         Net::IcmpEchoHeader* icmp_echo() const {
@@ -129,6 +299,11 @@ namespace HPGTP::Net {
             if (span.size() < p.l4_offset) return p; // Bad packet
             
             p.l4_protocol = p.ipv4->protocol;
+            if (const uint16_t frag = eth_proto_wire_to_host(p.ipv4->frag_off) & 0x3FFF) { // MF | offset
+                p.fragment = (frag & 0x1FFF) ? FragmentKind::Later : FragmentKind::First;
+                p.fragment_key = {p.ipv4->saddr, p.ipv4->daddr, p.ipv4->id, p.l4_protocol};
+                if (p.fragment == FragmentKind::Later) return p;
+            }
             if (p.l4_protocol == 17 && span.size() >= p.l4_offset + sizeof(Net::UDPHeader)) {
                 p.l4_header = span.data() + p.l4_offset;
             } else if (p.l4_protocol == 6 && span.size() >= p.l4_offset + sizeof(Net::TCPHeader)) {
@@ -136,6 +311,7 @@ namespace HPGTP::Net {
             } else if (p.l4_protocol == 1 && span.size() >= p.l4_offset + sizeof(Net::IcmpEchoHeader)) {
                 p.l4_header = span.data() + p.l4_offset;
             }
+            p.rehash();
 
             return p;
         }
@@ -3,30 +3,89 @@
 #include <array>
 #include <atomic>
 #include <cstdint>
+#include <expected>
+#include <mutex>
+#include <optional>
 #include "Headers.hpp"
 #include "Processor.hpp"
+#include "TimerWheel.hpp"
 
 namespace HPGTP::Logic {
     // True zero-copy user-space NAT engine
     class NatEngine {
+        // internal_key with a zero remote half (daddr, dport) is an endpoint-independent
+        // mapping: keyed by (LAN ip, LAN port, protocol) and reachable from any remote.
         struct alignas(64) NatSession {
             std::atomic<uint32_t> seq{0};
             FlowKey internal_key;
             uint16_t external_port = 0;
+            uint8_t  protocol = 0;
             std::atomic<uint32_t> last_active_tick{0};
             std::atomic<bool> active{false};
         };
 
-        struct UpnpMapping {
-            std::atomic<uint32_t> seq{0};
+        struct UpnpMapping {   // NBO ports
             Net::IPv4Net internal_ip{};
             uint16_t     internal_port = 0;
             uint16_t     external_port = 0;
             uint8_t      protocol = 0;
-            alignas(64) std::atomic<bool> active{false};
         };
 
-        static constexpr size_t MAX_SESSIONS = 65536;
+        static constexpr size_t   MAX_SESSIONS    = 65536;
+        static constexpr uint32_t SESSION_TIMEOUT = 300;  // ticks (s) idle before a session expires
+
+        // TCP/UDP sessions live in fixed shards, each with its own slice of the external
+        // port range. Upstream worker w of n owns shards w, w + n, ...: only the owner
+        // creates, reuses or expires sessions in a shard, so that path needs no lock and
+        // no atomic read-modify-write. Other workers only read a shard, under the session
+        // seqlock; a new full-cone mapping alone is created under create_lock_ when there
+        // are several upstream workers. Inbound packets find the shard from the port.
+        static constexpr size_t   MAX_SHARDS      = 8;
+        static constexpr size_t   SHARD_SESSIONS  = MAX_SESSIONS / MAX_SHARDS;
+        static constexpr uint16_t PORT_FIRST      = 10000;
+        static constexpr uint32_t PORTS_PER_SHARD = 50000 / MAX_SHARDS;  // 10000..59999
+        static_assert((SHARD_SESSIONS & (SHARD_SESSIONS - 1)) == 0);
+        static_assert(MAX_SHARDS >= Config::MAX_WORKERS_PER_DIRECTION,
+                      "every upstream worker needs at least one shard");
+
+        // Free external ports of one protocol in a shard's slice. A set bit is a free
+        // port and each summary bit marks a word that still has one, so an allocation
+        // is two find-first-set steps. Owner only; in_use is read by the watchdog.
+        //
+        // reserved marks the ports UPnP / NAT-PMP / PCP mappings hold (set and cleared
+        // by the control plane). A reserved port the owner takes out of free is parked
+        // there instead of used, and goes back once the mapping is gone.
+        struct PortPool {
+            static constexpr size_t WORDS   = (PORTS_PER_SHARD + 63) / 64;
+            static constexpr size_t SUMMARY = (WORDS + 63) / 64;
+            std::array<uint64_t, WORDS>   free{};
+            std::array<uint64_t, SUMMARY> summary{};
+            std::array<uint64_t, WORDS>   parked{};
+            std::array<std::atomic<uint64_t>, WORDS> reserved{};
+            uint32_t              next_word = 0;  // search starts here, spreading reuse
+            std::atomic<uint32_t> in_use{0};
+
+            PortPool();
+            bool    take(uint32_t off) noexcept;   // that port, if free
+            int32_t take_next() noexcept;          // any port; -1 = pool exhausted
+            void    put(uint32_t off) noexcept;
+            bool    is_reserved(uint32_t off) const noexcept;
+            void    park(uint32_t off) noexcept { parked[off / 64] |= uint64_t{1} << (off % 64); }
+            void    reclaim_parked() noexcept;     // parked ports whose mapping is gone
+        };
+        // TCP and UDP have separate pools, so one external port can carry one flow of each.
+        static constexpr size_t POOLS = 2;
+        static constexpr size_t pool_of(uint8_t protocol) noexcept { return protocol == 6 ? 0 : 1; }
+
+        struct Shard {
+            std::array<NatSession, SHARD_SESSIONS> sessions;
+            std::array<std::array<std::atomic<int32_t>, PORTS_PER_SHARD>, POOLS> port_to_slot;  // -1 = free
+            // Owner-only state: the port pools and the expiry wheel.
+            std::array<PortPool, POOLS> pools;
+            TimerWheel<SHARD_SESSIONS> timers;
+            uint16_t port_base = 0;  // host order; first external port of the slice
+        };
+
         static constexpr size_t MAX_ICMP_SESSIONS = 4096;
 
         struct alignas(64) IcmpEchoSession {
@@ -39,23 +98,102 @@ namespace HPGTP::Logic {
             std::atomic<bool>     active{false};
         };
 
-        std::array<NatSession, MAX_SESSIONS> sessions;
-        std::array<std::atomic<int32_t>, 65536> port_to_index{};
+        std::array<Shard, MAX_SHARDS> shards;
+        size_t upstream_workers = 1;  // set before the workers start
 
         std::array<IcmpEchoSession, MAX_ICMP_SESSIONS> icmp_sessions{};
         std::array<std::atomic<int32_t>, 65536>        icmp_id_to_index{};
 
-        std::array<UpnpMapping, 256> upnp_rules{};
-        alignas(64) std::atomic<size_t> upnp_cursor{0};
+        // UPnP port forwards. The control plane keeps the rule list under upnp_mutex_ and
+        // compiles it into the inactive UpnpTable, then flips upnp_active: the data plane
+        // does one direct-indexed load inbound and one short hash probe outbound however
+        // many rules exist. Each table's seq lets a reader still on a table that is being
+        // rebuilt notice and retry on the current one.
+        static constexpr size_t MAX_UPNP_RULES  = 256;
+        static constexpr size_t UPNP_HASH_SLOTS = 2 * MAX_UPNP_RULES;  // outbound index, load <= 1/2
+        struct UpnpTable {
+            std::atomic<uint32_t> seq{0};
+            uint32_t count = 0;
+            std::array<UpnpMapping, MAX_UPNP_RULES> rules{};
+            // Rule index + 1 (0 = none): by external port per protocol pool, and by
+            // (internal ip, internal port, protocol) endpoint hash.
+            std::array<std::array<uint16_t, 65536>, POOLS> by_external{};
+            std::array<uint16_t, UPNP_HASH_SLOTS>          by_internal{};
+        };
+        std::array<UpnpTable, 2>  upnp_tables{};
+        std::atomic<uint32_t>     upnp_active{0};
+        std::atomic<uint32_t>     upnp_count{0};   // rules in the active table; 0 = skip lookups
+
+        // Control-plane rule list (upnp_mutex_): every rule has a lease, armed on the
+        // wheel by list index; removal moves the last rule into the hole.
+        struct UpnpEntry {
+            UpnpMapping          m{};
+            uint32_t             expires_tick = 0;
+            std::array<char, 64> desc{};
+        };
+        std::mutex                               upnp_mutex_;
+        std::array<UpnpEntry, MAX_UPNP_RULES>    upnp_list{};
+        size_t                                   upnp_list_count = 0;
+        TimerWheel<MAX_UPNP_RULES>               upnp_timers;
+        void publish_upnp_locked();
+        size_t find_upnp_locked(uint16_t ext_port_nbo, uint8_t protocol) const noexcept;
+        void   remove_upnp_locked(size_t i) noexcept;
+        // A mapping's external port inside the NAT range is withheld from sessions while
+        // the mapping lives; false if a session holds that port now.
+        bool   reserve_mapped_port(uint16_t ext_port_nbo, uint8_t protocol) noexcept;
+        void   release_mapped_port(uint16_t ext_port_nbo, uint8_t protocol) noexcept;
+        bool upnp_outbound(const Net::ParsedPacket& pkt, uint16_t sport_nbo, UpnpMapping& out) const noexcept;
+        bool upnp_inbound(uint8_t protocol, uint16_t dport_nbo, UpnpMapping& out) const noexcept;
+
+        // Serialises ICMP echo session creation (and the ICMP id cursor) between
+        // upstream workers; TCP/UDP sessions are sharded instead.
+        alignas(64) std::atomic_flag create_lock_{};
+        void lock_create()   { while (create_lock_.test_and_set(std::memory_order_acquire)) { } }
+        void unlock_create() { create_lock_.clear(std::memory_order_release); }
+
+        // Hairpin (NAT loopback) sessions: a LAN client reaching a forward on the WAN
+        // address is sent to the server from the router's LAN address, on a router-side
+        // port that is the session index, so replies map back with one direct load.
+        // Created under the creation lock, read lock-free via seq.
+        static constexpr size_t   MAX_HAIRPIN_SESSIONS = 1024;
+        static constexpr uint16_t HAIRPIN_PORT_FIRST   = 61000;  // above the kernel's ephemeral ports
+        struct alignas(64) HairpinSession {
+            std::atomic<uint32_t> seq{0};
+            Net::IPv4Net client_ip{};
+            Net::IPv4Net server_ip{};
+            uint16_t     client_port = 0;   // NBO
+            uint16_t     server_port = 0;   // NBO
+            uint16_t     ext_port    = 0;   // NBO; the port the client addressed on the WAN IP
+            uint8_t      protocol    = 0;
+            std::atomic<uint32_t> last_active_tick{0};
+            std::atomic<bool>     active{false};
+        };
+        std::array<HairpinSession, MAX_HAIRPIN_SESSIONS> hairpin_sessions{};
 
-        uint16_t     port_cursor = 10000;
         uint16_t     icmp_id_cursor = 25000;
         alignas(64) std::atomic<uint32_t> wan_ip_nbo{0};
         std::atomic<uint32_t> current_tick{0};
 
-        uint32_t hash_flow(const FlowKey& k) const;
         uint32_t hash_icmp_flow(Net::IPv4Net sa, Net::IPv4Net da, uint16_t id_nbo) const;
+        uint32_t hash_hairpin_flow(Net::IPv4Net client, uint16_t client_port_nbo,
+                                   uint16_t ext_port_nbo, uint8_t protocol) const;
+        bool     resolve_inbound(uint8_t protocol, uint16_t dport_nbo, Net::IPv4Net rsaddr,
+                                 uint16_t rsport_nbo, Net::IPv4Net& int_ip, uint16_t& int_port_nbo) noexcept;
         uint16_t alloc_external_icmp_id() noexcept;
+        static bool is_cone_flow(Net::IPv4Net lan_ip, uint16_t sport_nbo, uint16_t dport_nbo) noexcept;
+        size_t   owned_shard(size_t worker, uint32_t h) const noexcept;
+        size_t   preserving_shard(size_t worker, uint16_t sport_nbo) const noexcept;
+        uint16_t find_session(Shard& sh, const FlowKey& key, uint8_t protocol,
+                              uint32_t home, uint32_t tick) noexcept;
+        uint16_t find_for_worker(size_t worker, const FlowKey& key, uint8_t protocol,
+                                 uint32_t h, uint32_t tick) noexcept;
+        uint16_t peek_session(const Shard& sh, const FlowKey& key, uint8_t protocol,
+                              uint32_t home, uint32_t tick) const noexcept;
+        uint16_t find_elsewhere(size_t worker, const FlowKey& key, uint8_t protocol,
+                                uint32_t h, uint32_t tick) const noexcept;
+        uint16_t claim_session(Shard& sh, const FlowKey& key, uint8_t protocol,
+                               uint32_t home, uint32_t tick, int32_t want_off) noexcept;
+        void     release_port(Shard& sh, const NatSession& sess) noexcept;
         bool     process_outbound_icmp(Net::ParsedPacket& pkt);
         bool     process_inbound_icmp(Net::ParsedPacket& pkt);
 
@@ -65,16 +203,56 @@ namespace HPGTP::Logic {
             Net::IPv4Net int_ip{};
             uint16_t     int_port  = 0;
             uint8_t      proto     = 0;
+            uint32_t     lease_s   = 0;   // seconds; 0 = UPNP_MAX_LEASE (also the cap)
+            std::array<char, 64> desc{};  // NUL-terminated
+        };
+        // UPnP IGD error codes reported back as SOAP faults.
+        enum class UpnpError : uint16_t {
+            ArrayIndexInvalid   = 713,
+            NoSuchEntry         = 714,
+            ConflictInMapping   = 718,
+            NoPortMapsAvailable = 728,
         };
+        static constexpr uint32_t UPNP_MAX_LEASE = 604800;  // one week (IGD v2)
 
         explicit NatEngine();
         void set_wan_ip(Net::IPv4Net ip);
         [[nodiscard]] Net::IPv4Net wan_ip_snapshot() const noexcept {
             return Net::IPv4Net{wan_ip_nbo.load(std::memory_order_acquire)};
         }
-        void add_upnp_rule(UpnpRule rule);
+        // UPnP port forwards (control plane; lookups in the data plane stay lock-free).
+        // Adding an existing (external port, protocol) for the same client renews it.
+        // An external port a NAT session is using is a ConflictInMapping.
+        std::expected<void, UpnpError> add_upnp_rule(const UpnpRule& rule);
+        std::expected<void, UpnpError> remove_upnp_rule(uint16_t ext_port, uint8_t proto);
+        // lease_s of the returned rule is the time left.
+        std::expected<UpnpRule, UpnpError> upnp_rule(uint16_t ext_port, uint8_t proto);
+        std::expected<UpnpRule, UpnpError> upnp_rule_at(size_t index);
+        // Drop rules whose lease ran out (watchdog, after tick()).
+        void expire_upnp_rules();
+        // Number of upstream workers sharing the shards (1..MAX_SHARDS); call before
+        // any worker passes packets.
+        void set_upstream_workers(size_t n) noexcept;
         void tick();
-        bool process_outbound(Net::ParsedPacket& pkt);
+        // Expire idle sessions in the shards owned by upstream `worker` (that worker's
+        // thread only; does nothing until the tick has moved).
+        void expire_sessions(size_t worker);
+        bool process_outbound(Net::ParsedPacket& pkt, size_t worker = 0);
         bool process_inbound(Net::ParsedPacket& pkt);
+        // LAN side, TCP/UDP. A packet to the WAN address that hits a UPnP forward or a
+        // full-cone mapping is rewritten to go from router_ip to the server; the server's
+        // reply to router_ip is rewritten back to come from the WAN address. True = the
+        // packet was translated and belongs back on the LAN.
+        bool process_hairpin(Net::ParsedPacket& pkt, Net::IPv4Net router_ip);
+        // Endpoint-independent filtering: the WAN packet targets a live full-cone UDP
+        // mapping, so it is accepted from any remote host (consulted by the firewall).
+        [[nodiscard]] bool accepts_any_remote(const Net::ParsedPacket& pkt) const noexcept;
+        // Batch prefetch: pull the first table line the matching process_* call reads
+        // (home session slot outbound, port index inbound).
+        void prefetch_outbound(const Net::ParsedPacket& pkt, size_t worker = 0) const noexcept;
+        void prefetch_inbound(const Net::ParsedPacket& pkt) const noexcept;
+        // External ports currently mapped for `protocol` (6 or 17), over all shards.
+        [[nodiscard]] size_t ports_in_use(uint8_t protocol) const noexcept;
+        static constexpr size_t port_capacity() noexcept { return PORTS_PER_SHARD * MAX_SHARDS; }
     };
 }
@@ -7,9 +7,45 @@
 #include <string>
 #include <functional>
 #include <cstdint>
+#include <atomic>
+#include <memory>
 #include "Headers.hpp"
 
 namespace HPGTP::Engine {
+    // PACKET_RX_RING layout. V1: fixed 2 KB frames, one status word per frame.
+    // V3: variable-length frames packed into blocks that the kernel retires as a
+    // whole (block full or block_timeout_ms elapsed); one status word per block.
+    enum class RxRingVersion : uint8_t { V1 = 1, V3 = 3 };
+
+    // PACKET_FANOUT demux across the sockets of one interface (one group per
+    // interface, so the two directions are split independently). Hash keeps one
+    // direction of a flow on one socket, hence one worker; the kernel hashes IP
+    // fragments on addresses and protocol only, without ports, so a fragmented
+    // datagram may land on a different socket than the unfragmented packets of its
+    // flow. Cpu follows the CPU the NIC interrupt landed on (RSS / RPS steering).
+    enum class RxFanoutMode : uint8_t { Hash, Cpu };
+
+    struct RxRingOptions {
+        RxRingVersion version          = RxRingVersion::V3;
+        uint32_t      block_timeout_ms = 1;
+        // Join the interface's fanout group (one group per interface per process).
+        bool          fanout           = false;
+        RxFanoutMode  fanout_mode      = RxFanoutMode::Hash;
+        // Hand a frame to the next socket in the group when the selected ring is full.
+        bool          fanout_rollover  = false;
+        // SO_BUSY_POLL budget for poll() on this socket (0 = off); also sets SO_PREFER_BUSY_POLL.
+        uint32_t      busy_poll_us     = 0;
+    };
+
+    // Descriptor for a frame left in place in the mmap'd RX ring. The ring slot
+    // holding it (frame for V1, block for V3) stays with user space until every
+    // acquired frame in it has been passed back through release_rx_frame().
+    struct RxFrameRef {
+        uint8_t* data = nullptr;
+        uint16_t len  = 0;
+        uint32_t slot = 0;
+    };
+
     class RawSocketManager {
         RawSocketManager(const RawSocketManager&) = delete;
         RawSocketManager& operator=(const RawSocketManager&) = delete;
@@ -17,13 +53,31 @@ namespace HPGTP::Engine {
         int fd = -1;
         uint8_t* ring = nullptr;
         size_t ring_size = 0;
-        uint32_t rx_idx = 0;
+        RxRingOptions opts;
+
+        // Ring slot = one frame (V1) or one block (V3); rx_idx is the current slot.
+        uint32_t slot_size = 0;
+        uint32_t slot_nr   = 0;
+        uint32_t rx_idx    = 0;
+
+        // V3 only: cursor inside the block at rx_idx (nullptr = block not entered yet).
+        uint8_t* blk_pkt       = nullptr;
+        uint32_t blk_pkts_left = 0;
+
+        // Outstanding references per slot (zero-copy handoff). The slot goes back
+        // to the kernel when its count drops to zero; for V3 the RX cursor holds
+        // one reference on the block it is walking.
+        std::unique_ptr<std::atomic<uint32_t>[]> slot_refs;
 
         static constexpr uint32_t BLOCK_SIZE = 4096 * 16;
         static constexpr uint32_t FRAME_SIZE = 2048;
         static constexpr uint32_t BLOCK_NR   = 1024;
         static constexpr uint32_t FRAME_NR   = (BLOCK_SIZE * BLOCK_NR) / FRAME_SIZE;
 
+        // V3: same 64 MiB footprint as V1, carved into 1 MiB blocks.
+        static constexpr uint32_t V3_BLOCK_SIZE = 1u << 20;
+        static constexpr uint32_t V3_BLOCK_NR   = 64;
+
         // Avoids exposing <net/if.h> (IFNAMSIZ) to clients
         static constexpr size_t IFACE_NAME_MAX = 16;
         std::array<char, IFACE_NAME_MAX> iface{};
@@ -31,15 +85,26 @@ namespace HPGTP::Engine {
 
         // Kernel ring-buffer helpers — implementation in NetworkEngine.cpp.
         // Hides <poll.h> and <linux/if_packet.h> from all clients.
+        std::expected<void, std::string> setup_ring_v1();
+        std::expected<void, std::string> setup_ring_v3();
+        std::expected<void, std::string> join_fanout(int ifindex);
+        void enable_busy_poll();
         void do_poll(int timeout_ms);
         bool peek_frame(std::span<uint8_t>& out);
         void advance_frame();
+        bool peek_frame_v3(std::span<uint8_t>& out);
+        void advance_frame_v3();
+        void return_slot(uint32_t slot);
+        // Slot status shows TP_STATUS_USER (filled, or still lent to the consumer).
+        bool slot_filled(uint32_t slot) const;
 
     public:
-        explicit RawSocketManager(std::string_view iface_name);
+        explicit RawSocketManager(std::string_view iface_name, RxRingOptions ring_opts = {});
         ~RawSocketManager();
         std::expected<void, std::string> init();
         int get_fd() const { return fd; }
+        // Layout actually in use after init() (V3 falls back to V1 if the kernel refuses it).
+        RxRingVersion ring_version() const { return opts.version; }
 
         void set_poll_error_callback(std::function<void(int err)> cb) {
             poll_error_callback_ = std::move(cb);
@@ -52,8 +117,22 @@ namespace HPGTP::Engine {
         bool peek_rx_frame(std::span<uint8_t>& out) { return peek_frame(out); }
         void finish_rx_frame() { advance_frame(); }
 
+        // Zero-copy handoff: acquire_rx_frame() (RX thread) moves past the next frame
+        // without returning its slot; release_rx_frame() (any one consumer thread)
+        // drops the reference once the frame is no longer read or written.
+        bool acquire_rx_frame(RxFrameRef& out);
+        void release_rx_frame(uint32_t slot) {
+            if (slot_refs[slot].fetch_sub(1, std::memory_order_acq_rel) == 1) return_slot(slot);
+        }
+        // The RX thread can only go on once the consumer releases a slot: the cursor
+        // wrapped onto a slot still lent out, or there is nothing new and the slot
+        // just behind it is lent (packet_poll() reports POLLIN for that state, so
+        // poll() on the socket returns at once). Reads state only.
+        bool rx_waiting_on_release() const;
+
         // poll_and_dispatch must remain in the header — template instantiation
-        // requires the full body to be visible at each call site.
+        // requires the full body to be visible at each call site. With V3 one
+        // wakeup drains every retired block, so a full block is handled per poll.
         template<typename Callback>
         void poll_and_dispatch(Callback&& cb, int timeout_ms = 1) {
             do_poll(timeout_ms);
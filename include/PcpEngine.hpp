@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string>
+#include "NatEngine.hpp"
+
+namespace HPGTP::Logic {
+
+    // NAT-PMP (RFC 6886, version 0) and PCP (RFC 6887, version 2, MAP and ANNOUNCE)
+    // on UDP 5351 of the router's LAN address. One datagram in, one datagram out: the
+    // mapping goes straight into the NatEngine UPnP table with the requested lifetime,
+    // so it shares conflict checks, leases and expiry with IGD mappings.
+    //
+    // No thread of its own: the owner polls poll_fd() and calls on_readable() from its
+    // event loop (the watchdog on Core 1).
+    class PcpEngine {
+        std::shared_ptr<NatEngine> nat_engine;
+        Net::IPv4Net lan_anchor{};
+        int          lan_prefix = 24;
+        int          fd = -1;
+        uint64_t     start_s = 0;   // CLOCK_MONOTONIC at startup; epoch = seconds since
+
+        static constexpr size_t   MAX_PORT_PROBES = 16;    // external ports tried on conflict
+
+        [[nodiscard]] uint32_t epoch() const noexcept;
+        // Map (client, internal port, protocol) for `lifetime` seconds, keeping the
+        // external port the client already holds for it, else `want_ext` or the next
+        // free port after it. Returns the external port.
+        std::expected<uint16_t, NatEngine::UpnpError> map(Net::IPv4Net client, uint8_t proto,
+                                                          uint16_t int_port, uint16_t want_ext,
+                                                          uint32_t lifetime, const char* desc);
+        // Delete the client's mappings for (internal port, protocol); internal port 0 =
+        // all of the client's mappings for the protocol.
+        void unmap(Net::IPv4Net client, uint8_t proto, uint16_t int_port);
+
+        size_t handle_natpmp(Net::IPv4Net client, std::span<const uint8_t> req, std::span<uint8_t> resp);
+        size_t handle_pcp(Net::IPv4Net client, std::span<const uint8_t> req, std::span<uint8_t> resp);
+
+    public:
+        static constexpr size_t MAX_DATAGRAM = 1100;  // PCP message size limit
+
+        PcpEngine(std::shared_ptr<NatEngine> nat, const std::string& router_ip, int prefix_len);
+        ~PcpEngine();
+        PcpEngine(const PcpEngine&)            = delete;
+        PcpEngine& operator=(const PcpEngine&) = delete;
+
+        // Non-blocking UDP socket; -1 if the bind failed (service disabled).
+        [[nodiscard]] int poll_fd() const noexcept { return fd; }
+        // Answer every queued request (call on POLLIN).
+        void on_readable();
+        // One request from `client` (the datagram's source address): the response is
+        // written to resp (at least MAX_DATAGRAM bytes). Returns its length, 0 = no reply.
+        size_t handle_datagram(Net::IPv4Net client, std::span<const uint8_t> req, std::span<uint8_t> resp);
+    };
+}
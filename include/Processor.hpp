@@ -3,8 +3,13 @@
 #include <cstdint>
 #include <cstddef>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include "Headers.hpp"
 #include "Config.hpp"
+#include "TimerWheel.hpp"
+#include "Telemetry.hpp"
 
 namespace HPGTP::Logic {
 
@@ -27,64 +32,173 @@ namespace HPGTP::Logic {
         bool operator==(const FlowKey&) const = default;
     };
 
+    // Cheap monotonic clock for inter-arrival timing: the ARMv8 virtual counter
+    // (54 MHz on the Pi 5, no syscall); steady_clock microseconds elsewhere.
+    inline uint64_t flow_clock_now() noexcept {
+#if defined(__aarch64__)
+        uint64_t v;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+        return v;
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    inline uint64_t flow_clock_hz() noexcept {
+#if defined(__aarch64__)
+        uint64_t f;
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(f));
+        return f;
+#else
+        return 1'000'000;
+#endif
+    }
+
     // Flow statistics
     struct FlowStats {
         uint32_t total_pkts = 0;
         uint32_t large_pkts = 0;
         uint32_t last_pkt   = 0;   // processor-local packet count at last observation
+        // Behavioural features (EWMA, weight 1/8): packet size in 1/16 bytes,
+        // inter-arrival time and its mean deviation in flow_clock ticks.
+        uint32_t last_seen   = 0;  // low 32 bits of flow_clock_now()
+        uint32_t ewma_size16 = 0;
+        uint32_t ewma_iat    = 0;
+        uint32_t ewma_jitter = 0;
+        uint16_t unpublished = 0;  // packets not yet added to the FlowDirectionBoard
         bool is_disguised = false;
+        bool is_realtime  = false;
     };
 
-    // Static flow table based on FNV-1a algorithm (zero dynamic allocation)
+    // Packet counts per direction shared by the downstream and upstream classifiers,
+    // so each side can see whether a flow is two-way. Indexed by the remote endpoint
+    // hash (destination upstream, source downstream), which NAT leaves unchanged.
+    // Workers add in steps of PUBLISH_EVERY packets; a slot taken over by another
+    // flow (tag mismatch) starts again from zero.
+    class FlowDirectionBoard {
+        struct Slot {
+            std::atomic<uint32_t> tag{0};
+            std::atomic<uint32_t> pkts[2]{};
+        };
+        static constexpr size_t SLOTS = 4096;
+        std::array<Slot, SLOTS> slots{};
+
+    public:
+        static constexpr uint16_t PUBLISH_EVERY = 16;
+
+        void publish(uint32_t remote_hash, size_t dir, uint32_t n) {
+            Slot& s = slots[remote_hash % SLOTS];
+            if (s.tag.load(std::memory_order_relaxed) != remote_hash) {
+                s.tag.store(remote_hash, std::memory_order_relaxed);
+                s.pkts[0].store(0, std::memory_order_relaxed);
+                s.pkts[1].store(0, std::memory_order_relaxed);
+            }
+            s.pkts[dir].fetch_add(n, std::memory_order_relaxed);
+        }
+
+        // false when the slot belongs to another flow
+        bool read(uint32_t remote_hash, uint32_t& dir0, uint32_t& dir1) const {
+            const Slot& s = slots[remote_hash % SLOTS];
+            if (s.tag.load(std::memory_order_relaxed) != remote_hash) return false;
+            dir0 = s.pkts[0].load(std::memory_order_relaxed);
+            dir1 = s.pkts[1].load(std::memory_order_relaxed);
+            return true;
+        }
+    };
+
+    // Static flow table with Robin Hood linear probing (zero dynamic allocation).
+    // Entries sit at most max_probe slots past their home bucket, lookups stop at
+    // the first entry closer to its home than the probe, and erase shifts the
+    // rest of the cluster back, so no tombstones are left to lengthen chains.
     template<size_t Capacity = 4096>
     class StaticFlowMap {
+        static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+        static constexpr size_t MASK = Capacity - 1;
+
         struct Entry {
-            FlowKey key{};
+            FlowKey   key{};
             FlowStats stats{};
-            bool occupied = false;
+            uint32_t  hash = 0;      // tuple hash; home bucket = hash & MASK
+            bool      occupied = false;
         };
 
         std::array<Entry, Capacity> table{};
 
-        // FNV-1a byte hash implementation
-        static uint32_t fnv1a_hash(const FlowKey& k) {
-            uint32_t h = 2166136261U;
-            auto process_bytes = [&](const auto& val) {
-                const uint8_t* p = reinterpret_cast<const uint8_t*>(&val);
-                for (size_t i = 0; i < sizeof(val); ++i) {
-                    h ^= p[i]; h *= 16777619U;
-                }
-            };
-            process_bytes(k.saddr); process_bytes(k.daddr);
-            process_bytes(k.sport); process_bytes(k.dport);
-            return h;
+        // Idle expiry on the owner's packet clock, one wheel tick per 2^EXPIRY_SHIFT packets.
+        // Timers are per slot and move with their entry. The wheel keeps its own tick
+        // count and is only ever stepped forward, so the packet counter wrapping does
+        // not send it round the whole 32-bit range.
+        static constexpr uint32_t EXPIRY_SHIFT = 6;
+        static constexpr uint32_t TICK_PKTS    = uint32_t{1} << EXPIRY_SHIFT;
+        TimerWheel<Capacity> timers;
+        uint32_t ticked_pkt = 0;   // packet count of the last wheel tick
+
+        size_t distance(size_t slot) const { return (slot - table[slot].hash) & MASK; }
+
+        void erase_at(size_t i) {
+            timers.cancel(static_cast<uint32_t>(i));
+            size_t j = (i + 1) & MASK;
+            while (table[j].occupied && distance(j) != 0) {
+                table[i] = table[j];
+                timers.move(static_cast<uint32_t>(j), static_cast<uint32_t>(i));
+                i = j;
+                j = (j + 1) & MASK;
+            }
+            table[i].occupied = false;
         }
 
     public:
-        // Find or create flow entity in hot path
-        FlowStats* get_or_create(const FlowKey& key) {
-            uint32_t h = fnv1a_hash(key) % Capacity;
-            for (size_t i = 0; i < Capacity; ++i) {
-                size_t idx = (h + i) % Capacity;
-                if (!table[idx].occupied) {
-                    table[idx].key = key;
-                    table[idx].occupied = true;
-                    table[idx].stats = {};
-                    return &table[idx].stats;
-                }
-                if (table[idx].key == key) {
-                    return &table[idx].stats;
-                }
+        // start_pkt: the owner's packet count when the map is created.
+        explicit StaticFlowMap(uint32_t start_pkt = 0) : ticked_pkt(start_pkt) {}
+
+        // Find or create flow entity in hot path. hash is the packet's
+        // ParsedPacket::tuple_hash(). Returns nullptr when the flow is not present
+        // and inserting it would put it, or an entry it displaces, more than
+        // max_probe slots from home.
+        FlowStats* get_or_create(const FlowKey& key, uint32_t hash, size_t max_probe) {
+            size_t pos = hash & MASK;
+            size_t d   = 0;
+            for (; d < Capacity && table[pos].occupied && distance(pos) >= d; ++d, pos = (pos + 1) & MASK) {
+                if (table[pos].hash == hash && table[pos].key == key) return &table[pos].stats;
             }
-            return nullptr;
+            if (d > max_probe || d >= Capacity) return nullptr;
+
+            // Insert at pos: the cluster up to the next free slot moves one slot right
+            size_t end = pos;
+            for (size_t n = 0; table[end].occupied; ++n, end = (end + 1) & MASK) {
+                if (n + 1 >= Capacity || distance(end) + 1 > max_probe) return nullptr;
+            }
+            for (size_t k = end; k != pos; k = (k - 1) & MASK) {
+                table[k] = table[(k - 1) & MASK];
+                timers.move(static_cast<uint32_t>((k - 1) & MASK), static_cast<uint32_t>(k));
+            }
+            table[pos] = Entry{key, {}, hash, true};
+            // First expiry re-arms at the real deadline once last_pkt is set
+            timers.arm(static_cast<uint32_t>(pos), timers.now() + 1);
+            return &table[pos].stats;
         }
 
-        // Periodically clean up flows idle for more than timeout_pkts packets
-        void cleanup(uint32_t current_pkt, uint32_t timeout_pkts) {
-            for (auto& entry : table) {
-                if (entry.occupied && (current_pkt - entry.stats.last_pkt) > timeout_pkts) {
-                    entry.occupied = false;
-                }
+        // Batch prefetch: pull the home bucket get_or_create() will probe first
+        void prefetch(uint32_t hash) const {
+            Net::prefetch_write(&table[hash & MASK]);
+        }
+
+        // Expire flows idle for more than timeout_pkts packets. Called per packet; only
+        // does work when the wheel ticks, and then only for the flows that are due.
+        void expire(uint32_t current_pkt, uint32_t timeout_pkts) {
+            while (current_pkt - ticked_pkt >= TICK_PKTS) {   // differences only: wrap-safe
+                ticked_pkt += TICK_PKTS;
+                timers.advance(timers.now() + 1, [&](uint32_t idx) {
+                    auto& entry = table[idx];
+                    if (!entry.occupied) return;
+                    const uint32_t idle = current_pkt - entry.stats.last_pkt;
+                    if (idle > timeout_pkts) {
+                        erase_at(idx);
+                        return;
+                    }
+                    timers.arm(idx, timers.now() + ((timeout_pkts - idle) >> EXPIRY_SHIFT) + 1);
+                });
             }
         }
     };
@@ -92,9 +206,67 @@ namespace HPGTP::Logic {
     // Heuristic traffic identification engine
     class HeuristicProcessor {
         StaticFlowMap<4096> flows;
-        uint32_t process_counter = 0;
         uint32_t pkt_count = 0;   // monotonic packet counter — lightweight logical clock
 
+        // Real-time flow fingerprint: small packets at a steady game/voice tick rate,
+        // flowing both ways. Scored every RT_EVAL_EVERY packets once RT_MIN_PKTS seen.
+        static constexpr uint32_t RT_MIN_PKTS       = 32;
+        static constexpr uint32_t RT_EVAL_EVERY     = 16;
+        static constexpr uint32_t RT_MAX_AVG_BYTES  = 320;
+        static constexpr uint32_t RT_MIN_IAT_US     = 4'000;    // 250 pkt/s
+        static constexpr uint32_t RT_MAX_IAT_US     = 100'000;  // 10 pkt/s
+        static constexpr uint32_t RT_MAX_SYMMETRY   = 4;        // heavier side ≤ 4× the lighter
+        uint32_t rt_min_iat = 0;   // thresholds in flow_clock ticks
+        uint32_t rt_max_iat = 0;
+        uint32_t rt_iat_cap = 0;   // one second: longer gaps are idle periods, not jitter
+
+        std::shared_ptr<FlowDirectionBoard> board;
+        size_t                              board_dir = 0;
+
+        void observe(FlowStats& st, const Net::ParsedPacket& parsed) {
+            const uint32_t now  = static_cast<uint32_t>(flow_clock_now());
+            const uint32_t size = static_cast<uint32_t>(parsed.raw_span.size()) << 4;
+            if (st.total_pkts == 1) {
+                st.ewma_size16 = size;
+            } else {
+                const uint32_t iat = std::min(now - st.last_seen, rt_iat_cap);
+                st.ewma_size16 = st.ewma_size16 - (st.ewma_size16 >> 3) + (size >> 3);
+                if (st.total_pkts == 2) {
+                    st.ewma_iat = iat;
+                } else {
+                    const uint32_t dev = iat > st.ewma_iat ? iat - st.ewma_iat : st.ewma_iat - iat;
+                    st.ewma_jitter = st.ewma_jitter - (st.ewma_jitter >> 3) + (dev >> 3);
+                    st.ewma_iat    = st.ewma_iat - (st.ewma_iat >> 3) + (iat >> 3);
+                }
+            }
+            st.last_seen = now;
+
+            if (board && ++st.unpublished >= FlowDirectionBoard::PUBLISH_EVERY) {
+                board->publish(remote_hash(parsed), board_dir, st.unpublished);
+                st.unpublished = 0;
+            }
+            if (st.total_pkts >= RT_MIN_PKTS && st.total_pkts % RT_EVAL_EVERY == 0)
+                st.is_realtime = score_realtime(st, parsed) >= 2;
+        }
+
+        // Small average size is required; then one point each for a game-like packet
+        // rate, a steady tick (jitter under half the interval) and two-way traffic.
+        int score_realtime(const FlowStats& st, const Net::ParsedPacket& parsed) const {
+            if (st.ewma_size16 > (RT_MAX_AVG_BYTES << 4)) return 0;
+            int score = 0;
+            if (st.ewma_iat >= rt_min_iat && st.ewma_iat <= rt_max_iat) ++score;
+            if (st.ewma_jitter * 2 <= st.ewma_iat) ++score;
+            uint32_t d0 = 0, d1 = 0;
+            if (board && board->read(remote_hash(parsed), d0, d1) && d0 && d1
+                && std::max(d0, d1) <= std::min(d0, d1) * RT_MAX_SYMMETRY)
+                ++score;
+            return score;
+        }
+
+        uint32_t remote_hash(const Net::ParsedPacket& parsed) const {
+            return board_dir ? parsed.dst_hash() : parsed.src_hash();
+        }
+
         using ProtocolHandler =
             Net::Priority (*)(HeuristicProcessor*, const Net::ParsedPacket&);
         std::array<ProtocolHandler, 256> protocol_handlers;
@@ -111,7 +283,9 @@ namespace HPGTP::Logic {
             if (dport == 53 || sport == 53) return Net::Priority::Critical;
 
             FlowKey key{ parsed.ipv4->saddr, parsed.ipv4->daddr, sport, dport };
-            auto* stats = self->flows.get_or_create(key);
+            auto* stats = self->flows.get_or_create(key, parsed.tuple_hash(), Config::FLOW_PROBE_LIMIT);
+            if (!stats)
+                Telemetry::instance().flow_table_drops.fetch_add(1, std::memory_order_relaxed);
 
             if (stats) {
                 stats->total_pkts++;
@@ -123,16 +297,16 @@ namespace HPGTP::Logic {
                     if (stats->large_pkts > Config::PUNISH_TRIGGER_COUNT) stats->is_disguised = true;
                 }
                 if (stats->is_disguised) return Net::Priority::Normal;
+                self->observe(*stats, parsed);
             }
+            const bool realtime = stats && stats->is_realtime;
 
             ++self->pkt_count;
 
-            // Periodic cleanup: expire flows not seen in 3 × CLEANUP_INTERVAL packets
-            if (++self->process_counter > Config::CLEANUP_INTERVAL_PKTS) {
-                self->flows.cleanup(self->pkt_count, Config::CLEANUP_INTERVAL_PKTS * 3);
-                self->process_counter = 0;
-            }
+            // Expire flows not seen in 3 × CLEANUP_INTERVAL packets (timer wheel, no sweep)
+            self->flows.expire(self->pkt_count, Config::CLEANUP_INTERVAL_PKTS * 3);
 
+            if (realtime) return Net::Priority::High;
             if (Config::is_game_port(dport) || Config::is_game_port(sport)) return Net::Priority::High;
             return parsed.raw_span.size() < 256 ? Net::Priority::High : Net::Priority::Normal;
         }
@@ -155,11 +329,27 @@ namespace HPGTP::Logic {
 
     public:
         HeuristicProcessor() {
+            const uint64_t per_ms = std::max<uint64_t>(flow_clock_hz() / 1000, 1);
+            rt_min_iat = static_cast<uint32_t>(per_ms * RT_MIN_IAT_US / 1000);
+            rt_max_iat = static_cast<uint32_t>(per_ms * RT_MAX_IAT_US / 1000);
+            rt_iat_cap = static_cast<uint32_t>(per_ms * 1000);
             protocol_handlers.fill(handle_default);
             protocol_handlers[17] = handle_udp;
             protocol_handlers[6] = handle_tcp;
         }
 
+        // Share per-direction packet counts with the opposite worker's classifier.
+        void attach_direction_board(std::shared_ptr<FlowDirectionBoard> b, bool upstream) {
+            board     = std::move(b);
+            board_dir = upstream ? 1 : 0;
+        }
+
+        // Batch prefetch ahead of process(): only UDP consults the flow table
+        void prefetch(const Net::ParsedPacket& parsed) const {
+            if (!parsed.is_valid_ipv4() || !parsed.udp()) return;
+            flows.prefetch(parsed.tuple_hash());
+        }
+
         // Main identification entry point
         Net::Priority process(const Net::ParsedPacket& parsed) {
             if (!parsed.is_valid_ipv4()) return Net::Priority::Normal;
@@ -9,6 +9,7 @@
 #include "Headers.hpp"
 #include "Telemetry.hpp"
 #include "Units.hpp"
+#include "DataPlane.hpp"
 
 namespace HPGTP::Traffic {
 
@@ -95,6 +96,13 @@ namespace HPGTP::Traffic {
             return { slot.payload, slot.size };
         }
 
+        // i-th queued packet from the front (i < size()).
+        std::span<const uint8_t> peek(size_t i) const {
+            if (i >= count) return {};
+            const auto& slot = pool[(head + i) % Capacity];
+            return { slot.payload, slot.size };
+        }
+
         void pop() {
             if (count > 0) { head = (head + 1) % Capacity; count--; }
         }
@@ -111,6 +119,13 @@ namespace HPGTP::Traffic {
         ZeroAllocRingBuffer<8192> normal_queue;
         TokenBucket               bucket;
         std::atomic_flag          spin_{};
+        // Held by the one worker draining the queue; siblings of the same direction skip.
+        std::atomic_flag          draining_{};
+
+        // Frames drained per sendmmsg(2) call when the port has no TX ring.
+        static constexpr size_t TX_BATCH = 32;
+
+        void process_queue_batched(int tx_fd);
 
         void lock_spin() {
             while (spin_.test_and_set(std::memory_order_acquire)) { }
@@ -138,6 +153,7 @@ namespace HPGTP::Traffic {
 
         void set_rate_limit(Mbps limit);
         void enqueue_normal(std::span<const uint8_t> pkt);
-        void process_queue(int tx_fd);
+        void process_queue(const DataPlane::TxPort& tx);
+        void process_queue(int tx_fd) { process_queue(DataPlane::TxPort{tx_fd}); }
     };
 }
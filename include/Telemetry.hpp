@@ -10,6 +10,12 @@
 
 namespace HPGTP {
 
+    // Bits in CoreMetrics::role: data-plane workers pinned to that core (set once at App::start).
+    enum CoreRole : uint8_t {
+        CORE_ROLE_DOWNSTREAM = 1u << 0,   // WAN → LAN worker
+        CORE_ROLE_UPSTREAM   = 1u << 1,   // LAN → WAN worker
+    };
+
     // Core metrics slot (L1 cache line aligned)
     // Forced alignment to 64 bytes ensures each CPU core's stats updates don't trigger cache line bouncing
     struct alignas(64) CoreMetrics {
@@ -20,11 +26,28 @@ namespace HPGTP {
         std::atomic<uint64_t> dropped[3]{ 0, 0, 0 };
         std::atomic<uint64_t> last_heartbeat{ 0 };
         std::atomic<int>      cpu_load_pct{ 0 };  // 0-100, updated by watchdog 1Hz via /proc/stat
+        std::atomic<uint8_t>  role{ 0 };          // CoreRole bits
+        // Worker processing thread idle behaviour (BUSY_POLL_US): spin windows that
+        // caught a frame before the budget ran out vs. times it blocked on its eventfd.
+        std::atomic<uint64_t> busy_spin_hits{ 0 };
+        std::atomic<uint64_t> idle_sleeps{ 0 };
+        std::atomic<uint64_t> doorbell_writes{ 0 };  // RX → processing eventfd writes
+    };
+
+    // Per-direction traffic totals, independent of how workers are pinned to cores.
+    struct alignas(64) DirectionMetrics {
+        std::atomic<uint64_t> pkts{ 0 };
+        std::atomic<uint64_t> bytes{ 0 };
     };
 
     struct Telemetry {
         // Allocate independent 64-byte cache blocks for each CPU core
-        std::array<CoreMetrics, 4> core_metrics{};
+        static constexpr size_t MAX_CORES = 16;
+        std::array<CoreMetrics, MAX_CORES> core_metrics{};
+        // CPUs in use: min(online CPUs, MAX_CORES); written once by App::start, read by GUI/watchdog.
+        std::atomic<uint8_t> core_count{ 4 };
+        // [0] = downstream (WAN → LAN), [1] = upstream (LAN → WAN); summed over all workers.
+        std::array<DirectionMetrics, 2> direction_metrics{};
 
         // Diagnostics and control data (low-frequency read/write, no need for separation)
         std::atomic<bool> effective_bridge_mode{ false };
@@ -63,6 +86,12 @@ namespace HPGTP {
         // Firewall conntrack: track_outbound could not insert (linear probe exhausted).
         std::atomic<uint64_t> conntrack_track_drops{0};
 
+        // Classifier flow table: new flow not tracked (FLOW_PROBE_LIMIT reached).
+        std::atomic<uint64_t> flow_table_drops{0};
+
+        // NAT: new TCP/UDP flow not mapped because its shard's port pool was empty.
+        std::atomic<uint64_t> nat_port_exhausted{0};
+
         // Device table: scanned from /proc/net/arp by Core 1 watchdog every 5s.
         // Plain char arrays — torn reads acceptable for display-only data.
         static constexpr uint8_t MAX_TRACKED_DEVICES = 64;
@@ -128,9 +157,10 @@ namespace HPGTP {
             void reset() { *this = BatchStats{}; }
         };
 
-        // Zero-contention batch commit: core N writes only to slot N.
-        void commit_batch(const BatchStats& s, int core_id) {
-            if (core_id < 0 || core_id >= 4) return;
+        // Batch commit: core N writes only to slot N (shared only by workers pinned to N);
+        // the direction totals take one add per batch, not per packet.
+        void commit_batch(const BatchStats& s, int core_id, size_t direction) {
+            if (core_id < 0 || core_id >= static_cast<int>(MAX_CORES) || direction > 1) return;
             auto& m = core_metrics[core_id];
             
             m.pkts.fetch_add(s.pkts, std::memory_order_relaxed);
@@ -140,6 +170,8 @@ namespace HPGTP {
                 m.prio_pkts[i].fetch_add(s.prio_pkts[i], std::memory_order_relaxed);
                 m.prio_bytes[i].fetch_add(s.prio_bytes[i], std::memory_order_relaxed);
             }
+            direction_metrics[direction].pkts.fetch_add(s.pkts, std::memory_order_relaxed);
+            direction_metrics[direction].bytes.fetch_add(s.bytes, std::memory_order_relaxed);
             // Removed time(nullptr) syscall here, heartbeat tick incremented by idle loop
         }
     };
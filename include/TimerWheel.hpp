@@ -0,0 +1,135 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace HPGTP::Logic {
+
+    // Hierarchical timer wheel over the slots of a fixed-size table (zero allocation).
+    // A timer is identified by its table index; each index has at most one timer and
+    // arming it again moves it. Level 0 has 2^Bits one-tick buckets; a level-l bucket
+    // spans 2^(Bits*l) ticks and is cascaded into the levels below when the wheel
+    // reaches it. arm(), cancel() and each expiry are O(1), and advance() only visits
+    // buckets that are due instead of sweeping the table.
+    //
+    // Owners arm an entry when it is created and re-arm it from the expiry callback
+    // if its real deadline has moved since (refreshes on the packet path never touch
+    // the wheel). Not thread-safe: the owner serialises all calls.
+    template<size_t Capacity, size_t Bits = 8, size_t Levels = 3>
+    class TimerWheel {
+        static_assert(Bits * Levels < 32, "wheel span must fit in a 32-bit tick");
+        static_assert(Capacity < UINT32_MAX);
+
+        static constexpr size_t   SLOTS = size_t{1} << Bits;
+        static constexpr uint32_t MASK  = SLOTS - 1;
+        static constexpr uint32_t NIL   = UINT32_MAX;
+        // Furthest deadline that still lands in the top level without wrapping onto
+        // the bucket the wheel is in; later deadlines fire early and get re-armed.
+        static constexpr uint32_t MAX_DELTA = static_cast<uint32_t>(SLOTS - 2) << (Bits * (Levels - 1));
+
+        struct Node {
+            uint32_t next   = NIL;
+            uint32_t prev   = NIL;
+            uint32_t expire = 0;
+            uint32_t bucket = NIL;  // index into heads; NIL = not armed
+        };
+
+        std::array<Node, Capacity>           nodes{};
+        std::array<uint32_t, SLOTS * Levels> heads;
+        uint32_t now_ = 0;
+
+        // Lowest level whose higher digits match now_: the bucket at that level is
+        // reached (fired or cascaded) no later than the deadline.
+        void link(uint32_t idx) {
+            Node& n = nodes[idx];
+            size_t level = 0;
+            while (level + 1 < Levels
+                   && (n.expire >> (Bits * (level + 1))) != (now_ >> (Bits * (level + 1))))
+                ++level;
+            const uint32_t b = static_cast<uint32_t>(level * SLOTS + ((n.expire >> (Bits * level)) & MASK));
+            n.bucket = b;
+            n.prev   = NIL;
+            n.next   = heads[b];
+            if (n.next != NIL) nodes[n.next].prev = idx;
+            heads[b] = idx;
+        }
+
+        void unlink(uint32_t idx) {
+            Node& n = nodes[idx];
+            if (n.prev != NIL) nodes[n.prev].next = n.next;
+            else               heads[n.bucket]    = n.next;
+            if (n.next != NIL) nodes[n.next].prev = n.prev;
+            n.next = n.prev = n.bucket = NIL;
+        }
+
+        void cascade(size_t level, uint32_t digit) {
+            const size_t b = level * SLOTS + digit;
+            uint32_t i = heads[b];
+            heads[b] = NIL;
+            while (i != NIL) {
+                const uint32_t next = nodes[i].next;
+                link(i);
+                i = next;
+            }
+        }
+
+    public:
+        explicit TimerWheel(uint32_t start = 0) : now_(start) { heads.fill(NIL); }
+
+        uint32_t now() const { return now_; }
+        bool armed(uint32_t idx) const { return nodes[idx].bucket != NIL; }
+
+        // Fire at tick `expire` (clamped to at least the next tick).
+        void arm(uint32_t idx, uint32_t expire) {
+            if (armed(idx)) unlink(idx);
+            const uint32_t delta = expire - now_;
+            if (delta == 0 || delta > MAX_DELTA)
+                expire = now_ + (static_cast<int32_t>(delta) <= 0 ? 1 : MAX_DELTA);
+            nodes[idx].expire = expire;
+            link(idx);
+        }
+
+        void cancel(uint32_t idx) {
+            if (armed(idx)) unlink(idx);
+        }
+
+        // The entry at `from` moved to `to` (tables that shift entries): its timer
+        // follows with the same deadline. Any timer already at `to` is dropped.
+        void move(uint32_t from, uint32_t to) {
+            cancel(to);
+            if (!armed(from)) return;
+            nodes[to].expire = nodes[from].expire;
+            unlink(from);
+            link(to);
+        }
+
+        // Turn the wheel to `now`, calling on_expire(idx) for every timer that comes
+        // due. The callback may arm, cancel or move any timer; a due timer moved to
+        // another index still fires in this call. Returns the number of expiries.
+        template<typename OnExpire>
+        size_t advance(uint32_t now, OnExpire&& on_expire) {
+            size_t fired = 0;
+            while (now_ != now) {
+                ++now_;
+                // Top level first, so entries cascaded from it can land in a lower
+                // bucket that is cascaded in this same step.
+                size_t rolled = 0;
+                while (rolled + 1 < Levels && (now_ & ((uint32_t{1} << (Bits * (rolled + 1))) - 1)) == 0)
+                    ++rolled;
+                for (size_t l = rolled; l >= 1; --l)
+                    cascade(l, (now_ >> (Bits * l)) & MASK);
+
+                // One at a time from the head: arm() never targets this bucket
+                // (deadlines are at least now_ + 1), so the loop terminates.
+                const uint32_t b = now_ & MASK;
+                while (heads[b] != NIL) {
+                    const uint32_t i = heads[b];
+                    unlink(i);
+                    on_expire(i);
+                    ++fired;
+                }
+            }
+            return fired;
+        }
+    };
+}
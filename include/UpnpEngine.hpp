@@ -1,38 +1,68 @@
 #pragma once
 #include <array>
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <atomic>
 #include <memory>
-#include "Headers.hpp"
 #include "NatEngine.hpp"
 
 namespace HPGTP::Logic {
 
+    struct HttpReply;   // response being assembled into a connection's send buffer
+
     class UpnpEngine {
-        struct SoapRequestJob {
-            int cfd = -1;
-            uint16_t len = 0;
-            std::array<char, 2048> buf{};
+        // One keep-alive HTTP/1.1 connection to the SOAP port. Requests are parsed
+        // from rx as bytes arrive; a response is built into tx and drained on
+        // EPOLLOUT before the next pipelined request is looked at.
+        static constexpr size_t   MAX_HTTP_CONNS = 16;
+        static constexpr size_t   HTTP_RX_MAX    = 4096;  // headers + body of one request
+        static constexpr size_t   HTTP_TX_MAX    = 4096;
+        static constexpr uint64_t HTTP_IDLE_MS   = 10000; // no progress for this long: close
+        struct HttpConn {
+            int      fd = -1;
+            uint32_t rx_len = 0;
+            uint32_t tx_off = 0;
+            uint32_t tx_len = 0;
+            bool     want_write = false;      // tx backed up: polled for EPOLLOUT, not EPOLLIN
+            bool     close_after_tx = false;
+            uint64_t last_active_ms = 0;
+            std::array<char, HTTP_RX_MAX> rx{};
+            std::array<char, HTTP_TX_MAX> tx{};
         };
 
-        std::thread ssdp_thread;
-        std::thread soap_thread;
-        std::thread soap_worker_thread;
+        std::thread server_thread;
         std::atomic<bool> running{false};
         std::shared_ptr<NatEngine> nat_engine;
         std::string router_ip_str;
 
-        Net::SpscRingBuffer<SoapRequestJob, 64> soap_jobs{};
+        int epoll_fd       = -1;
+        int ssdp_fd        = -1;
         int soap_listen_fd = -1;
-        int soap_job_notify_efd = -1;
-        int shutdown_efd = -1;
+        int shutdown_efd   = -1;
+        std::array<HttpConn, MAX_HTTP_CONNS> conns{};
+
+        // SSDP (UDP 1900) and SOAP (TCP 5000) on one epoll loop, pinned to Core 1.
+        void run();
+        bool open_ssdp();
+        bool open_soap();
+        void on_ssdp_readable();
+        void on_soap_accept();
+        void on_conn_readable(HttpConn& c);
+        void on_conn_writable(HttpConn& c);
+        // Answer every complete request buffered in rx while tx is free.
+        void serve_requests(HttpConn& c);
+        // Send what is left of tx; true once it is empty and the connection stays open.
+        bool flush(HttpConn& c);
+        void close_conn(HttpConn& c);
+        void expire_idle_conns(uint64_t now_ms);
+        void watch_conn(const HttpConn& c);
 
-        void run_ssdp_server();
-        void run_soap_server();
-        void run_soap_worker();
-        void dispatch_soap_http(int cfd, std::string_view req);
+        void dispatch_soap_http(HttpReply& reply, std::string_view method, std::string_view target,
+                                std::string_view body);
+        // POST /control body: port mapping actions, answered with a response or a UPnP fault.
+        void dispatch_soap_action(HttpReply& reply, std::string_view body);
 
     public:
         // Bit 0 = SSDP bind failed, Bit 1 = SOAP bind failed, Bit 2 = SOAP listen failed
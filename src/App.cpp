@@ -1,5 +1,6 @@
 #include "App.hpp"
 #include "DataPlane.hpp"
+#include "FragmentTable.hpp"
 #include "GUI/Dashboard.hpp"
 // POSIX C headers — visible only in this translation unit, hidden from all
 // clients that include App.hpp.
@@ -12,6 +13,7 @@
 #include <cstring>
 #include <dirent.h>
 #include <sys/eventfd.h>
+#include <sched.h>
 #include <ctime>
 #include <cstdio>
 #include <cstdlib>
@@ -25,12 +27,15 @@
 #include <atomic>
 #include <netinet/in.h>
 #include <optional>
+#include <chrono>
+#include <bit>
 
 namespace HPGTP {
 
 namespace {
 
-// RX thread uses poll(2) on the raw socket plus stop_efd (-1 timeout). Egress uses DataPlane::TxFrameOutput.
+// RX thread uses poll(2) on the raw socket plus stop_efd (-1 timeout). Egress uses
+// DataPlane::TxFrameOutput on a TxPort (PACKET_TX_RING when enabled, flushed per pass).
 
 static std::string trim_ws(const std::string& s) {
     size_t a = s.find_first_not_of(" \t\r\n");
@@ -91,16 +96,6 @@ struct alignas(64) ForwardL2Snapshot {
 static std::array<ForwardL2Snapshot, 2> g_fwd_snap{};
 static std::atomic<unsigned>            g_fwd_active{0};
 
-static uint16_t ip_header_checksum_fold(const Net::IPv4Header* ip) noexcept {
-    const auto* w = reinterpret_cast<const uint8_t*>(ip);
-    const size_t  ihl = static_cast<size_t>(ip->ver_ihl & 0x0Fu) * 4u;
-    uint32_t      sum = 0;
-    for (size_t i = 0; i + 1 < ihl; i += 2)
-        sum += (uint32_t(w[i]) << 8) | w[i + 1];
-    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
-    return static_cast<uint16_t>(~sum & 0xFFFF);
-}
-
 static uint16_t icmp_body_checksum_fold(const uint8_t* icmp, size_t icmp_len) noexcept {
     uint32_t sum = 0;
     for (size_t i = 0; i + 1 < icmp_len; i += 2)
@@ -177,7 +172,7 @@ static void refresh_forward_layer2_macs() {
 
 // ─── Packet routing context (internal to data plane) ─────────────────────────
 struct RouteContext {
-    int tx_fd;
+    DataPlane::TxPort                tx;
     std::shared_ptr<Traffic::Shaper> shaper;
 };
 using RouteFunc = void (*)(const RouteContext&, std::span<uint8_t>, size_t, int);
@@ -186,7 +181,7 @@ using RouteFunc = void (*)(const RouteContext&, std::span<uint8_t>, size_t, int)
 
 void fast_path_handler(const RouteContext& ctx, std::span<uint8_t> pkt,
                         size_t prio_idx, int core_id) {
-    DataPlane::TxFrameOutput::send_best_effort(ctx.tx_fd, pkt, core_id, prio_idx);
+    DataPlane::TxFrameOutput::send_best_effort(ctx.tx, pkt, core_id, prio_idx);
 }
 
 void shaper_handler(const RouteContext& ctx, std::span<uint8_t> pkt,
@@ -201,11 +196,14 @@ void shaper_handler(const RouteContext& ctx, std::span<uint8_t> pkt,
 class PacketConsumer {
 public:
     int rx_fd;
-    int tx_fd;
-    int tx_fd_lan;
+    DataPlane::TxPort tx;
+    DataPlane::TxPort tx_lan;
     int core_id;
+    WorkerDirection direction;
+    size_t worker_index;
     Telemetry::BatchStats          stats;
     Logic::HeuristicProcessor      processor;
+    Logic::FragmentTable           fragments;
     RouteContext                   ctx;
     std::shared_ptr<Logic::NatEngine>      nat_engine;
     std::shared_ptr<Logic::DnsEngine>      dns_engine;
@@ -218,16 +216,38 @@ public:
     std::array<std::array<RouteFunc, 3>, 2> routes;
 
     using PipelineStep = bool (*)(PacketConsumer&, Net::ParsedPacket&);
+    // Issues the cache-line prefetch for the table bucket a step is about to touch.
+    using PrefetchStep = void (*)(PacketConsumer&, const Net::ParsedPacket&);
+
+    // Control-plane state read by the steps, snapshotted once per batch (or per
+    // on_packet_event call) instead of re-loading each atomic per packet per step.
+    struct BatchFlags {
+        bool     dhcp       = false;
+        bool     nat        = false;
+        bool     firewall   = false;
+        size_t   route_mode = 0;  // routes[] row: 0 = acceleration, 1 = bridge
+        unsigned fwd_idx    = 0;  // g_fwd_snap buffer in use
+        size_t   qos_idx    = 0;  // qos_config->buffers in use
+        size_t   device_idx = 0;  // device_shaper->buffers in use
+    };
+    BatchFlags flags;
+
+    // Packets handled per on_packet_batch() call (one bit each in the live mask).
+    static constexpr size_t MAX_BATCH = 32;
+    static_assert(MAX_BATCH <= 32, "the live mask in on_packet_batch() is a uint32_t");
 
     // Ordered pipeline stages; each step returns true if it handled the packet.
+    // prefetch[i] (optional) runs over the whole batch right before steps[i].
     struct PacketPipeline {
-        std::array<PipelineStep, 12> steps{};
+        std::array<PipelineStep, 14> steps{};
+        std::array<PrefetchStep, 14> prefetch{};
     };
     PacketPipeline pipeline;
 
     PacketConsumer(int rx_fd_, const PacketWorkerConfig& cfg)
-        : rx_fd(rx_fd_), tx_fd(cfg.tx_fd), tx_fd_lan(cfg.tx_fd_lan), core_id(cfg.core_id),
-          ctx{cfg.tx_fd, cfg.route_shaper},
+        : rx_fd(rx_fd_), tx(cfg.tx), tx_lan(cfg.tx_lan), core_id(cfg.core_id),
+          direction(cfg.direction), worker_index(cfg.worker_index),
+          ctx{cfg.tx, cfg.route_shaper},
           nat_engine(cfg.nat_engine), dns_engine(cfg.dns_engine),
           qos_config(cfg.qos_config), device_shaper(cfg.device_shaper),
           dhcp_engine(cfg.dhcp_engine),
@@ -238,38 +258,123 @@ public:
             { fast_path_handler, fast_path_handler, fast_path_handler } // bridge
         }};
 
+        if (cfg.flow_board)
+            processor.attach_direction_board(cfg.flow_board, direction == WorkerDirection::Upstream);
+
         // Pipeline steps are fixed at construction (no per-packet branch to select a path).
-        if (core_id == 2) {
-            // Core 2 WAN→LAN: DNAT first, then DNS response rewrite (needs
+        if (direction == WorkerDirection::Downstream) {
+            // WAN→LAN: DNAT first, then DNS response rewrite (needs
             // client-side (ip, port)), then device block on real LAN IP.
+            // Later IP fragments take the addresses the first one had after both.
             pipeline.steps = {{
-                step_dhcp_interceptor,
+                step_fragment_follow, step_dhcp_interceptor,
                 step_firewall_inbound, step_nat_downstream,
-                step_dns_response,
+                step_dns_response, step_fragment_commit,
                 step_eth_rewrite_wan_to_lan,
                 step_block_device_downstream, step_device_shaper_downstream,
                 step_ip_shaper_downstream, step_qos_routing,
                 nullptr, nullptr, nullptr
             }};
         } else {
-            // Core 3 LAN→WAN: block and SNAT before sending upstream
+            // LAN→WAN: block and SNAT before sending upstream. Hairpin runs before the
+            // subnet forward, which would drop the server replies addressed to the router.
             pipeline.steps = {{
+                step_fragment_follow,
                 step_dhcp_interceptor, step_dns_interceptor,
-                step_lan_subnet_forward,
+                step_nat_hairpin, step_lan_subnet_forward,
                 step_local_delivery_blocker, step_block_device_upstream,
-                step_firewall_track_outbound, step_nat_downstream,
-                step_nat_upstream, step_eth_rewrite_lan_to_wan,
+                step_firewall_track_outbound,
+                step_nat_upstream, step_fragment_commit, step_eth_rewrite_lan_to_wan,
                 step_device_shaper_upstream,
                 step_ip_shaper_upstream, step_qos_routing
             }};
         }
+        for (size_t i = 0; i < pipeline.steps.size(); ++i)
+            pipeline.prefetch[i] = prefetch_for(pipeline.steps[i]);
+    }
+
+    // ── Batch prefetch ────────────────────────────────────────────────────────
+    // Only the steps that hash into a large table have one; the rest stay nullptr.
+
+    static PrefetchStep prefetch_for(PipelineStep step) {
+        if (step == step_firewall_inbound)        return prefetch_firewall_inbound;
+        if (step == step_firewall_track_outbound) return prefetch_firewall_outbound;
+        if (step == step_nat_downstream)          return prefetch_nat_inbound;
+        if (step == step_nat_upstream)            return prefetch_nat_outbound;
+        if (step == step_qos_routing)             return prefetch_qos_flow;
+        return nullptr;
+    }
+
+    static void prefetch_firewall_inbound(PacketConsumer& self, const Net::ParsedPacket& pkt) {
+        if (self.flags.firewall && self.firewall_engine) self.firewall_engine->prefetch_inbound(pkt);
+    }
+
+    static void prefetch_firewall_outbound(PacketConsumer& self, const Net::ParsedPacket& pkt) {
+        if (self.flags.firewall && self.firewall_engine) self.firewall_engine->prefetch_outbound(pkt);
+    }
+
+    static void prefetch_nat_inbound(PacketConsumer& self, const Net::ParsedPacket& pkt) {
+        if (self.flags.nat && self.nat_engine) self.nat_engine->prefetch_inbound(pkt);
+    }
+
+    static void prefetch_nat_outbound(PacketConsumer& self, const Net::ParsedPacket& pkt) {
+        if (self.flags.nat && self.nat_engine) self.nat_engine->prefetch_outbound(pkt, self.worker_index);
+    }
+
+    static void prefetch_qos_flow(PacketConsumer& self, const Net::ParsedPacket& pkt) {
+        self.processor.prefetch(pkt);
     }
 
     // ── Pipeline steps ────────────────────────────────────────────────────────
 
+    // IPv4 fragments. Only the first fragment has ports, so it alone goes through NAT,
+    // the firewall and the classifier; its outcome is kept in `fragments` and the later
+    // fragments of the datagram copy it. Entry: open the record for a first fragment;
+    // drop a later one whose first fragment was not forwarded (or never seen while a
+    // stage that needs ports is on), send it straight to the LAN if the first went there.
+    static bool step_fragment_follow(PacketConsumer& self, Net::ParsedPacket& pkt) {
+        if (pkt.fragment == Net::FragmentKind::None) return false;
+        if (pkt.fragment == Net::FragmentKind::First) {
+            self.fragments.begin(pkt.fragment_key);
+            return false;
+        }
+        const auto* e = self.fragments.find(pkt.fragment_key);
+        if (!e) return self.flags.nat || (self.direction == WorkerDirection::Downstream && self.flags.firewall);
+        if (e->state != Logic::FragmentTable::State::Committed) return true;
+        if (!e->lan) return false;
+        Logic::FragmentTable::rewrite(pkt, *e);
+        send_on_lan(self, pkt);
+        return true;
+    }
+
+    // After the last address rewrite (NAT, DNS redirect): record the first fragment's
+    // addresses, give the later ones the same.
+    static bool step_fragment_commit(PacketConsumer& self, Net::ParsedPacket& pkt) {
+        if (pkt.fragment == Net::FragmentKind::First) {
+            self.fragments.commit(pkt, false);
+        } else if (pkt.fragment == Net::FragmentKind::Later) {
+            const auto* e = self.fragments.find(pkt.fragment_key);
+            if (e && e->state == Logic::FragmentTable::State::Committed)
+                Logic::FragmentTable::rewrite(pkt, *e);
+        }
+        return false;
+    }
+
+    // L2 forward out of the LAN port to an on-link host; false if its MAC is unknown.
+    static bool send_on_lan(PacketConsumer& self, Net::ParsedPacket& pkt) {
+        const ForwardL2Snapshot& s = g_fwd_snap[self.flags.fwd_idx];
+        uint8_t nh[6]{};
+        if (!s.ready || !resolve_mac_onlink_wan(s, pkt.ipv4->daddr.raw(), nh)) return false;
+        std::memcpy(pkt.eth->dest, nh, 6);
+        std::memcpy(pkt.eth->src, s.lan_hw.data(), 6);
+        DataPlane::TxFrameOutput::send_best_effort(
+            self.tx_lan, pkt.raw_span, self.core_id, 0);
+        return true;
+    }
+
     static bool step_local_delivery_blocker(PacketConsumer& self, Net::ParsedPacket& pkt) {
         if (!pkt.is_valid_ipv4()) return false;
-        if (self.core_id == 3) {
+        if (self.direction == WorkerDirection::Upstream) {
             Net::IPv4Net d = pkt.ipv4->daddr;
             if (d == Net::IPv4Net{0xFAFFFFEF}     ||  // 239.255.255.250 SSDP multicast (NBO on LE)
                 d == Net::IPv4Net{0xFFFFFFFF})        // broadcast
@@ -278,10 +383,10 @@ public:
         return false;
     }
 
-    // LAN RX (core 3): same-subnet traffic must egress LAN (hairpin), not WAN. Includes
+    // LAN RX (upstream): same-subnet traffic must egress LAN (hairpin), not WAN. Includes
     // ICMP echo reply to ROUTER_IP and L2 forward to other LAN hosts.
     static bool step_lan_subnet_forward(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        if (self.core_id != 3 || self.tx_fd_lan < 0) return false;
+        if (self.direction != WorkerDirection::Upstream || self.tx_lan.fd < 0) return false;
         if (!pkt.eth || !pkt.is_valid_ipv4()) return false;
         const int pl = Config::LAN_PREFIX_LEN;
         if (pl < 1 || pl > 32) return false;
@@ -289,8 +394,7 @@ public:
         const Net::IPv4Net d = pkt.ipv4->daddr;
         if (!Utils::Network::ipv4_in_subnet(d, pl, self.gateway_ip)) return false;
 
-        const unsigned           fa = g_fwd_active.load(std::memory_order_acquire);
-        const ForwardL2Snapshot& s  = g_fwd_snap[fa];
+        const ForwardL2Snapshot& s  = g_fwd_snap[self.flags.fwd_idx];
         if (!s.ready) return true;
 
         auto* ip = pkt.ipv4;
@@ -323,7 +427,7 @@ public:
                 i2->daddr            = os;
                 i2->ttl              = 64;
                 i2->check            = 0;
-                i2->check            = htons(ip_header_checksum_fold(i2));
+                i2->check            = Net::ipv4_header_checksum(i2);
 
                 c2->type = 0;
                 c2->code = 0;
@@ -332,7 +436,7 @@ public:
                     reinterpret_cast<uint8_t*>(c2), icmp_len));
 
                 DataPlane::TxFrameOutput::send_best_effort(
-                    self.tx_fd_lan, std::span<const uint8_t>(buf.data(), total),
+                    self.tx_lan, std::span<const uint8_t>(buf.data(), total),
                     self.core_id, 0);
                 return true;
             }
@@ -346,13 +450,25 @@ public:
         std::memcpy(pkt.eth->dest, nh, 6);
         std::memcpy(pkt.eth->src, s.lan_hw.data(), 6);
         DataPlane::TxFrameOutput::send_best_effort(
-            self.tx_fd_lan, pkt.raw_span, self.core_id, 0);
+            self.tx_lan, pkt.raw_span, self.core_id, 0);
+        self.fragments.commit(pkt, true);
+        return true;
+    }
+
+    // LAN RX (upstream): NAT loopback. A LAN client addressing a forwarded port on the
+    // WAN IP is translated to the server (from the router IP) and the server's replies
+    // back to the client, so the exchange stays on the LAN instead of going upstream.
+    static bool step_nat_hairpin(PacketConsumer& self, Net::ParsedPacket& pkt) {
+        if (!self.flags.nat || !self.nat_engine || self.tx_lan.fd < 0) return false;
+        if (!pkt.eth || !self.nat_engine->process_hairpin(pkt, self.gateway_ip)) return false;
+        if (send_on_lan(self, pkt)) self.fragments.commit(pkt, true);
         return true;
     }
 
     static bool step_dhcp_interceptor(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        if (!Config::global_state.enable_dhcp.load(std::memory_order_relaxed)) return false;
-        if (self.core_id == 3 && pkt.is_valid_ipv4() && pkt.l4_protocol == 17) {
+        if (!self.flags.dhcp) return false;
+        if (self.direction == WorkerDirection::Upstream
+            && pkt.is_valid_ipv4() && pkt.l4_protocol == 17) {
             auto udp = pkt.udp();
             if (udp && (ntohs(udp->dest) == 67 || ntohs(udp->dest) == 68)) {
                 if (self.dhcp_engine) self.dhcp_engine->intercept_request(pkt);
@@ -363,9 +479,9 @@ public:
     }
 
     static bool step_dns_interceptor(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        if (self.core_id != 3 || !self.dns_engine) return false;
+        if (self.direction != WorkerDirection::Upstream || !self.dns_engine) return false;
         const Logic::DnsQueryDisposition d =
-            self.dns_engine->process_query(pkt, self.rx_fd);
+            self.dns_engine->process_query(pkt, self.rx_fd, self.core_id);
         return d == Logic::DnsQueryDisposition::Replied
             || d == Logic::DnsQueryDisposition::ReplySendFailed;
     }
@@ -374,20 +490,20 @@ public:
     // (daddr, dport) have been restored to the client's (ip, sport), which is
     // the key used to look up the original DNS server address.
     static bool step_dns_response(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        if (self.core_id != 2 || !self.dns_engine) return false;
+        if (self.direction != WorkerDirection::Downstream || !self.dns_engine) return false;
         self.dns_engine->process_response(pkt);
         return false;
     }
 
     static bool step_nat_downstream(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        if (!Config::global_state.enable_nat.load(std::memory_order_relaxed)) return false;
+        if (!self.flags.nat) return false;
         if (self.nat_engine) self.nat_engine->process_inbound(pkt);
         return false;
     }
 
     static bool step_nat_upstream(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        if (!Config::global_state.enable_nat.load(std::memory_order_relaxed)) return false;
-        if (self.nat_engine) self.nat_engine->process_outbound(pkt);
+        if (!self.flags.nat) return false;
+        if (self.nat_engine) self.nat_engine->process_outbound(pkt, self.worker_index);
         return false;
     }
 
@@ -399,10 +515,8 @@ public:
     }
 
     static bool step_eth_rewrite_lan_to_wan(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        (void)self;
-        if (!Config::global_state.enable_nat.load(std::memory_order_relaxed)) return false;
-        const unsigned a = g_fwd_active.load(std::memory_order_acquire);
-        const ForwardL2Snapshot& s = g_fwd_snap[a];
+        if (!self.flags.nat) return false;
+        const ForwardL2Snapshot& s = g_fwd_snap[self.flags.fwd_idx];
         if (!s.ready || !pkt.eth || !pkt.ipv4) return false;
         if (!ipv4_needs_eth_rewrite_for_forward(pkt.ipv4)) return false;
 
@@ -428,10 +542,8 @@ public:
     }
 
     static bool step_eth_rewrite_wan_to_lan(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        (void)self;
-        if (!Config::global_state.enable_nat.load(std::memory_order_relaxed)) return false;
-        const unsigned a = g_fwd_active.load(std::memory_order_acquire);
-        const ForwardL2Snapshot& s = g_fwd_snap[a];
+        if (!self.flags.nat) return false;
+        const ForwardL2Snapshot& s = g_fwd_snap[self.flags.fwd_idx];
         if (!s.ready || !pkt.eth || !pkt.ipv4) return false;
         if (!ipv4_needs_eth_rewrite_for_forward(pkt.ipv4)) return false;
         const uint32_t key = pkt.ipv4->daddr.raw();
@@ -447,10 +559,9 @@ public:
 
     static bool step_ip_shaper_downstream(PacketConsumer& self, Net::ParsedPacket& pkt) {
         if (!pkt.is_valid_ipv4() || !self.qos_config) return false;
-        size_t ai     = self.qos_config->active_idx.load(std::memory_order_acquire);
-        auto shaper   = self.qos_config->buffers[ai].find(pkt.ipv4->daddr);
+        auto shaper   = self.qos_config->buffers[self.flags.qos_idx].find(pkt.ipv4->daddr);
         if (shaper) {
-            RouteContext ip_ctx{self.tx_fd, shaper};
+            RouteContext ip_ctx{self.tx, shaper};
             shaper_handler(ip_ctx, pkt.raw_span, 2, self.core_id);
             return true;
         }
@@ -459,10 +570,9 @@ public:
 
     static bool step_ip_shaper_upstream(PacketConsumer& self, Net::ParsedPacket& pkt) {
         if (!pkt.is_valid_ipv4() || !self.qos_config) return false;
-        size_t ai   = self.qos_config->active_idx.load(std::memory_order_acquire);
-        auto shaper = self.qos_config->buffers[ai].find(pkt.ipv4->saddr);
+        auto shaper = self.qos_config->buffers[self.flags.qos_idx].find(pkt.ipv4->saddr);
         if (shaper) {
-            RouteContext ip_ctx{self.tx_fd, shaper};
+            RouteContext ip_ctx{self.tx, shaper};
             shaper_handler(ip_ctx, pkt.raw_span, 2, self.core_id);
             return true;
         }
@@ -470,13 +580,16 @@ public:
     }
 
     static bool step_firewall_inbound(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        if (!Config::global_state.enable_firewall.load(std::memory_order_relaxed)) return false;
+        if (!self.flags.firewall) return false;
         if (!self.firewall_engine) return false;
-        return !self.firewall_engine->check_inbound(pkt); // true = drop
+        if (pkt.fragment == Net::FragmentKind::Later) return false; // its first fragment was checked
+        if (self.firewall_engine->check_inbound(pkt)) return false;
+        // Full-cone NAT mappings take UDP from any remote host (endpoint-independent filtering).
+        return !(self.flags.nat && self.nat_engine && self.nat_engine->accepts_any_remote(pkt)); // true = drop
     }
 
     static bool step_firewall_track_outbound(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        if (!Config::global_state.enable_firewall.load(std::memory_order_relaxed)) return false;
+        if (!self.flags.firewall) return false;
         if (self.firewall_engine) self.firewall_engine->track_outbound(pkt);
         return false;
     }
@@ -493,10 +606,9 @@ public:
 
     static bool step_device_shaper_downstream(PacketConsumer& self, Net::ParsedPacket& pkt) {
         if (!pkt.is_valid_ipv4() || !self.device_shaper) return false;
-        size_t ai   = self.device_shaper->active_idx.load(std::memory_order_acquire);
-        auto shaper = self.device_shaper->buffers[ai].find(pkt.ipv4->daddr);
+        auto shaper = self.device_shaper->buffers[self.flags.device_idx].find(pkt.ipv4->daddr);
         if (shaper) {
-            RouteContext c{self.tx_fd, shaper};
+            RouteContext c{self.tx, shaper};
             shaper_handler(c, pkt.raw_span, 2, self.core_id);
             return true;
         }
@@ -505,10 +617,9 @@ public:
 
     static bool step_device_shaper_upstream(PacketConsumer& self, Net::ParsedPacket& pkt) {
         if (!pkt.is_valid_ipv4() || !self.device_shaper) return false;
-        size_t ai   = self.device_shaper->active_idx.load(std::memory_order_acquire);
-        auto shaper = self.device_shaper->buffers[ai].find(pkt.ipv4->saddr);
+        auto shaper = self.device_shaper->buffers[self.flags.device_idx].find(pkt.ipv4->saddr);
         if (shaper) {
-            RouteContext c{self.tx_fd, shaper};
+            RouteContext c{self.tx, shaper};
             shaper_handler(c, pkt.raw_span, 2, self.core_id);
             return true;
         }
@@ -516,34 +627,87 @@ public:
     }
 
     static bool step_qos_routing(PacketConsumer& self, Net::ParsedPacket& pkt) {
-        auto prio       = self.processor.process(pkt);
+        // A later fragment has no ports to classify on: it rides in its first fragment's lane.
+        auto prio = Net::Priority::Normal;
+        if (pkt.fragment != Net::FragmentKind::Later) prio = self.processor.process(pkt);
+        if (pkt.fragment != Net::FragmentKind::None) {
+            if (auto* e = self.fragments.find(pkt.fragment_key)) {
+                if (pkt.fragment == Net::FragmentKind::First) e->prio = prio;
+                else prio = e->prio;
+            }
+        }
         const size_t pi = static_cast<size_t>(prio);
         self.stats.pkts++;
         self.stats.bytes += pkt.raw_span.size();
         self.stats.prio_pkts[pi]++;
         self.stats.prio_bytes[pi] += pkt.raw_span.size();
-        size_t mode = Telemetry::instance().effective_bridge_mode.load(std::memory_order_acquire) ? 1U : 0U;
-        self.routes[mode][pi](self.ctx, pkt.raw_span, pi, self.core_id);
+        self.routes[self.flags.route_mode][pi](self.ctx, pkt.raw_span, pi, self.core_id);
         return true;
     }
 
-    // ── Packet entry point ────────────────────────────────────────────────────
+    void load_flags() {
+        const auto& gs = Config::global_state;
+        flags.dhcp       = gs.enable_dhcp.load(std::memory_order_relaxed);
+        flags.nat        = gs.enable_nat.load(std::memory_order_relaxed);
+        flags.firewall   = gs.enable_firewall.load(std::memory_order_relaxed);
+        flags.route_mode =
+            Telemetry::instance().effective_bridge_mode.load(std::memory_order_acquire) ? 1U : 0U;
+        flags.fwd_idx    = g_fwd_active.load(std::memory_order_acquire);
+        if (qos_config)    flags.qos_idx    = qos_config->active_idx.load(std::memory_order_acquire);
+        if (device_shaper) flags.device_idx = device_shaper->active_idx.load(std::memory_order_acquire);
+    }
+
+    void commit_stats() {
+        if (stats.pkts == 0) return;
+        Telemetry::instance().commit_batch(stats, core_id, static_cast<size_t>(direction));
+        stats.reset();
+    }
+
+    // ── Packet entry points ───────────────────────────────────────────────────
     void on_packet_event(Net::ParsedPacket& pkt) {
+        load_flags();
         for (auto* step : pipeline.steps)
             if (step && step(*this, pkt)) break;
         // Batch-commit telemetry every 32 packets (& 31 avoids division)
-        if ((stats.pkts & 31) == 0) {
-            Telemetry::instance().commit_batch(stats, core_id);
-            stats.reset();
-        }
+        if ((stats.pkts & 31) == 0) commit_stats();
     }
-};
 
-// Fixed-size copy of one Ethernet frame for transfer from the RX thread to the
-// packet processing thread (single producer, single consumer ring).
-struct RxFrameCopy {
-    std::array<uint8_t, 2048> data{};
-    uint16_t                len = 0;
+    // Stage-major: each step runs over every still-live packet before the next step
+    // starts, so a step's code and the engine state it touches stay hot across the
+    // batch. A step returning true retires that packet (consumed or dropped); packets
+    // of one flow keep their relative order because every stage walks the batch in order.
+    // Before a table-backed stage, the buckets of all live packets are prefetched in one
+    // pass so the misses overlap instead of stalling the stage once per packet.
+    void on_packet_batch(std::span<Net::ParsedPacket> pkts) {
+        const size_t n = std::min(pkts.size(), MAX_BATCH);
+        if (n == 0) return;
+        load_flags();
+        // A later IP fragment depends on what the pipeline did to its first fragment,
+        // which stage-major order would not have finished yet: such batches (rare) run
+        // packet-major instead.
+        if (std::any_of(pkts.begin(), pkts.begin() + n,
+                        [](const Net::ParsedPacket& p) { return p.fragment != Net::FragmentKind::None; })) {
+            for (size_t i = 0; i < n; ++i)
+                for (auto* step : pipeline.steps)
+                    if (step && step(*this, pkts[i])) break;
+            commit_stats();
+            return;
+        }
+        uint32_t live = n == MAX_BATCH ? ~0u >> (32 - MAX_BATCH) : ((1u << n) - 1u);
+        for (size_t s = 0; s < pipeline.steps.size(); ++s) {
+            if (live == 0) break;
+            auto* step = pipeline.steps[s];
+            if (!step) continue;
+            if (auto* pf = pipeline.prefetch[s])
+                for (uint32_t m = live; m != 0; m &= m - 1)
+                    pf(*this, pkts[static_cast<unsigned>(std::countr_zero(m))]);
+            for (uint32_t m = live; m != 0; m &= m - 1) {
+                const unsigned i = static_cast<unsigned>(std::countr_zero(m));
+                if (step(*this, pkts[i])) live &= ~(1u << i);
+            }
+        }
+        commit_stats();
+    }
 };
 
 } // anonymous namespace
@@ -669,8 +833,12 @@ App::App() {
             Net::parse_ipv4(Config::DHCP_POOL_END.c_str()),
             Config::DHCP_LEASE_DURATION});
     firewall_engine = std::make_shared<Logic::FirewallEngine>();
-    if (Config::global_state.enable_upnp.load(std::memory_order_relaxed))
+    flow_board      = std::make_shared<Logic::FlowDirectionBoard>();
+    if (Config::global_state.enable_upnp.load(std::memory_order_relaxed)) {
         upnp_engine = std::make_shared<Logic::UpnpEngine>(nat_engine, Config::ROUTER_IP);
+        pcp_engine  = std::make_shared<Logic::PcpEngine>(nat_engine, Config::ROUTER_IP,
+                                                         Config::LAN_PREFIX_LEN);
+    }
     qos_config       = std::make_shared<QoSConfig>();
     device_shaper_dl = std::make_shared<QoSConfig>();
     device_shaper_ul = std::make_shared<QoSConfig>();
@@ -681,12 +849,11 @@ App::App() {
 }
 
 App::~App() {
-    // Stop data-plane workers (Cores 2/3) before watchdog (Core 1) so
+    // Stop data-plane workers before watchdog (Core 1) so
     // the watchdog does not read stale shaper state after workers exit.
     running_workers.store(false, std::memory_order_relaxed);
     wake_proc_threads_for_shutdown();
-    if (worker_downstream.joinable()) worker_downstream.join();
-    if (worker_upstream.joinable())   worker_upstream.join();
+    join_workers();
     close_worker_poll_fds();
     running_watchdog.store(false, std::memory_order_relaxed);
     wake_watchdog_for_shutdown();
@@ -694,15 +861,22 @@ App::~App() {
     close_watchdog_stop_efd();
 }
 
+void App::join_workers() {
+    for (auto& w : workers_)
+        if (w.thread.joinable()) w.thread.join();
+}
+
 std::expected<void, std::string> App::open_worker_poll_fds_for_start() {
     close_worker_poll_fds();
-    for (auto& w : worker_poll_) {
+    for (auto& slot : workers_) {
+        auto& w = slot.poll;
         w.frame_efd = ::eventfd(0, EFD_CLOEXEC);
         // Semaphore mode: RX and proc threads both poll+read the same stop_efd; a single
         // non-semaphore write(1) wakes both but only one read drains — the other blocks
         // forever on read(), so App::stop() hangs on worker join.
         w.stop_efd  = ::eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
-        if (w.frame_efd < 0 || w.stop_efd < 0) {
+        w.release_efd = ::eventfd(0, EFD_CLOEXEC);
+        if (w.frame_efd < 0 || w.stop_efd < 0 || w.release_efd < 0) {
             int e = errno;
             close_worker_poll_fds();
             return std::unexpected(
@@ -713,7 +887,8 @@ std::expected<void, std::string> App::open_worker_poll_fds_for_start() {
 }
 
 void App::close_worker_poll_fds() {
-    for (auto& w : worker_poll_) {
+    for (auto& slot : workers_) {
+        auto& w = slot.poll;
         if (w.frame_efd >= 0) {
             ::close(w.frame_efd);
             w.frame_efd = -1;
@@ -722,11 +897,16 @@ void App::close_worker_poll_fds() {
             ::close(w.stop_efd);
             w.stop_efd = -1;
         }
+        if (w.release_efd >= 0) {
+            ::close(w.release_efd);
+            w.release_efd = -1;
+        }
     }
 }
 
 void App::wake_proc_threads_for_shutdown() {
-    for (auto& w : worker_poll_) {
+    for (auto& slot : workers_) {
+        auto& w = slot.poll;
         if (w.stop_efd >= 0)
             // Two readers per worker (RX thread + proc thread); EFD_SEMAPHORE needs one
             // increment per successful read.
@@ -748,12 +928,11 @@ void App::close_watchdog_stop_efd() {
 
 void App::stop() {
     if (shutdown_sequence_started_.exchange(true, std::memory_order_acq_rel)) return;
-    // Stop data-plane workers (Cores 2/3) before watchdog (Core 1) so
+    // Stop data-plane workers before watchdog (Core 1) so
     // the watchdog does not read stale shaper state after workers exit.
     running_workers.store(false, std::memory_order_relaxed);
     wake_proc_threads_for_shutdown();
-    if (worker_downstream.joinable()) worker_downstream.join();
-    if (worker_upstream.joinable()) worker_upstream.join();
+    join_workers();
     close_worker_poll_fds();
     running_watchdog.store(false, std::memory_order_release);
     wake_watchdog_for_shutdown();
@@ -765,13 +944,64 @@ void App::stop() {
 std::expected<void, std::string> App::init() {
     Utils::Network::disable_hardware_offloads(Config::iface_wan());
     Utils::Network::disable_hardware_offloads(Config::iface_lan());
-    iface_wan = std::make_unique<Engine::RawSocketManager>(Config::iface_wan());
-    iface_lan = std::make_unique<Engine::RawSocketManager>(Config::iface_lan());
-    if (auto r = iface_wan->init(); !r) return r;
-    if (auto r = iface_lan->init(); !r) return r;
+    // Worker topology: downstream workers first, then upstream (see WorkerSlot).
+    auto worker_count = [](uint32_t configured) -> size_t {
+        size_t n = configured == 0 ? 1 : configured;
+        return n > Config::MAX_WORKERS_PER_DIRECTION ? Config::MAX_WORKERS_PER_DIRECTION : n;
+    };
+    const size_t n_down = worker_count(Config::WORKERS_DOWNSTREAM);
+    const size_t n_up   = worker_count(Config::WORKERS_UPSTREAM);
+
+    // Several workers on one interface share its traffic through a fanout group;
+    // without it every socket would receive a copy of every frame.
+    auto rx_opts_for = [](size_t n_workers) {
+        return Engine::RxRingOptions{
+            .version = Config::RX_RING_VERSION == 1 ? Engine::RxRingVersion::V1
+                                                     : Engine::RxRingVersion::V3,
+            .block_timeout_ms = Config::RX_BLOCK_TIMEOUT_MS,
+            .fanout           = n_workers > 1,
+            .fanout_mode      = Config::RX_FANOUT_MODE == Config::FanoutMode::Cpu
+                                    ? Engine::RxFanoutMode::Cpu : Engine::RxFanoutMode::Hash,
+            .fanout_rollover  = Config::RX_FANOUT_ROLLOVER,
+            .busy_poll_us     = Config::BUSY_POLL_US,
+        };
+    };
+    workers_ = std::vector<WorkerSlot>(n_down + n_up);
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        auto& w = workers_[i];
+        const bool down = i < n_down;
+        w.direction = down ? WorkerDirection::Downstream : WorkerDirection::Upstream;
+        w.cpu = down ? Config::WORKER_CPUS_DOWNSTREAM.at(i)
+                     : Config::WORKER_CPUS_UPSTREAM.at(i - n_down);
+        if (w.cpu < 0 || static_cast<size_t>(w.cpu) >= Telemetry::MAX_CORES)
+            return std::unexpected(std::string("worker CPU out of range: ") + std::to_string(w.cpu));
+        w.rx = std::make_unique<Engine::RawSocketManager>(
+            down ? Config::iface_wan() : Config::iface_lan(), rx_opts_for(down ? n_down : n_up));
+        if (auto r = w.rx->init(); !r) return r;
+    }
+
+    if (Config::TX_RING) {
+        auto open_ring = [](std::unique_ptr<DataPlane::TxRing>& ring, const std::string& ifname) {
+            ring = std::make_unique<DataPlane::TxRing>();
+            if (auto r = ring->open(ifname, Config::TX_QDISC_BYPASS); !r) {
+                std::println(stderr, "[Engine] {}: TX ring unavailable ({}) — using send(2)",
+                    ifname, r.error());
+                ring.reset();
+            }
+        };
+        for (auto& w : workers_) {
+            if (w.direction == WorkerDirection::Downstream) {
+                open_ring(w.tx_ring, Config::iface_lan());
+            } else {
+                open_ring(w.tx_ring,     Config::iface_wan());
+                open_ring(w.tx_ring_lan, Config::iface_lan());
+            }
+        }
+    }
 
     if (auto s = sync_lan_subnet_and_dhcp_gateway(); !s) return s;
 
+    nat_engine->set_upstream_workers(n_up);
     if (Config::global_state.enable_nat.load(std::memory_order_relaxed)) {
         auto w = resolve_nat_wan_ip();
         if (!w) return std::unexpected(w.error());
@@ -834,8 +1064,14 @@ void App::start() {
 
     HPGTP::System::Optimizer::lock_cpu_frequency();
 
-    int fd_wan = iface_wan->get_fd();
-    int fd_lan = iface_lan->get_fd();
+    // Plain-socket egress goes out through any RX socket bound to the target interface.
+    auto first_rx_fd = [this](WorkerDirection d) {
+        for (auto& w : workers_)
+            if (w.direction == d) return w.rx->get_fd();
+        return -1;
+    };
+    int fd_wan = first_rx_fd(WorkerDirection::Downstream);
+    int fd_lan = first_rx_fd(WorkerDirection::Upstream);
     lan_fd_ = fd_lan;
 
     base_dl_mbps = tel.qos_global_dl_mbps_pending.load(std::memory_order_relaxed);
@@ -880,27 +1116,33 @@ void App::start() {
                 "[App] Warning: Ethernet MACs for L3 forwarding not ready (interfaces or default route / ARP).");
     }
 
+    {
+        long nproc = ::sysconf(_SC_NPROCESSORS_ONLN);
+        if (nproc < 1) nproc = 1;
+        tel.core_count.store(static_cast<uint8_t>(std::min<long>(
+            nproc, static_cast<long>(Telemetry::MAX_CORES))), std::memory_order_relaxed);
+        for (auto& m : tel.core_metrics) m.role.store(0, std::memory_order_relaxed);
+    }
+
     running_workers.store(true, std::memory_order_relaxed);
 
-    worker_downstream = std::thread(
-        [this, ps = &worker_poll_[0]](std::unique_ptr<Engine::RawSocketManager> iface,
-                                       PacketWorkerConfig cfg) {
-            worker_event_loop(std::move(iface), std::move(cfg), *ps);
-        },
-        std::move(iface_wan),
-        PacketWorkerConfig{ fd_lan, -1, 2, global_shaper_dl, nat_engine, dns_engine,
-                            qos_config, device_shaper_dl, dhcp_engine,
-                            firewall_engine, gw_ip });
-
-    worker_upstream = std::thread(
-        [this, ps = &worker_poll_[1]](std::unique_ptr<Engine::RawSocketManager> iface,
-                                       PacketWorkerConfig cfg) {
-            worker_event_loop(std::move(iface), std::move(cfg), *ps);
-        },
-        std::move(iface_lan),
-        PacketWorkerConfig{ fd_wan, fd_lan, 3, global_shaper_ul, nat_engine, dns_engine,
-                            qos_config, device_shaper_ul, dhcp_engine,
-                            firewall_engine, gw_ip });
+    size_t n_started[2]{};
+    for (auto& w : workers_) {
+        const bool down = w.direction == WorkerDirection::Downstream;
+        tel.core_metrics[static_cast<size_t>(w.cpu)].role.fetch_or(
+            down ? CORE_ROLE_DOWNSTREAM : CORE_ROLE_UPSTREAM, std::memory_order_relaxed);
+        PacketWorkerConfig cfg = down
+            ? PacketWorkerConfig{ {fd_lan, w.tx_ring.get()}, {}, w.cpu, w.direction,
+                                  global_shaper_dl, nat_engine, dns_engine,
+                                  qos_config, device_shaper_dl, dhcp_engine,
+                                  firewall_engine, gw_ip, flow_board, n_started[0]++ }
+            : PacketWorkerConfig{ {fd_wan, w.tx_ring.get()}, {fd_lan, w.tx_ring_lan.get()},
+                                  w.cpu, w.direction,
+                                  global_shaper_ul, nat_engine, dns_engine,
+                                  qos_config, device_shaper_ul, dhcp_engine,
+                                  firewall_engine, gw_ip, flow_board, n_started[1]++ };
+        w.thread = std::thread([this, &w, cfg]() { worker_event_loop(w, cfg); });
+    }
 
     std::println("[App] Data plane and control plane started.");
 }
@@ -910,25 +1152,51 @@ void App::wait_for_shutdown() {
     std::println("\n[System] Shutdown signal received, core services terminated gracefully.");
 }
 
-// ─── Worker event loop (Core 2 / Core 3) ─────────────────────────────────────
-// RX thread: blocking poll(2) on AF_PACKET and stop_efd; copy each frame into an
-// SPSC ring. Processing thread: parse and run PacketConsumer::on_packet_event;
-// waits on frame_efd/stop_efd with no periodic timeout.
-
-void App::worker_event_loop(std::unique_ptr<Engine::RawSocketManager> rx_mgr,
-                             PacketWorkerConfig cfg,
-                             WorkerPollSync& poll_sync) {
-    std::println("[App] Core {} pipeline mounted and ready.", cfg.core_id);
-
-    const int rx_fd_saved = rx_mgr->get_fd();
+// ─── Worker event loop (one per WorkerSlot) ──────────────────────────────────
+// RX thread: blocking poll(2) on AF_PACKET and stop_efd; hands each frame to the
+// processing thread as an RxFrameRef into the mmap'd ring (SPSC, no copy), and rings
+// frame_efd only when the processing thread has armed consumer_sleeping.
+// Processing thread: parse each burst and run PacketConsumer::on_packet_batch in place,
+// then release the ring slots; busy-polls for BUSY_POLL_US, then waits on frame_efd/stop_efd
+// with no periodic timeout.
+
+void App::worker_event_loop(WorkerSlot& slot, PacketWorkerConfig cfg) {
+    std::println("[App] Core {} {} pipeline mounted and ready.", cfg.core_id,
+        cfg.direction == WorkerDirection::Downstream ? "WAN→LAN" : "LAN→WAN");
+
+    WorkerPollSync& poll_sync = slot.poll;
+    const int rx_fd_saved = slot.rx->get_fd();
+    // Descriptors only: frames stay in the RX ring until the consumer releases them.
+    Net::SpscRingBuffer<Engine::RxFrameRef, 4096> frame_q{};
+    static constexpr size_t FRAME_BURST = PacketConsumer::MAX_BATCH;
+    // Frames ahead of the parse cursor whose headers are prefetched (Eth + IPv4 + L4
+    // fit in the first two cache lines).
+    static constexpr size_t PARSE_PREFETCH_AHEAD = 4;
+    Engine::RawSocketManager* const mgr = slot.rx.get();
+
+    // Without a TX ring, best-effort egress is gathered per pass and sent with sendmmsg(2).
+    DataPlane::TxBatch batch_tx(cfg.tx.fd), batch_tx_lan(cfg.tx_lan.fd);
+    if (!cfg.tx.ring) cfg.tx.batch = &batch_tx;
+    if (!cfg.tx_lan.ring && cfg.tx_lan.fd >= 0) cfg.tx_lan.batch = &batch_tx_lan;
     PacketConsumer consumer(rx_fd_saved, cfg);
-    Net::SpscRingBuffer<RxFrameCopy, 1024> frame_q{};
 
     std::thread rx_thread(
-        [this, mgr = std::move(rx_mgr), &frame_q, &poll_sync, core = cfg.core_id]() mutable {
+        [this, mgr, &frame_q, &poll_sync, core = cfg.core_id]() {
             HPGTP::System::Optimizer::set_current_thread_affinity(core);
             HPGTP::System::Optimizer::set_realtime_priority();
             const int sock_fd = mgr->get_fd();
+            // Pairs with the fence after the consumer arms consumer_sleeping: either it
+            // sees the frames already pushed, or this sees the flag and writes frame_efd.
+            auto ring_doorbell = [&poll_sync, core]() {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (poll_sync.frame_efd >= 0
+                    && poll_sync.consumer_sleeping.load(std::memory_order_relaxed)
+                    && poll_sync.consumer_sleeping.exchange(false, std::memory_order_acq_rel)) {
+                    (void)::eventfd_write(poll_sync.frame_efd, 1);
+                    Telemetry::instance().core_metrics[core].doorbell_writes.fetch_add(
+                        1, std::memory_order_relaxed);
+                }
+            };
             while (this->running_workers.load(std::memory_order_relaxed)) {
                 struct pollfd pfds_rx[2]{};
                 pfds_rx[0] = { sock_fd, POLLIN, 0 };
@@ -949,59 +1217,144 @@ void App::worker_event_loop(std::unique_ptr<Engine::RawSocketManager> rx_mgr,
                 }
                 if ((pfds_rx[0].revents & POLLIN) == 0) continue;
 
-                std::span<uint8_t> raw;
-                while (this->running_workers.load(std::memory_order_relaxed)
-                       && mgr->peek_rx_frame(raw)) {
-                    RxFrameCopy copy{};
-                    const size_t n =
-                        raw.size() < copy.data.size() ? raw.size() : copy.data.size();
-                    copy.len = static_cast<uint16_t>(n);
-                    std::memcpy(copy.data.data(), raw.data(), n);
-
-                    if (frame_q.push(copy)) {
-                        if (poll_sync.frame_efd >= 0)
-                            (void)::eventfd_write(poll_sync.frame_efd, 1);
-                        mgr->finish_rx_frame();
-                    } else {
+                // Frames are handed over in bursts: one index publish per burst.
+                std::array<Engine::RxFrameRef, FRAME_BURST> burst;
+                size_t pushed = 0;
+                while (this->running_workers.load(std::memory_order_relaxed)) {
+                    size_t n = 0;
+                    while (n < burst.size() && mgr->acquire_rx_frame(burst[n])) ++n;
+                    if (n == 0) break;
+                    bool was_empty = false;
+                    const size_t ok = frame_q.push_n(
+                        std::span<const Engine::RxFrameRef>(burst.data(), n), was_empty);
+                    // Empty → non-empty: ring now rather than at the end of the batch.
+                    if (ok && was_empty) ring_doorbell();
+                    pushed += ok;
+                    for (size_t i = ok; i < n; ++i) {
                         Telemetry::instance().core_metrics[core].dropped[0].fetch_add(
                             1, std::memory_order_relaxed);
-                        mgr->finish_rx_frame();
+                        mgr->release_rx_frame(burst[i].slot);
+                    }
+                }
+                // Once per batch: covers a consumer that went to sleep mid-batch after
+                // missing a burst whose push saw the queue non-empty.
+                if (pushed) ring_doorbell();
+                if (pushed || poll_sync.release_efd < 0) continue;
+
+                // Nothing to take because the processing thread still holds the slot at
+                // (or just behind) the cursor; the socket may keep reporting POLLIN.
+                // Polling again would spin at SCHED_FIFO on the core that thread needs
+                // to release it, so park until it does.
+                // Arm, then re-check: a release before the flag was visible woke no one.
+                poll_sync.rx_waiting.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (mgr->rx_waiting_on_release()) {
+                    struct pollfd pfds_rel[2]{};
+                    pfds_rel[0] = { poll_sync.release_efd, POLLIN, 0 };
+                    pfds_rel[1] = { poll_sync.stop_efd, POLLIN, 0 };
+                    const int pr = ::poll(pfds_rel, 2, -1);
+                    if (pr > 0 && (pfds_rel[1].revents & POLLIN) != 0) {
+                        uint64_t v;
+                        (void)::eventfd_read(poll_sync.stop_efd, &v);
+                        break;
+                    }
+                    if (pr > 0 && (pfds_rel[0].revents & POLLIN) != 0) {
+                        uint64_t v;
+                        (void)::eventfd_read(poll_sync.release_efd, &v);
                     }
                 }
+                poll_sync.rx_waiting.store(false, std::memory_order_relaxed);
             }
         });
 
-    std::thread proc_thread([this, &consumer, &frame_q, &poll_sync, cfg]() {
+    std::thread proc_thread([this, mgr, &consumer, &frame_q, &poll_sync, cfg]() {
         HPGTP::System::Optimizer::set_current_thread_affinity(cfg.core_id);
         HPGTP::System::Optimizer::set_realtime_priority();
+        auto& core_tel = Telemetry::instance().core_metrics[cfg.core_id];
+        const auto spin_budget = std::chrono::microseconds(Config::BUSY_POLL_US);
         while (this->running_workers.load(std::memory_order_relaxed)) {
-            RxFrameCopy copy{};
-            while (frame_q.pop(copy)) {
-                auto pkt = Net::ParsedPacket::parse(
-                    std::span<uint8_t>(copy.data.data(), copy.len));
-                consumer.on_packet_event(pkt);
+            std::array<Engine::RxFrameRef, FRAME_BURST> refs;
+            std::array<Net::ParsedPacket, FRAME_BURST> pkts;
+            while (size_t n = frame_q.pop_n(refs)) {
+                // Pipeline steps rewrite headers in place inside the ring frames;
+                // anything kept beyond this call (shaper queues, DNS/DHCP jobs) is copied.
+                for (size_t i = 0; i < std::min(n, PARSE_PREFETCH_AHEAD); ++i) {
+                    Net::prefetch_write(refs[i].data);
+                    Net::prefetch_write(refs[i].data + 64);
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    if (i + PARSE_PREFETCH_AHEAD < n) {
+                        Net::prefetch_write(refs[i + PARSE_PREFETCH_AHEAD].data);
+                        Net::prefetch_write(refs[i + PARSE_PREFETCH_AHEAD].data + 64);
+                    }
+                    pkts[i] = Net::ParsedPacket::parse(std::span<uint8_t>(refs[i].data, refs[i].len));
+                }
+                consumer.on_packet_batch(std::span(pkts.data(), n));
+                for (size_t i = 0; i < n; ++i) mgr->release_rx_frame(refs[i].slot);
+                // Pairs with the fence after the RX thread arms rx_waiting.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (poll_sync.release_efd >= 0
+                    && poll_sync.rx_waiting.load(std::memory_order_relaxed)
+                    && poll_sync.rx_waiting.exchange(false, std::memory_order_acq_rel))
+                    (void)::eventfd_write(poll_sync.release_efd, 1);
             }
 
-            if (cfg.route_shaper) cfg.route_shaper->process_queue(cfg.tx_fd);
+            if (cfg.route_shaper) cfg.route_shaper->process_queue(cfg.tx);
+
+            // NAT sessions are expired by the upstream worker that owns their shard.
+            if (cfg.direction == WorkerDirection::Upstream && consumer.nat_engine)
+                consumer.nat_engine->expire_sessions(cfg.worker_index);
 
             if (consumer.qos_config
                 && Config::IP_LIMIT_ACTIVE.load(std::memory_order_relaxed)) {
                 size_t ai =
                     consumer.qos_config->active_idx.load(std::memory_order_acquire);
                 consumer.qos_config->buffers[ai].for_each_occupied([&](auto& shaper) {
-                    shaper->process_queue(cfg.tx_fd);
+                    shaper->process_queue(cfg.tx);
                 });
             }
 
-            Telemetry::instance().core_metrics[cfg.core_id].last_heartbeat.fetch_add(
-                1, std::memory_order_relaxed);
+            // One kernel call per pass for everything staged above.
+            DataPlane::TxFrameOutput::flush(cfg.tx);
+            DataPlane::TxFrameOutput::flush(cfg.tx_lan);
+
+            core_tel.last_heartbeat.fetch_add(1, std::memory_order_relaxed);
 
             if (poll_sync.frame_efd < 0 || poll_sync.stop_efd < 0) break;
 
+            // Busy-poll window: while traffic is flowing the next frame usually lands
+            // within microseconds, so skip the eventfd round trip. The RX thread shares
+            // this core at the same SCHED_FIFO priority, hence sched_yield(), not a pure spin.
+            if (spin_budget.count() > 0) {
+                const auto deadline = std::chrono::steady_clock::now() + spin_budget;
+                bool hit = false;
+                while (this->running_workers.load(std::memory_order_relaxed)) {
+                    if (!frame_q.empty()) { hit = true; break; }
+                    if (std::chrono::steady_clock::now() >= deadline) break;
+                    ::sched_yield();
+                }
+                if (hit) {
+                    core_tel.busy_spin_hits.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+
+            // Arm the doorbell, then re-check: a frame pushed before the flag became
+            // visible to the RX thread would otherwise sit in the queue until the next one.
+            poll_sync.consumer_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!frame_q.empty()) {
+                poll_sync.consumer_sleeping.store(false, std::memory_order_relaxed);
+                continue;
+            }
+
+            core_tel.idle_sleeps.fetch_add(1, std::memory_order_relaxed);
+
             struct pollfd pfds[2]{};
             pfds[0] = { poll_sync.frame_efd, POLLIN, 0 };
             pfds[1] = { poll_sync.stop_efd,  POLLIN, 0 };
             int pr = ::poll(pfds, 2, -1);
+            poll_sync.consumer_sleeping.store(false, std::memory_order_relaxed);
             if (pr < 0) {
                 if (errno == EINTR) continue;
                 break;
@@ -1048,9 +1401,9 @@ void App::watchdog_loop() {
     }
 
     uint64_t expirations;
-    uint64_t last_bytes[4]  = {};
-    uint64_t stat_idle[4]   = {};
-    uint64_t stat_total[4]  = {};
+    uint64_t last_dir_bytes[2]                 = {};
+    uint64_t stat_idle[Telemetry::MAX_CORES]  = {};
+    uint64_t stat_total[Telemetry::MAX_CORES] = {};
     uint64_t watchdog_tick  = 0;
     int      last_throttle_pct = 100;
 
@@ -1110,13 +1463,20 @@ void App::watchdog_loop() {
 
     while (running_watchdog.load(std::memory_order_acquire)) {
         const int rescan_fd = si.rescan_poll_fd();
-        struct pollfd pfds[3]{};
+        const int pcp_fd    = pcp_engine ? pcp_engine->poll_fd() : -1;
+        struct pollfd pfds[4]{};
         pfds[0] = { tfd, POLLIN, 0 };
         pfds[1] = { watchdog_stop_efd_, POLLIN, 0 };
-        int nfds = 2;
+        int nfds     = 2;
+        int rescan_i = -1;
+        int pcp_i    = -1;
         if (rescan_fd >= 0) {
-            pfds[2] = { rescan_fd, POLLIN, 0 };
-            nfds    = 3;
+            rescan_i     = nfds;
+            pfds[nfds++] = { rescan_fd, POLLIN, 0 };
+        }
+        if (pcp_fd >= 0) {
+            pcp_i        = nfds;
+            pfds[nfds++] = { pcp_fd, POLLIN, 0 };
         }
         int pr = poll(pfds, nfds, -1);
         if (pr < 0) {
@@ -1135,7 +1495,10 @@ void App::watchdog_loop() {
 
         if (timer_fired && ::read(tfd, &expirations, sizeof(expirations)) <= 0)
             timer_fired = false;
-        if (nfds == 3 && (pfds[2].revents & POLLIN)) {
+        // NAT-PMP / PCP requests are answered as they arrive, between ticks.
+        if (pcp_i >= 0 && (pfds[pcp_i].revents & POLLIN))
+            pcp_engine->on_readable();
+        if (rescan_i >= 0 && (pfds[rescan_i].revents & POLLIN)) {
             si.consume_rescan();
             force_scan = true;
         }
@@ -1162,7 +1525,7 @@ void App::watchdog_loop() {
 
         // Per-core CPU load from /proc/stat (1 Hz)
         {
-            char sbuf[1024]{};
+            char sbuf[4096]{};
             int sfd = ::open("/proc/stat", O_RDONLY);
             if (sfd >= 0) {
                 ssize_t n = ::read(sfd, sbuf, sizeof(sbuf) - 1);
@@ -1228,6 +1591,59 @@ void App::watchdog_loop() {
             prev_ct = ct;
         }
 
+        {
+            static uint64_t prev_ft = 0;
+            uint64_t ft = tel.flow_table_drops.load(std::memory_order_relaxed);
+            uint64_t dft = ft - prev_ft;
+            if (dft != 0) {
+                std::println(
+                    "[Classifier] last 1s: flow_table_drops (probe limit) +{}", dft);
+            }
+            prev_ft = ft;
+        }
+
+        if (nat_engine) {
+            static uint64_t prev_px = 0;
+            uint64_t px = tel.nat_port_exhausted.load(std::memory_order_relaxed);
+            uint64_t dpx = px - prev_px;
+            if (dpx != 0) {
+                std::println(
+                    "[NAT] last 1s: port_pool_exhausted +{} (in use: tcp {}, udp {} of {})",
+                    dpx, nat_engine->ports_in_use(6), nat_engine->ports_in_use(17),
+                    Logic::NatEngine::port_capacity());
+            }
+            prev_px = px;
+        }
+
+        // Worker wakeups per worker core: packets handled against RX → processing
+        // doorbell writes (eventfd syscalls), and idle behaviour (BUSY_POLL_US).
+        {
+            static std::array<uint64_t, Telemetry::MAX_CORES> prev_pkts{}, prev_bell{};
+            static std::array<uint64_t, Telemetry::MAX_CORES> prev_spin{}, prev_sleep{};
+            for (size_t i = 0; i < Telemetry::MAX_CORES; ++i) {
+                const auto& m = tel.core_metrics[i];
+                if (m.role.load(std::memory_order_relaxed) == 0) continue;
+                uint64_t pkts   = m.pkts.load(std::memory_order_relaxed);
+                uint64_t bell   = m.doorbell_writes.load(std::memory_order_relaxed);
+                uint64_t spin   = m.busy_spin_hits.load(std::memory_order_relaxed);
+                uint64_t sleep  = m.idle_sleeps.load(std::memory_order_relaxed);
+                uint64_t dpkts  = pkts - prev_pkts[i];
+                uint64_t dbell  = bell - prev_bell[i];
+                uint64_t dspin  = spin - prev_spin[i];
+                uint64_t dsleep = sleep - prev_sleep[i];
+                if (dpkts != 0 || dbell != 0 || dspin != 0 || dsleep != 0) {
+                    std::println(
+                        "[Worker] core {} last 1s: pkts +{}, doorbell_writes +{}, "
+                        "busy_spin_hits +{}, idle_sleeps +{}",
+                        i, dpkts, dbell, dspin, dsleep);
+                }
+                prev_pkts[i]  = pkts;
+                prev_bell[i]  = bell;
+                prev_spin[i]  = spin;
+                prev_sleep[i] = sleep;
+            }
+        }
+
         {
             static uint8_t prev_pe = 0;
             uint8_t pe = tel.raw_socket_poll_errors.load(std::memory_order_relaxed);
@@ -1369,14 +1785,14 @@ void App::watchdog_loop() {
         }
 
         // Bandwidth (1 Hz)
-        uint64_t bd = tel.core_metrics[2].bytes.load(std::memory_order_relaxed);
-        uint64_t bu = tel.core_metrics[3].bytes.load(std::memory_order_relaxed);
+        uint64_t bd = tel.direction_metrics[0].bytes.load(std::memory_order_relaxed);
+        uint64_t bu = tel.direction_metrics[1].bytes.load(std::memory_order_relaxed);
         std::println("[Monitor] DL: {:.2f} Mbps | UL: {:.2f} Mbps | Mode: {}",
-            (bd - last_bytes[2]) * 8.0 / 1e6,
-            (bu - last_bytes[3]) * 8.0 / 1e6,
+            (bd - last_dir_bytes[0]) * 8.0 / 1e6,
+            (bu - last_dir_bytes[1]) * 8.0 / 1e6,
             tel.effective_bridge_mode.load(std::memory_order_acquire) ? "Bridge" : "Accel");
-        last_bytes[2] = bd;
-        last_bytes[3] = bu;
+        last_dir_bytes[0] = bd;
+        last_dir_bytes[1] = bu;
 
         // Game port whitelist (GUI staging → double-buffer swap)
         if (Config::GAME_PORTS_DIRTY.exchange(false, std::memory_order_acq_rel))
@@ -1493,7 +1909,7 @@ void App::watchdog_loop() {
         }
 
         // 1 Hz engine ticks
-        if (nat_engine)      nat_engine->tick();
+        if (nat_engine)      { nat_engine->tick(); nat_engine->expire_upnp_rules(); }
         if (dns_engine)    { dns_engine->tick(); dns_engine->process_background_tasks(); }
         if (dhcp_engine)     dhcp_engine->process_background_tasks(lan_fd_);
         if (firewall_engine) { firewall_engine->tick(); firewall_engine->cleanup(); }
@@ -37,6 +37,8 @@ static void commit_loaded_game_ports_to_runtime() {
         std::memcpy(GAME_PORT_TABLE_DOUBLE[static_cast<size_t>(b)].data(),
             g_load_game_ports.data(), n * sizeof(PortRange));
         game_port_table_counts[static_cast<size_t>(b)] = n;
+        compile_game_port_bitmap(std::span(g_load_game_ports.data(), n),
+            GAME_PORT_BITMAP_DOUBLE[static_cast<size_t>(b)]);
     }
     std::memcpy(game_port_staging.data(), g_load_game_ports.data(), n * sizeof(PortRange));
     game_port_staging_count = n;
@@ -64,12 +66,34 @@ void apply_pended_game_ports() {
     size_t next = 1 - cur;
     std::memcpy(GAME_PORT_TABLE_DOUBLE[next].data(), local.data(), n * sizeof(PortRange));
     game_port_table_counts[next] = n;
+    compile_game_port_bitmap(std::span(local.data(), n), GAME_PORT_BITMAP_DOUBLE[next]);
     game_port_active_idx.store(next, std::memory_order_release);
     std::println("[QoS] Game port whitelist applied: {} range(s)", n);
 }
 
 // ── private helpers ──────────────────────────────────────────────────────────
 
+// "2,4,6" → WorkerCpuList; entries past MAX_WORKERS_PER_DIRECTION are ignored.
+static void parse_cpu_list(const char* s, WorkerCpuList& out) {
+    out.count = 0;
+    const char* p = s;
+    while (*p && out.count < MAX_WORKERS_PER_DIRECTION) {
+        while (*p == ' ' || *p == ',') ++p;
+        if (!*p) break;
+        int v = 0;
+        auto [next, ec] = std::from_chars(p, p + strlen(p), v);
+        if (ec != std::errc{}) break;
+        out.cpus[out.count++] = v;
+        p = next;
+    }
+}
+
+static void write_cpu_list(int fd, const char* key, const WorkerCpuList& l) {
+    dprintf(fd, "%s=", key);
+    for (size_t i = 0; i < l.count; ++i) dprintf(fd, i ? ",%d" : "%d", l.cpus[i]);
+    dprintf(fd, "\n");
+}
+
 static uint32_t parse_u32(const char* s) {
     uint32_t v = 0;
     std::string_view sv{s};
@@ -140,6 +164,19 @@ std::expected<void, std::string> load_config(const std::string& path) {
                 else if (!strcmp(key, "LARGE_PACKET_THRESHOLD")) LARGE_PACKET_THRESHOLD_BYTES = parse_u32(val);
                 else if (!strcmp(key, "PUNISH_TRIGGER_COUNT"))   PUNISH_TRIGGER_COUNT   = parse_u32(val);
                 else if (!strcmp(key, "CLEANUP_INTERVAL"))       CLEANUP_INTERVAL_PKTS  = parse_u32(val);
+                else if (!strcmp(key, "FLOW_PROBE_LIMIT"))       FLOW_PROBE_LIMIT       = parse_u32(val);
+                else if (!strcmp(key, "RX_RING_VERSION"))        RX_RING_VERSION        = parse_u32(val);
+                else if (!strcmp(key, "RX_BLOCK_TIMEOUT_MS"))    RX_BLOCK_TIMEOUT_MS    = parse_u32(val);
+                else if (!strcmp(key, "TX_RING"))         TX_RING         = (!strcmp(val, "true") || !strcmp(val, "1"));
+                else if (!strcmp(key, "TX_QDISC_BYPASS")) TX_QDISC_BYPASS = (!strcmp(val, "true") || !strcmp(val, "1"));
+                else if (!strcmp(key, "WORKERS_DOWNSTREAM"))     WORKERS_DOWNSTREAM = parse_u32(val);
+                else if (!strcmp(key, "WORKERS_UPSTREAM"))       WORKERS_UPSTREAM   = parse_u32(val);
+                else if (!strcmp(key, "WORKER_CPUS_DOWNSTREAM")) parse_cpu_list(val, WORKER_CPUS_DOWNSTREAM);
+                else if (!strcmp(key, "WORKER_CPUS_UPSTREAM"))   parse_cpu_list(val, WORKER_CPUS_UPSTREAM);
+                else if (!strcmp(key, "RX_FANOUT_MODE"))
+                    RX_FANOUT_MODE = !strcmp(val, "cpu") ? FanoutMode::Cpu : FanoutMode::Hash;
+                else if (!strcmp(key, "RX_FANOUT_ROLLOVER")) RX_FANOUT_ROLLOVER = (!strcmp(val, "true") || !strcmp(val, "1"));
+                else if (!strcmp(key, "BUSY_POLL_US"))       BUSY_POLL_US       = parse_u32(val);
                 else if (!strcmp(key, "enable_gui"))        global_state.enable_gui.store(!strcmp(val, "true") || !strcmp(val, "1"), std::memory_order_relaxed);
                 else if (!strcmp(key, "enable_nat"))        global_state.enable_nat.store(!strcmp(val, "true") || !strcmp(val, "1"), std::memory_order_relaxed);
                 else if (!strcmp(key, "enable_dhcp"))       global_state.enable_dhcp.store(!strcmp(val, "true") || !strcmp(val, "1"), std::memory_order_relaxed);
@@ -184,6 +221,16 @@ std::expected<void, std::string> load_config(const std::string& path) {
                                 ip_e.error());
                     }
                 }
+                else if (!strcmp(key, "NAT_CONE_DEVICE")) {
+                    auto ip_e = parse_ip_str(val);
+                    if (ip_e)
+                        add_nat_cone_device(*ip_e);
+                    else
+                        std::println(stderr, "[Config] NAT_CONE_DEVICE bad address: {}",
+                            ip_e.error());
+                }
+                else if (!strcmp(key, "NAT_CONE_GAME_PORTS"))
+                    NAT_CONE_GAME_PORTS.store(!strcmp(val, "true") || !strcmp(val, "1"), std::memory_order_relaxed);
                 else if (!strcmp(key, "GAME_PORT")) {
                     if (g_load_game_ports_n < MAX_GAME_PORT_RANGES) {
                         // Format: port or start-end, optionally followed by :description
@@ -260,6 +307,18 @@ std::expected<void, std::string> save_config(const std::string& path) {
     dprintf(fd, "LARGE_PACKET_THRESHOLD=%u\n", LARGE_PACKET_THRESHOLD_BYTES);
     dprintf(fd, "PUNISH_TRIGGER_COUNT=%u\n",   PUNISH_TRIGGER_COUNT);
     dprintf(fd, "CLEANUP_INTERVAL=%u\n",       CLEANUP_INTERVAL_PKTS);
+    dprintf(fd, "FLOW_PROBE_LIMIT=%u\n",       FLOW_PROBE_LIMIT);
+    dprintf(fd, "RX_RING_VERSION=%u\n",        RX_RING_VERSION);
+    dprintf(fd, "RX_BLOCK_TIMEOUT_MS=%u\n",    RX_BLOCK_TIMEOUT_MS);
+    dprintf(fd, "TX_RING=%s\n",                b(TX_RING));
+    dprintf(fd, "TX_QDISC_BYPASS=%s\n",        b(TX_QDISC_BYPASS));
+    dprintf(fd, "WORKERS_DOWNSTREAM=%u\n",     WORKERS_DOWNSTREAM);
+    dprintf(fd, "WORKERS_UPSTREAM=%u\n",       WORKERS_UPSTREAM);
+    write_cpu_list(fd, "WORKER_CPUS_DOWNSTREAM", WORKER_CPUS_DOWNSTREAM);
+    write_cpu_list(fd, "WORKER_CPUS_UPSTREAM",   WORKER_CPUS_UPSTREAM);
+    dprintf(fd, "RX_FANOUT_MODE=%s\n",         RX_FANOUT_MODE == FanoutMode::Cpu ? "cpu" : "hash");
+    dprintf(fd, "RX_FANOUT_ROLLOVER=%s\n",     b(RX_FANOUT_ROLLOVER));
+    dprintf(fd, "BUSY_POLL_US=%u\n",           BUSY_POLL_US);
     dprintf(fd, "enable_gui=%s\n",        b(global_state.enable_gui.load(std::memory_order_relaxed)));
     dprintf(fd, "enable_nat=%s\n",        b(global_state.enable_nat.load(std::memory_order_relaxed)));
     dprintf(fd, "enable_dhcp=%s\n",       b(global_state.enable_dhcp.load(std::memory_order_relaxed)));
@@ -289,6 +348,12 @@ std::expected<void, std::string> save_config(const std::string& path) {
                 IP_LIMIT_TABLE[i].rate.value);
         }
     }
+    dprintf(fd, "NAT_CONE_GAME_PORTS=%s\n", b(NAT_CONE_GAME_PORTS.load(std::memory_order_relaxed)));
+    for (size_t i = 0; i < NAT_CONE_DEVICE_COUNT; ++i) {
+        uint32_t ip = NAT_CONE_DEVICES[i].raw();
+        dprintf(fd, "NAT_CONE_DEVICE=%u.%u.%u.%u\n",
+            ip & 0xFF, (ip >> 8) & 0xFF, (ip >> 16) & 0xFF, (ip >> 24) & 0xFF);
+    }
     {
         size_t ai = game_port_active_idx.load(std::memory_order_acquire);
         size_t n  = game_port_table_counts[ai];
@@ -1,11 +1,91 @@
 #include "DataPlane.hpp"
 #include "Telemetry.hpp"
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <unistd.h>
 #include <cerrno>
 #include <cstdint>
+#include <cstring>
 
 namespace HPGTP::DataPlane {
 
+TxRing::~TxRing() {
+    if (ring && ring != MAP_FAILED) munmap(ring, ring_size);
+    if (fd >= 0) close(fd);
+}
+
+std::expected<void, std::string> TxRing::open(std::string_view iface_name, bool qdisc_bypass) {
+    // Protocol 0: the socket never receives, it only drains the TX ring.
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0) return std::unexpected(std::string("TX socket creation failed: ") + strerror(errno));
+
+    struct ifreq ifr{};
+    auto n = iface_name.copy(ifr.ifr_name, IFNAMSIZ - 1);
+    ifr.ifr_name[n] = '\0';
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) return std::unexpected("TX interface lookup failed");
+
+    // Malformed frames are skipped by the kernel instead of halting the ring (TP_STATUS_WRONG_FORMAT).
+    int loss = 1;
+    setsockopt(fd, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss));
+    if (qdisc_bypass) {
+        int one = 1;
+        if (setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0)
+            return std::unexpected(std::string("PACKET_QDISC_BYPASS: ") + strerror(errno));
+    }
+
+    tpacket_req req{
+        .tp_block_size = FRAME_SIZE * 32,
+        .tp_block_nr   = FRAME_NR / 32,
+        .tp_frame_size = FRAME_SIZE,
+        .tp_frame_nr   = FRAME_NR
+    };
+    if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+        return std::unexpected(std::string("Setsockopt TX_RING failed: ") + strerror(errno));
+
+    ring_size = static_cast<size_t>(req.tp_block_size) * req.tp_block_nr;
+    ring = static_cast<uint8_t*>(mmap(nullptr, ring_size,
+                                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if (ring == MAP_FAILED) return std::unexpected("TX ring mmap failed");
+
+    sockaddr_ll sll{};
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = 0;
+    sll.sll_ifindex  = ifr.ifr_ifindex;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&sll), sizeof(sll)) < 0)
+        return std::unexpected("TX bind failed");
+    return {};
+}
+
+TxRing::StageResult TxRing::stage(std::span<const uint8_t> pkt) noexcept {
+    constexpr size_t data_off = TPACKET_ALIGN(sizeof(tpacket_hdr));
+    if (pkt.size() > FRAME_SIZE - data_off) return StageResult::Error;
+
+    auto* hdr = reinterpret_cast<tpacket_hdr*>(ring + static_cast<size_t>(head) * FRAME_SIZE);
+    const auto st = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if (st & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        flush();
+        return StageResult::Busy;
+    }
+
+    std::memcpy(reinterpret_cast<uint8_t*>(hdr) + data_off, pkt.data(), pkt.size());
+    hdr->tp_len = static_cast<unsigned int>(pkt.size());
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    head = (head + 1) % FRAME_NR;
+    if (++pending >= FLUSH_BATCH) flush();
+    return StageResult::Staged;
+}
+
+void TxRing::flush() noexcept {
+    if (pending == 0) return;
+    pending = 0;
+    while (::send(fd, nullptr, 0, MSG_DONTWAIT) < 0 && errno == EINTR) { }
+}
+
 TxFrameOutput::PacketTxTry TxFrameOutput::try_send_packet_nonblocking(
     int tx_fd, std::span<const uint8_t> pkt) noexcept {
     for (;;) {
@@ -20,6 +100,94 @@ TxFrameOutput::PacketTxTry TxFrameOutput::try_send_packet_nonblocking(
     }
 }
 
+TxFrameOutput::PacketTxTry TxFrameOutput::try_send_packet_nonblocking(
+    const TxPort& port, std::span<const uint8_t> pkt) noexcept {
+    if (!port.ring) return try_send_packet_nonblocking(port.fd, pkt);
+    switch (port.ring->stage(pkt)) {
+    case TxRing::StageResult::Staged: return PacketTxTry::Complete;
+    case TxRing::StageResult::Busy:   return PacketTxTry::Busy;
+    case TxRing::StageResult::Error:  return PacketTxTry::Error;
+    }
+    return PacketTxTry::Error;
+}
+
+void TxFrameOutput::send_batch_nonblocking(int tx_fd,
+    std::span<const std::span<const uint8_t>> frames, std::span<PacketTxTry> results) noexcept {
+    constexpr size_t MAX_BATCH = TxBatch::MAX_FRAMES;
+    const size_t n = frames.size() < MAX_BATCH ? frames.size() : MAX_BATCH;
+    std::array<iovec, MAX_BATCH>   iov{};
+    std::array<mmsghdr, MAX_BATCH> msgs{};
+    for (size_t i = 0; i < n; ++i) {
+        iov[i] = { const_cast<uint8_t*>(frames[i].data()), frames[i].size() };
+        msgs[i].msg_hdr.msg_iov    = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    size_t off = 0;
+    while (off < n) {
+        int r = ::sendmmsg(tx_fd, msgs.data() + off, static_cast<unsigned>(n - off), MSG_DONTWAIT);
+        if (r > 0) {
+            for (size_t i = off; i < off + static_cast<size_t>(r); ++i)
+                results[i] = msgs[i].msg_len == frames[i].size() ? PacketTxTry::Complete
+                                                                  : PacketTxTry::Error;
+            off += static_cast<size_t>(r);
+            continue;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+            for (size_t i = off; i < n; ++i) results[i] = PacketTxTry::Busy;
+            return;
+        }
+        // Hard error on frames[off]: account it and carry on with the rest.
+        results[off++] = PacketTxTry::Error;
+    }
+}
+
+void TxFrameOutput::flush(const TxPort& port) {
+    if (port.ring)       port.ring->flush();
+    else if (port.batch) port.batch->flush();
+}
+
+void TxBatch::stage(std::span<const uint8_t> pkt, int core_id, size_t prio_idx) {
+    if (pkt.size() > FRAME_MAX) {
+        Telemetry::instance().core_metrics[core_id].dropped[prio_idx]
+            .fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (count == MAX_FRAMES) flush();
+    auto& s = slots[count++];
+    s.len  = static_cast<uint16_t>(pkt.size());
+    s.core = static_cast<uint8_t>(core_id);
+    s.prio = static_cast<uint8_t>(prio_idx);
+    std::memcpy(s.data.data(), pkt.data(), pkt.size());
+}
+
+void TxBatch::flush() {
+    if (count == 0) return;
+    std::array<std::span<const uint8_t>, MAX_FRAMES> frames;
+    std::array<TxFrameOutput::PacketTxTry, MAX_FRAMES> results;
+    for (size_t i = 0; i < count; ++i) frames[i] = { slots[i].data.data(), slots[i].len };
+    TxFrameOutput::send_batch_nonblocking(fd, std::span(frames.data(), count),
+                                          std::span(results.data(), count));
+    auto& tel = Telemetry::instance();
+    for (size_t i = 0; i < count; ++i)
+        if (results[i] != TxFrameOutput::PacketTxTry::Complete)
+            tel.core_metrics[slots[i].core].dropped[slots[i].prio]
+                .fetch_add(1, std::memory_order_relaxed);
+    count = 0;
+}
+
+void TxFrameOutput::send_best_effort(const TxPort& port, std::span<const uint8_t> pkt,
+                                     int core_id, size_t prio_idx) {
+    if (!port.ring && port.batch) {
+        port.batch->stage(pkt, core_id, prio_idx);
+        return;
+    }
+    if (try_send_packet_nonblocking(port, pkt) != PacketTxTry::Complete)
+        Telemetry::instance().core_metrics[core_id].dropped[prio_idx]
+            .fetch_add(1, std::memory_order_relaxed);
+}
+
 void TxFrameOutput::send_best_effort(int tx_fd, std::span<const uint8_t> pkt,
                                      int core_id, size_t prio_idx) {
     if (try_send_packet_nonblocking(tx_fd, pkt) != PacketTxTry::Complete)
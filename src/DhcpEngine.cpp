@@ -230,7 +230,9 @@ void DhcpEngine::intercept_request(const Net::ParsedPacket& pkt) {
     DhcpMessage msg;
     msg.len = std::min(pkt.raw_span.size(), size_t(512));
     std::memcpy(msg.data.data(), pkt.raw_span.data(), msg.len);
+    while (request_push_lock_.test_and_set(std::memory_order_acquire)) { }
     request_queue.push(msg);
+    request_push_lock_.clear(std::memory_order_release);
 }
 
 void DhcpEngine::process_background_tasks(int lan_fd) {
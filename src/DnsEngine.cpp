@@ -115,7 +115,7 @@ void DnsEngine::reload_static_records() {
 }
 
 bool DnsEngine::do_bounce(Net::ParsedPacket& pkt, DnsHeader* dns, Net::UDPHeader* udp,
-                          Net::IPv4Net ip, int bounce_fd) noexcept {
+                          Net::IPv4Net ip, int bounce_fd, int core_id) noexcept {
     if (!pkt.ipv4) return false;
     const size_t eth_sz = sizeof(Net::EthernetHeader);
     const uint16_t ip_tot = ntohs(pkt.ipv4->tot_len);
@@ -160,8 +160,9 @@ bool DnsEngine::do_bounce(Net::ParsedPacket& pkt, DnsHeader* dns, Net::UDPHeader
     const auto tr = DataPlane::TxFrameOutput::try_send_packet_nonblocking(
         bounce_fd, std::span<const uint8_t>(pkt.raw_span.data(), new_len));
     if (tr != DataPlane::TxFrameOutput::PacketTxTry::Complete) {
-        Telemetry::instance().core_metrics[3].dropped[1].fetch_add(
-            1, std::memory_order_relaxed);
+        if (core_id >= 0 && static_cast<size_t>(core_id) < Telemetry::MAX_CORES)
+            Telemetry::instance().core_metrics[static_cast<size_t>(core_id)].dropped[1].fetch_add(
+                1, std::memory_order_relaxed);
         return false;
     }
     return true;
@@ -175,10 +176,11 @@ void DnsEngine::rewrite_upstream(Net::ParsedPacket& pkt, Net::UDPHeader* udp,
     // UDP pseudo-header includes daddr: patch transport checksum when present.
     if (udp && udp->check != 0)
         csum_patch_32(udp->check, old_daddr, upstream_ip);
+    pkt.rehash();
 }
 
 DnsQueryDisposition DnsEngine::process_query(Net::ParsedPacket& pkt,
-                                             int bounce_fd) noexcept {
+                                             int bounce_fd, int core_id) noexcept {
     if (!pkt.is_valid_ipv4() || pkt.l4_protocol != 17)
         return DnsQueryDisposition::NotHandled;
 
@@ -202,7 +204,7 @@ DnsQueryDisposition DnsEngine::process_query(Net::ParsedPacket& pkt,
     uint8_t scnt = static_count.load(std::memory_order_acquire);
     for (uint8_t i = 0; i < scnt; ++i) {
         if (static_records[i].domain_hash == h)
-            return do_bounce(pkt, dns, udp, static_records[i].ip, bounce_fd)
+            return do_bounce(pkt, dns, udp, static_records[i].ip, bounce_fd, core_id)
                 ? DnsQueryDisposition::Replied
                 : DnsQueryDisposition::ReplySendFailed;
     }
@@ -216,7 +218,7 @@ DnsQueryDisposition DnsEngine::process_query(Net::ParsedPacket& pkt,
             const uint32_t ex = cache[idx].expire_tick.load(std::memory_order_relaxed);
             if (!cache[idx].valid.load(std::memory_order_acquire)) continue;
             if (dh == h && current_tick.load(std::memory_order_relaxed) <= ex)
-                return do_bounce(pkt, dns, udp, addr, bounce_fd) ? DnsQueryDisposition::Replied
+                return do_bounce(pkt, dns, udp, addr, bounce_fd, core_id) ? DnsQueryDisposition::Replied
                                                                  : DnsQueryDisposition::ReplySendFailed;
             cache[idx].valid.store(false, std::memory_order_relaxed);
             break;
@@ -255,6 +257,7 @@ void DnsEngine::process_response(Net::ParsedPacket& pkt) noexcept {
         csum_patch_32(pkt.ipv4->check, old_saddr, orig_dst);
         if (udp->check != 0)
             csum_patch_32(udp->check, old_saddr, orig_dst);
+        pkt.rehash();
     }
 
     if (pkt.raw_span.size() > 512) return;
@@ -263,7 +266,9 @@ void DnsEngine::process_response(Net::ParsedPacket& pkt) noexcept {
     DnsMessage msg;
     msg.len = pkt.raw_span.size();
     std::memcpy(msg.data.data(), pkt.raw_span.data(), pkt.raw_span.size());
+    while (response_push_lock_.test_and_set(std::memory_order_acquire)) { }
     response_queue.push(msg);
+    response_push_lock_.clear(std::memory_order_release);
 }
 
 void DnsEngine::process_background_tasks() {
@@ -5,18 +5,6 @@
 
 namespace HPGTP::Logic {
 
-uint32_t FirewallEngine::hash_remote(uint32_t remote_ip, uint16_t remote_port, uint8_t proto) {
-    uint32_t h = 2166136261U;
-    const uint8_t* p;
-    p = reinterpret_cast<const uint8_t*>(&remote_ip);
-    h ^= p[0]; h *= 16777619U; h ^= p[1]; h *= 16777619U;
-    h ^= p[2]; h *= 16777619U; h ^= p[3]; h *= 16777619U;
-    p = reinterpret_cast<const uint8_t*>(&remote_port);
-    h ^= p[0]; h *= 16777619U; h ^= p[1]; h *= 16777619U;
-    h ^= proto; h *= 16777619U;
-    return h;
-}
-
 uint32_t FirewallEngine::timeout_for(ConnState s) {
     if (s == ConnState::ESTABLISHED) return TIMEOUT_ESTABLISHED;
     if (s == ConnState::FIN_WAIT)    return TIMEOUT_FIN_WAIT;
@@ -74,7 +62,8 @@ void FirewallEngine::track_outbound(const Net::ParsedPacket& pkt) {
         lan_port    = tcp->source;
     }
 
-    uint32_t h       = hash_remote(remote_ip, remote_port, proto) % TABLE_SIZE;
+    // Remote = destination endpoint on the outbound path
+    uint32_t h       = pkt.dst_hash() % TABLE_SIZE;
     int32_t  free_slot = -1;
     uint32_t tick    = current_tick.load(std::memory_order_relaxed);
 
@@ -121,6 +110,25 @@ void FirewallEngine::track_outbound(const Net::ParsedPacket& pkt) {
         Telemetry::instance().conntrack_track_drops.fetch_add(1, std::memory_order_relaxed);
         return;
     }
+
+    // With several upstream workers another one may have taken the slot since the
+    // scan above; re-validate under the claim lock and move to the next free slot.
+    lock_claim();
+    auto slot_free = [this](const ConnTrackEntry& e) {
+        return !e.active.load(std::memory_order_acquire) || is_expired(e);
+    };
+    if (!slot_free(table[free_slot])) {
+        free_slot = -1;
+        for (size_t i = 0; i < PROBE_LIMIT; ++i) {
+            size_t idx = (h + i) % TABLE_SIZE;
+            if (slot_free(table[idx])) { free_slot = static_cast<int32_t>(idx); break; }
+        }
+        if (free_slot == -1) {
+            unlock_claim();
+            Telemetry::instance().conntrack_track_drops.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
     auto& ne = table[free_slot];
     ne.seq.fetch_add(1, std::memory_order_acq_rel);
     ne.remote_ip   = remote_ip;
@@ -140,6 +148,18 @@ void FirewallEngine::track_outbound(const Net::ParsedPacket& pkt) {
         ne.state.store(ConnState::ESTABLISHED, std::memory_order_relaxed);
     }
     ne.active.store(true, std::memory_order_release);
+    conn_timers.arm(static_cast<uint32_t>(free_slot), tick + timeout_for(ne.state.load(std::memory_order_relaxed)) + 1);
+    unlock_claim();
+}
+
+void FirewallEngine::prefetch_outbound(const Net::ParsedPacket& pkt) const noexcept {
+    if (!pkt.is_valid_ipv4() || (!pkt.udp() && !pkt.tcp())) return;
+    Net::prefetch_write(&table[pkt.dst_hash() % TABLE_SIZE]);
+}
+
+void FirewallEngine::prefetch_inbound(const Net::ParsedPacket& pkt) const noexcept {
+    if (!pkt.is_valid_ipv4() || (!pkt.udp() && !pkt.tcp())) return;
+    Net::prefetch_read(&table[pkt.src_hash() % TABLE_SIZE]);
 }
 
 bool FirewallEngine::check_inbound(const Net::ParsedPacket& pkt) {
@@ -162,7 +182,8 @@ bool FirewallEngine::check_inbound(const Net::ParsedPacket& pkt) {
         sport = tcp->source;
     }
 
-    uint32_t h    = hash_remote(remote_ip, sport, proto) % TABLE_SIZE;
+    // Remote = source endpoint inbound; same endpoint hash as track_outbound's dst_hash()
+    uint32_t h    = pkt.src_hash() % TABLE_SIZE;
     uint32_t tick = current_tick.load(std::memory_order_relaxed);
 
     for (size_t i = 0; i < PROBE_LIMIT; ++i) {
@@ -221,10 +242,20 @@ bool FirewallEngine::check_inbound(const Net::ParsedPacket& pkt) {
 }
 
 void FirewallEngine::cleanup() {
-    for (auto& e : table) {
-        if (e.active.load(std::memory_order_relaxed) && is_expired(e))
+    const uint32_t tick = current_tick.load(std::memory_order_relaxed);
+    lock_claim();
+    conn_timers.advance(tick, [&](uint32_t idx) {
+        auto& e = table[idx];
+        if (!e.active.load(std::memory_order_relaxed)) return;   // RST already closed it
+        if (is_expired(e)) {
             e.active.store(false, std::memory_order_release);
-    }
+            return;
+        }
+        // Refreshed or moved to a longer-lived state since it was armed
+        conn_timers.arm(idx, e.last_tick.load(std::memory_order_relaxed)
+                             + timeout_for(e.state.load(std::memory_order_relaxed)) + 1);
+    });
+    unlock_claim();
 }
 
 } // namespace HPGTP::Logic
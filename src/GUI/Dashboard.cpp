@@ -408,9 +408,9 @@ OverviewPage::OverviewPage(QWidget* parent) : QWidget(parent) {
     plot_row->addWidget(bps_group);
     layout->addLayout(plot_row);
 
-    // 4-core CPU load row
+    // Per-core CPU load row; refresh() hides cores beyond Telemetry::core_count
     auto* cores_row = new QHBoxLayout();
-    for (int i = 0; i < 4; ++i) {
+    for (size_t i = 0; i < Telemetry::MAX_CORES; ++i) {
         core_labels[i] = new QLabel(QString("Core %1\n0%").arg(i));
         core_labels[i]->setStyleSheet("background-color: #22223a; border: 1px solid #2a2a4a; border-radius: 6px; padding: 10px; font-size: 15px;");
         core_labels[i]->setAlignment(Qt::AlignCenter);
@@ -445,9 +445,14 @@ OverviewPage::OverviewPage(QWidget* parent) : QWidget(parent) {
     layout->addStretch();
 }
 
-void OverviewPage::refresh(const Telemetry& tel, const std::array<uint64_t, 4>& last_p, const std::array<uint64_t, 4>& last_b) {
+void OverviewPage::refresh(const Telemetry& tel,
+                           const std::array<uint64_t, Telemetry::MAX_CORES>& last_p,
+                           const std::array<uint64_t, Telemetry::MAX_CORES>& last_b) {
     double total_pps = 0, total_bps = 0;
-    for (int i = 0; i < 4; ++i) {
+    const size_t n_cores = tel.core_count.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < Telemetry::MAX_CORES; ++i) {
+        core_labels[i]->setVisible(i < n_cores);
+        if (i >= n_cores) continue;
         uint64_t cp = tel.core_metrics[i].pkts.load(std::memory_order_relaxed);
         uint64_t cb = tel.core_metrics[i].bytes.load(std::memory_order_relaxed);
         uint64_t dp = cp - last_p[i], db = cb - last_b[i];
@@ -456,7 +461,12 @@ void OverviewPage::refresh(const Telemetry& tel, const std::array<uint64_t, 4>&
         int load_pct = tel.core_metrics[i].cpu_load_pct.load(std::memory_order_relaxed);
         // Colour: green <50%, orange 50-80%, red >80%
         const char* colour = load_pct < 50 ? "#00cc66" : (load_pct < 80 ? "#ffaa00" : "#ff4444");
-        core_labels[i]->setText(QString("Core %1\n%2%").arg(i).arg(load_pct));
+        // Worker cores are tagged with their forwarding direction(s)
+        uint8_t role = tel.core_metrics[i].role.load(std::memory_order_relaxed);
+        QString tag = QString("%1%2")
+            .arg((role & CORE_ROLE_DOWNSTREAM) ? " ↓" : "")
+            .arg((role & CORE_ROLE_UPSTREAM)   ? " ↑" : "");
+        core_labels[i]->setText(QString("Core %1%2\n%3%").arg(i).arg(tag).arg(load_pct));
         core_labels[i]->setStyleSheet(
             QString("background-color: #22223a; border: 1px solid #2a2a4a; border-radius: 6px;"
                     " padding: 10px; font-size: 15px; color: %1;").arg(colour));
@@ -2630,10 +2640,10 @@ void Dashboard::timerEvent(QTimerEvent* event) {
     auto& tel = Telemetry::instance();
 
     // Bandwidth: byte delta / actual elapsed seconds → Mbps
-    uint64_t cur_b2 = tel.core_metrics[2].bytes.load(std::memory_order_relaxed);
-    uint64_t cur_b3 = tel.core_metrics[3].bytes.load(std::memory_order_relaxed);
-    double dl = (cur_b2 - last_bytes[2]) * 8.0 / elapsed / 1e6;
-    double ul = (cur_b3 - last_bytes[3]) * 8.0 / elapsed / 1e6;
+    uint64_t cur_dl = tel.direction_metrics[0].bytes.load(std::memory_order_relaxed);
+    uint64_t cur_ul = tel.direction_metrics[1].bytes.load(std::memory_order_relaxed);
+    double dl = (cur_dl - last_dir_bytes[0]) * 8.0 / elapsed / 1e6;
+    double ul = (cur_ul - last_dir_bytes[1]) * 8.0 / elapsed / 1e6;
 
     // CPU temperature
     double t = tel.cpu_temp_celsius.load(std::memory_order_relaxed);
@@ -2655,10 +2665,12 @@ void Dashboard::timerEvent(QTimerEvent* event) {
         page_devices->refresh();
 
     // Snapshot current counters for next delta
-    for (int i = 0; i < 4; ++i) {
+    for (size_t i = 0; i < Telemetry::MAX_CORES; ++i) {
         last_pkts[i]  = tel.core_metrics[i].pkts.load(std::memory_order_relaxed);
         last_bytes[i] = tel.core_metrics[i].bytes.load(std::memory_order_relaxed);
     }
+    last_dir_bytes[0] = cur_dl;
+    last_dir_bytes[1] = cur_ul;
 }
 
 } // namespace HPGTP::GUI
@@ -1,5 +1,8 @@
 #include "NatEngine.hpp"
+#include <algorithm>
+#include <bit>
 #include <cstring>
+#include <print>
 #include <netinet/in.h>
 
 namespace HPGTP::Logic {
@@ -16,14 +19,14 @@ static void update_checksum_32(uint16_t& check, Net::IPv4Net old_val, Net::IPv4N
     update_checksum_16(check, old_val.raw() >> 16,    new_val.raw() >> 16);
 }
 
-uint32_t NatEngine::hash_flow(const FlowKey& k) const {
-    uint32_t h = 2166136261U;
-    auto proc = [&](const auto& val) {
-        const uint8_t* p = reinterpret_cast<const uint8_t*>(&val);
-        for (size_t i = 0; i < sizeof(val); ++i) { h ^= p[i]; h *= 16777619U; }
-    };
-    proc(k.saddr); proc(k.daddr); proc(k.sport); proc(k.dport);
-    return h;
+// Seqlock bracket for a single writer (the shard owner): plain stores, no RMW.
+static void seq_write_begin(std::atomic<uint32_t>& seq) {
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void seq_write_end(std::atomic<uint32_t>& seq) {
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
 }
 
 uint32_t NatEngine::hash_icmp_flow(Net::IPv4Net sa, Net::IPv4Net da, uint16_t id_nbo) const {
@@ -62,7 +65,6 @@ bool NatEngine::process_outbound_icmp(Net::ParsedPacket& pkt) {
 
     auto icmp = pkt.icmp_echo();
     if (!icmp) return false;
-    if (ntohs(ip->frag_off) & 0x3FFF) return false;
     if (icmp->type != 8 || icmp->code != 0) return false;
 
     const uint16_t id_nbo = icmp->id;
@@ -70,6 +72,8 @@ bool NatEngine::process_outbound_icmp(Net::ParsedPacket& pkt) {
     const uint32_t tick = current_tick.load(std::memory_order_relaxed);
     uint16_t       ext_nbo = 0;
 
+    // Echo traffic is light: the whole probe runs under the creation lock.
+    lock_create();
     for (size_t n = 0; n < 32; ++n) {
         const size_t idx      = (h + n) % MAX_ICMP_SESSIONS;
         const bool   is_active = icmp_sessions[idx].active.load(std::memory_order_acquire);
@@ -90,6 +94,7 @@ bool NatEngine::process_outbound_icmp(Net::ParsedPacket& pkt) {
             const uint16_t new_ext = alloc_external_icmp_id();
             if (!new_ext) {
                 sess.seq.fetch_add(1, std::memory_order_acq_rel);
+                unlock_create();
                 return false;
             }
             sess.int_saddr     = ip->saddr;
@@ -112,6 +117,7 @@ bool NatEngine::process_outbound_icmp(Net::ParsedPacket& pkt) {
             break;
         }
     }
+    unlock_create();
 
     if (!ext_nbo) return false;
 
@@ -131,7 +137,6 @@ bool NatEngine::process_inbound_icmp(Net::ParsedPacket& pkt) {
 
     auto icmp = pkt.icmp_echo();
     if (!icmp) return false;
-    if (ntohs(ip->frag_off) & 0x3FFF) return false;
     if (icmp->type != 0 || icmp->code != 0) return false;
 
     const uint16_t     ext_host = ntohs(icmp->id);
@@ -174,8 +179,12 @@ bool NatEngine::process_inbound_icmp(Net::ParsedPacket& pkt) {
 }
 
 NatEngine::NatEngine() {
-    for (auto& p : port_to_index)
-        p.store(-1, std::memory_order_relaxed);
+    for (size_t i = 0; i < MAX_SHARDS; ++i) {
+        shards[i].port_base = static_cast<uint16_t>(PORT_FIRST + i * PORTS_PER_SHARD);
+        for (auto& pool : shards[i].port_to_slot)
+            for (auto& p : pool)
+                p.store(-1, std::memory_order_relaxed);
+    }
     for (auto& p : icmp_id_to_index)
         p.store(-1, std::memory_order_relaxed);
 }
@@ -184,35 +193,435 @@ void NatEngine::set_wan_ip(Net::IPv4Net ip) {
     wan_ip_nbo.store(ip.raw(), std::memory_order_release);
 }
 
-void NatEngine::add_upnp_rule(UpnpRule rule) {
-    uint16_t net_ext_port = htons(rule.ext_port);
-    uint16_t net_int_port = htons(rule.int_port);
+size_t NatEngine::find_upnp_locked(uint16_t ext_port_nbo, uint8_t protocol) const noexcept {
+    size_t i = 0;
+    while (i < upnp_list_count
+           && !(upnp_list[i].m.external_port == ext_port_nbo && upnp_list[i].m.protocol == protocol))
+        ++i;
+    return i;
+}
 
-    for (auto& r : upnp_rules) {
-        if (r.active.load(std::memory_order_acquire)) {
-            if (r.external_port == net_ext_port && r.protocol == rule.proto) {
-                r.seq.fetch_add(1, std::memory_order_acq_rel);
-                r.internal_ip   = rule.int_ip;
-                r.internal_port = net_int_port;
-                r.seq.fetch_add(1, std::memory_order_acq_rel);
-                return;
+bool NatEngine::reserve_mapped_port(uint16_t ext_port_nbo, uint8_t protocol) noexcept {
+    const uint32_t off = static_cast<uint32_t>(ntohs(ext_port_nbo)) - PORT_FIRST;
+    if (off >= PORTS_PER_SHARD * MAX_SHARDS) return true;
+    Shard&         sh  = shards[off / PORTS_PER_SHARD];
+    const uint32_t o   = off % PORTS_PER_SHARD;
+    PortPool&      pool = sh.pools[pool_of(protocol)];
+    const uint64_t bit = uint64_t{1} << (o % 64);
+    // Reserve, then look for a session: claim_session() publishes, then looks for a
+    // reservation, so at most one of the two keeps the port.
+    pool.reserved[o / 64].fetch_or(bit, std::memory_order_seq_cst);
+    if (sh.port_to_slot[pool_of(protocol)][o].load(std::memory_order_seq_cst) < 0) return true;
+    pool.reserved[o / 64].fetch_and(~bit, std::memory_order_seq_cst);
+    return false;
+}
+
+void NatEngine::release_mapped_port(uint16_t ext_port_nbo, uint8_t protocol) noexcept {
+    const uint32_t off = static_cast<uint32_t>(ntohs(ext_port_nbo)) - PORT_FIRST;
+    if (off >= PORTS_PER_SHARD * MAX_SHARDS) return;
+    const uint32_t o = off % PORTS_PER_SHARD;
+    shards[off / PORTS_PER_SHARD].pools[pool_of(protocol)].reserved[o / 64].fetch_and(
+        ~(uint64_t{1} << (o % 64)), std::memory_order_release);
+}
+
+void NatEngine::remove_upnp_locked(size_t i) noexcept {
+    release_mapped_port(upnp_list[i].m.external_port, upnp_list[i].m.protocol);
+    const size_t last = --upnp_list_count;
+    upnp_timers.cancel(static_cast<uint32_t>(i));
+    if (i != last) {
+        upnp_list[i] = upnp_list[last];
+        upnp_timers.move(static_cast<uint32_t>(last), static_cast<uint32_t>(i));
+    }
+}
+
+std::expected<void, NatEngine::UpnpError> NatEngine::add_upnp_rule(const UpnpRule& rule) {
+    const UpnpMapping m{rule.int_ip, htons(rule.int_port), htons(rule.ext_port), rule.proto};
+    const uint32_t lease =
+        rule.lease_s == 0 || rule.lease_s > UPNP_MAX_LEASE ? UPNP_MAX_LEASE : rule.lease_s;
+    std::lock_guard<std::mutex> lk(upnp_mutex_);
+    size_t i = find_upnp_locked(m.external_port, m.protocol);
+    if (i < upnp_list_count) {
+        if (upnp_list[i].m.internal_ip != m.internal_ip)
+            return std::unexpected(UpnpError::ConflictInMapping);
+    } else {
+        if (upnp_list_count == MAX_UPNP_RULES)
+            return std::unexpected(UpnpError::NoPortMapsAvailable);
+        if (!reserve_mapped_port(m.external_port, m.protocol))
+            return std::unexpected(UpnpError::ConflictInMapping);
+        i = upnp_list_count++;
+    }
+    UpnpEntry& e = upnp_list[i];
+    e.m            = m;
+    e.expires_tick = current_tick.load(std::memory_order_relaxed) + lease;
+    e.desc         = rule.desc;
+    e.desc.back()  = '\0';
+    upnp_timers.arm(static_cast<uint32_t>(i), e.expires_tick);
+    publish_upnp_locked();
+    return {};
+}
+
+std::expected<void, NatEngine::UpnpError> NatEngine::remove_upnp_rule(uint16_t ext_port, uint8_t proto) {
+    std::lock_guard<std::mutex> lk(upnp_mutex_);
+    const size_t i = find_upnp_locked(htons(ext_port), proto);
+    if (i == upnp_list_count) return std::unexpected(UpnpError::NoSuchEntry);
+    remove_upnp_locked(i);
+    publish_upnp_locked();
+    return {};
+}
+
+std::expected<NatEngine::UpnpRule, NatEngine::UpnpError> NatEngine::upnp_rule(uint16_t ext_port, uint8_t proto) {
+    std::lock_guard<std::mutex> lk(upnp_mutex_);
+    const size_t i = find_upnp_locked(htons(ext_port), proto);
+    if (i == upnp_list_count) return std::unexpected(UpnpError::NoSuchEntry);
+    const UpnpEntry& e = upnp_list[i];
+    return UpnpRule{ext_port, e.m.internal_ip, ntohs(e.m.internal_port), proto,
+                    e.expires_tick - current_tick.load(std::memory_order_relaxed), e.desc};
+}
+
+std::expected<NatEngine::UpnpRule, NatEngine::UpnpError> NatEngine::upnp_rule_at(size_t index) {
+    std::lock_guard<std::mutex> lk(upnp_mutex_);
+    if (index >= upnp_list_count) return std::unexpected(UpnpError::ArrayIndexInvalid);
+    const UpnpEntry& e = upnp_list[index];
+    return UpnpRule{ntohs(e.m.external_port), e.m.internal_ip, ntohs(e.m.internal_port),
+                    e.m.protocol, e.expires_tick - current_tick.load(std::memory_order_relaxed),
+                    e.desc};
+}
+
+void NatEngine::expire_upnp_rules() {
+    const uint32_t tick = current_tick.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lk(upnp_mutex_);
+    // Removal moves the last rule into the hole; its timer moves with it and
+    // still fires in this call if it is due too.
+    const size_t before = upnp_list_count;
+    upnp_timers.advance(tick, [&](uint32_t i) { remove_upnp_locked(i); });
+    if (upnp_list_count != before) {
+        std::println("[UPnP] {} port mapping(s) expired, {} active",
+                     before - upnp_list_count, upnp_list_count);
+        publish_upnp_locked();
+    }
+}
+
+// Rebuild the inactive table from upnp_list and make it the active one.
+void NatEngine::publish_upnp_locked() {
+    const uint32_t next = 1 - upnp_active.load(std::memory_order_relaxed);
+    UpnpTable&     t    = upnp_tables[next];
+    seq_write_begin(t.seq);
+    for (uint32_t i = 0; i < t.count; ++i)
+        t.by_external[pool_of(t.rules[i].protocol)][ntohs(t.rules[i].external_port)] = 0;
+    t.by_internal.fill(0);
+
+    t.count = static_cast<uint32_t>(upnp_list_count);
+    for (uint32_t i = 0; i < t.count; ++i) {
+        const UpnpMapping& r = upnp_list[i].m;
+        t.rules[i] = r;
+        t.by_external[pool_of(r.protocol)][ntohs(r.external_port)] = static_cast<uint16_t>(i + 1);
+        uint32_t h = Net::endpoint_hash(r.internal_ip.raw(), r.internal_port, r.protocol);
+        while (t.by_internal[h % UPNP_HASH_SLOTS]) ++h;
+        t.by_internal[h % UPNP_HASH_SLOTS] = static_cast<uint16_t>(i + 1);
+    }
+    seq_write_end(t.seq);
+    upnp_active.store(next, std::memory_order_release);
+    upnp_count.store(t.count, std::memory_order_release);
+}
+
+// Forward for the packet's LAN source endpoint. Its hash is the parse-time src_hash().
+bool NatEngine::upnp_outbound(const Net::ParsedPacket& pkt, uint16_t sport_nbo,
+                              UpnpMapping& out) const noexcept {
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        const UpnpTable& t  = upnp_tables[upnp_active.load(std::memory_order_acquire)];
+        const uint32_t   s0 = t.seq.load(std::memory_order_acquire);
+        if (s0 & 1u) continue;
+        bool found = false;
+        for (uint32_t h = pkt.src_hash(), n = 0; n < UPNP_HASH_SLOTS; ++h, ++n) {
+            const uint16_t i = t.by_internal[h % UPNP_HASH_SLOTS];
+            if (!i || i > MAX_UPNP_RULES) break;
+            const UpnpMapping& r = t.rules[i - 1];
+            if (r.protocol == pkt.ipv4->protocol && r.internal_ip == pkt.ipv4->saddr
+                && r.internal_port == sport_nbo) {
+                out   = r;
+                found = true;
+                break;
             }
         }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (t.seq.load(std::memory_order_relaxed) != s0) continue;
+        return found;
     }
-    size_t idx = upnp_cursor.fetch_add(1, std::memory_order_relaxed) % upnp_rules.size();
-    auto& slot = upnp_rules[idx];
-    slot.seq.fetch_add(1, std::memory_order_acq_rel);
-    slot.internal_ip   = rule.int_ip;
-    slot.internal_port = net_int_port;
-    slot.external_port = net_ext_port;
-    slot.protocol      = rule.proto;
-    slot.seq.fetch_add(1, std::memory_order_acq_rel);
-    slot.active.store(true, std::memory_order_release);
+    return false;
+}
+
+bool NatEngine::upnp_inbound(uint8_t protocol, uint16_t dport_nbo, UpnpMapping& out) const noexcept {
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        const UpnpTable& t  = upnp_tables[upnp_active.load(std::memory_order_acquire)];
+        const uint32_t   s0 = t.seq.load(std::memory_order_acquire);
+        if (s0 & 1u) continue;
+        const uint16_t i = t.by_external[pool_of(protocol)][ntohs(dport_nbo)];
+        if (i && i <= MAX_UPNP_RULES) out = t.rules[i - 1];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (t.seq.load(std::memory_order_relaxed) != s0) continue;
+        return i && i <= MAX_UPNP_RULES && out.protocol == protocol;
+    }
+    return false;
+}
+
+void NatEngine::set_upstream_workers(size_t n) noexcept {
+    upstream_workers = std::clamp<size_t>(n, 1, MAX_SHARDS);
 }
 
 void NatEngine::tick() { current_tick.fetch_add(1, std::memory_order_relaxed); }
 
-bool NatEngine::process_outbound(Net::ParsedPacket& pkt) {
+size_t NatEngine::owned_shard(size_t worker, uint32_t h) const noexcept {
+    const size_t n     = upstream_workers;
+    const size_t w     = worker < n ? worker : 0;
+    const size_t owned = (MAX_SHARDS - w + n - 1) / n;
+    // The low bits pick the slot inside the shard; spread over shards with the high ones.
+    return w + ((h >> 16) % owned) * n;
+}
+
+bool NatEngine::is_cone_flow(Net::IPv4Net lan_ip, uint16_t sport_nbo, uint16_t dport_nbo) noexcept {
+    if (Config::NAT_CONE_GAME_PORTS.load(std::memory_order_relaxed)
+        && (Config::is_game_port(ntohs(dport_nbo)) || Config::is_game_port(ntohs(sport_nbo))))
+        return true;
+    for (size_t i = 0; i < Config::NAT_CONE_DEVICE_COUNT; ++i)
+        if (Config::NAT_CONE_DEVICES[i] == lan_ip) return true;
+    return false;
+}
+
+// Port preservation: a LAN source port inside the NAT range can only be kept in the
+// shard whose slice holds it, and only by that shard's owner. MAX_SHARDS = none.
+size_t NatEngine::preserving_shard(size_t worker, uint16_t sport_nbo) const noexcept {
+    const size_t   n   = upstream_workers;
+    const uint32_t off = static_cast<uint32_t>(ntohs(sport_nbo)) - PORT_FIRST;
+    if (off >= PORTS_PER_SHARD * MAX_SHARDS) return MAX_SHARDS;
+    const size_t s = off / PORTS_PER_SHARD;
+    return s % n == (worker < n ? worker : 0) ? s : MAX_SHARDS;
+}
+
+NatEngine::PortPool::PortPool() {
+    for (uint32_t off = 0; off < PORTS_PER_SHARD; ++off)
+        free[off / 64] |= uint64_t{1} << (off % 64);
+    for (size_t w = 0; w < WORDS; ++w)
+        summary[w / 64] |= uint64_t{1} << (w % 64);
+}
+
+bool NatEngine::PortPool::take(uint32_t off) noexcept {
+    const uint32_t w   = off / 64;
+    const uint64_t bit = uint64_t{1} << (off % 64);
+    if (!(free[w] & bit)) return false;
+    free[w] &= ~bit;
+    if (!free[w]) summary[w / 64] &= ~(uint64_t{1} << (w % 64));
+    in_use.store(in_use.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return true;
+}
+
+int32_t NatEngine::PortPool::take_next() noexcept {
+    // Summary words from next_word on; the last pass wraps back onto the first one.
+    const size_t first = next_word / 64;
+    for (size_t i = 0; i <= SUMMARY; ++i) {
+        const size_t s = (first + i) % SUMMARY;
+        uint64_t     m = summary[s];
+        if (i == 0) m &= ~uint64_t{0} << (next_word % 64);
+        if (!m) continue;
+        const uint32_t w   = static_cast<uint32_t>(s * 64 + std::countr_zero(m));
+        const uint32_t off = w * 64 + static_cast<uint32_t>(std::countr_zero(free[w]));
+        free[w] &= free[w] - 1;
+        if (!free[w]) summary[s] &= ~(uint64_t{1} << (w % 64));
+        next_word = w + 1 == WORDS ? 0 : w + 1;
+        in_use.store(in_use.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return static_cast<int32_t>(off);
+    }
+    return -1;
+}
+
+void NatEngine::PortPool::put(uint32_t off) noexcept {
+    const uint32_t w = off / 64;
+    free[w] |= uint64_t{1} << (off % 64);
+    summary[w / 64] |= uint64_t{1} << (w % 64);
+    in_use.store(in_use.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+bool NatEngine::PortPool::is_reserved(uint32_t off) const noexcept {
+    return reserved[off / 64].load(std::memory_order_seq_cst) & (uint64_t{1} << (off % 64));
+}
+
+void NatEngine::PortPool::reclaim_parked() noexcept {
+    for (size_t w = 0; w < WORDS; ++w) {
+        if (!parked[w]) continue;
+        const uint64_t back = parked[w] & ~reserved[w].load(std::memory_order_acquire);
+        if (!back) continue;
+        parked[w] &= ~back;
+        free[w]   |= back;
+        summary[w / 64] |= uint64_t{1} << (w % 64);
+        in_use.store(in_use.load(std::memory_order_relaxed) - static_cast<uint32_t>(std::popcount(back)),
+                     std::memory_order_relaxed);
+    }
+}
+
+size_t NatEngine::ports_in_use(uint8_t protocol) const noexcept {
+    size_t n = 0;
+    for (const auto& sh : shards)
+        n += sh.pools[pool_of(protocol)].in_use.load(std::memory_order_relaxed);
+    return n;
+}
+
+void NatEngine::release_port(Shard& sh, const NatSession& sess) noexcept {
+    const size_t   pool = pool_of(sess.protocol);
+    const uint32_t off  = ntohs(sess.external_port) - sh.port_base;
+    sh.port_to_slot[pool][off].store(-1, std::memory_order_release);
+    sh.pools[pool].put(off);
+}
+
+void NatEngine::expire_sessions(size_t worker) {
+    const size_t n = upstream_workers;
+    if (worker >= n) return;
+    const uint32_t tick = current_tick.load(std::memory_order_relaxed);
+    for (size_t s = worker; s < MAX_SHARDS; s += n) {
+        Shard& sh = shards[s];
+        if (sh.timers.now() == tick) continue;
+        sh.timers.advance(tick, [&](uint32_t idx) {
+            NatSession& sess = sh.sessions[idx];
+            if (!sess.active.load(std::memory_order_relaxed)) return;
+            const uint32_t last = sess.last_active_tick.load(std::memory_order_relaxed);
+            if (tick - last <= SESSION_TIMEOUT) {   // refreshed since armed
+                sh.timers.arm(idx, last + SESSION_TIMEOUT + 1);
+                return;
+            }
+            seq_write_begin(sess.seq);
+            sess.active.store(false, std::memory_order_release);
+            release_port(sh, sess);
+            seq_write_end(sess.seq);
+        });
+        for (auto& pool : sh.pools) pool.reclaim_parked();
+    }
+}
+
+// Lookup only. The probe stops where claim_session() would take a slot, so both
+// agree on where a flow lives.
+uint16_t NatEngine::find_session(Shard& sh, const FlowKey& key, uint8_t protocol,
+                                 uint32_t home, uint32_t tick) noexcept {
+    for (size_t i = 0; i < 32; ++i) {
+        NatSession& sess = sh.sessions[(home + i) & (SHARD_SESSIONS - 1)];
+        if (!sess.active.load(std::memory_order_acquire)
+            || tick - sess.last_active_tick.load(std::memory_order_relaxed) > SESSION_TIMEOUT)
+            break;
+        if (sess.internal_key == key && sess.protocol == protocol) {
+            sess.last_active_tick.store(tick, std::memory_order_relaxed);
+            return sess.external_port;
+        }
+    }
+    return 0;
+}
+
+// The shards a worker may have put the flow in: the port-preserving one, then the
+// hashed one.
+uint16_t NatEngine::find_for_worker(size_t worker, const FlowKey& key, uint8_t protocol,
+                                    uint32_t h, uint32_t tick) noexcept {
+    const uint32_t home = h & (SHARD_SESSIONS - 1);
+    const size_t   pres = preserving_shard(worker, key.sport);
+    const size_t   own  = owned_shard(worker, h);
+    if (pres != MAX_SHARDS)
+        if (uint16_t ext = find_session(shards[pres], key, protocol, home, tick)) return ext;
+    if (pres == own) return 0;
+    return find_session(shards[own], key, protocol, home, tick);
+}
+
+// Lookup in a shard another worker owns: read under the session seqlock, as
+// resolve_inbound() does, and never written (its owner may be reusing or expiring
+// the same slots). The session is not refreshed; replies keep it alive.
+uint16_t NatEngine::peek_session(const Shard& sh, const FlowKey& key, uint8_t protocol,
+                                 uint32_t home, uint32_t tick) const noexcept {
+    for (size_t i = 0; i < 32; ++i) {
+        const NatSession& sess = sh.sessions[(home + i) & (SHARD_SESSIONS - 1)];
+        for (int attempt = 0; attempt < 8; ++attempt) {
+            uint32_t s0 = sess.seq.load(std::memory_order_acquire);
+            if (s0 & 1u) continue;
+            bool     act  = sess.active.load(std::memory_order_acquire);
+            FlowKey  ik   = sess.internal_key;
+            uint16_t ep   = sess.external_port;
+            uint8_t  pr   = sess.protocol;
+            uint32_t last = sess.last_active_tick.load(std::memory_order_relaxed);
+            uint32_t s1 = sess.seq.load(std::memory_order_acquire);
+            if (s0 != s1 || (s1 & 1u)) continue;
+            // Where the owner's own probe stops.
+            if (!act || tick - last > SESSION_TIMEOUT) return 0;
+            if (ik == key && pr == protocol) return ep;
+            break;
+        }
+        // A slot still being rewritten holds another flow now: look past it.
+    }
+    return 0;
+}
+
+// The shards every other upstream worker may have put the flow in, read only.
+uint16_t NatEngine::find_elsewhere(size_t worker, const FlowKey& key, uint8_t protocol,
+                                   uint32_t h, uint32_t tick) const noexcept {
+    const uint32_t home = h & (SHARD_SESSIONS - 1);
+    for (size_t w = 0; w < upstream_workers; ++w) {
+        if (w == worker) continue;
+        const size_t pres = preserving_shard(w, key.sport);
+        const size_t own  = owned_shard(w, h);
+        if (pres != MAX_SHARDS)
+            if (uint16_t ext = peek_session(shards[pres], key, protocol, home, tick)) return ext;
+        if (pres == own) continue;
+        if (uint16_t ext = peek_session(shards[own], key, protocol, home, tick)) return ext;
+    }
+    return 0;
+}
+
+// Owner only: take the first free or idle slot of the probe for `key`, mapped to
+// external port offset `want_off` if that is free (>= 0), else to any free port.
+uint16_t NatEngine::claim_session(Shard& sh, const FlowKey& key, uint8_t protocol,
+                                  uint32_t home, uint32_t tick, int32_t want_off) noexcept {
+    const size_t p    = pool_of(protocol);
+    PortPool&    pool = sh.pools[p];
+    for (size_t i = 0; i < 32; ++i) {
+        const uint32_t idx = (home + i) & (SHARD_SESSIONS - 1);
+        NatSession& sess = sh.sessions[idx];
+        const bool is_active = sess.active.load(std::memory_order_relaxed);
+        if (is_active
+            && tick - sess.last_active_tick.load(std::memory_order_relaxed) <= SESSION_TIMEOUT)
+            continue;
+
+        seq_write_begin(sess.seq);
+        if (is_active) {   // idle, not yet collected
+            sess.active.store(false, std::memory_order_release);
+            release_port(sh, sess);
+        }
+        // Publish the port, then check it is not reserved for a port mapping (pairs
+        // with reserve_mapped_port()); a reserved one stays out of the pool, parked.
+        int32_t off;
+        while (true) {
+            off = want_off >= 0
+                ? (pool.take(static_cast<uint32_t>(want_off)) ? want_off : -1)
+                : pool.take_next();
+            if (off < 0) break;
+            auto& slot = sh.port_to_slot[p][static_cast<size_t>(off)];
+            slot.store(static_cast<int32_t>(idx), std::memory_order_seq_cst);
+            if (!pool.is_reserved(static_cast<uint32_t>(off))) break;
+            slot.store(-1, std::memory_order_relaxed);
+            pool.park(static_cast<uint32_t>(off));
+            if (want_off >= 0) { off = -1; break; }
+        }
+        if (off < 0) {
+            seq_write_end(sess.seq);
+            if (want_off < 0)
+                Telemetry::instance().nat_port_exhausted.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        const uint16_t ext_nbo = htons(static_cast<uint16_t>(sh.port_base + off));
+        sess.internal_key  = key;
+        sess.external_port = ext_nbo;
+        sess.protocol      = protocol;
+        sess.last_active_tick.store(tick, std::memory_order_relaxed);
+        seq_write_end(sess.seq);
+        sess.active.store(true, std::memory_order_release);
+        sh.timers.arm(idx, tick + SESSION_TIMEOUT + 1);
+        return ext_nbo;
+    }
+    return 0;
+}
+
+bool NatEngine::process_outbound(Net::ParsedPacket& pkt, size_t worker) {
     if (!pkt.is_valid_ipv4()) return false;
     const Net::IPv4Net wan_ip{wan_ip_nbo.load(std::memory_order_acquire)};
     if (wan_ip.raw() == 0) return false;
@@ -235,62 +644,51 @@ bool NatEngine::process_outbound(Net::ParsedPacket& pkt) {
         sport_ptr = &tcp->source; dport = tcp->dest; check_ptr = &tcp->check;
     }
 
-    if (upnp_cursor.load(std::memory_order_relaxed) > 0) for (auto& rule : upnp_rules) {
-        if (!rule.active.load(std::memory_order_acquire)) continue;
-        uint32_t s0 = rule.seq.load(std::memory_order_acquire);
-        if (s0 & 1u) continue;
-        Net::IPv4Net r_int_ip   = rule.internal_ip;
-        uint16_t     r_int_port = rule.internal_port;
-        uint16_t     r_ext_port = rule.external_port;
-        uint8_t      r_prot     = rule.protocol;
-        uint32_t s1 = rule.seq.load(std::memory_order_acquire);
-        if (s0 != s1 || (s1 & 1u)) continue;
-        if (r_prot == ip->protocol && r_int_ip == ip->saddr && r_int_port == *sport_ptr) {
-            update_checksum_32(ip->check, ip->saddr, wan_ip);
-            if (check_ptr && *check_ptr != 0)
-                update_checksum_32(*check_ptr, ip->saddr, wan_ip);
-            ip->saddr  = wan_ip;
-            *sport_ptr = r_ext_port;
-            return true;
+    if (UpnpMapping r; upnp_count.load(std::memory_order_relaxed) > 0 && upnp_outbound(pkt, *sport_ptr, r)) {
+        update_checksum_32(ip->check, ip->saddr, wan_ip);
+        if (check_ptr && *check_ptr != 0) {
+            update_checksum_32(*check_ptr, ip->saddr, wan_ip);
+            update_checksum_16(*check_ptr, *sport_ptr, r.external_port);
         }
+        ip->saddr  = wan_ip;
+        *sport_ptr = r.external_port;
+        pkt.rehash();
+        return true;
     }
 
-    FlowKey key{ip->saddr, ip->daddr, *sport_ptr, dport};
-    uint32_t h    = hash_flow(key) % MAX_SESSIONS;
-    uint32_t tick = current_tick.load(std::memory_order_relaxed);
-    uint16_t ext_port = 0;
-
-    for (size_t i = 0; i < 32; ++i) {
-        size_t idx   = (h + i) % MAX_SESSIONS;
-        bool is_active = sessions[idx].active.load(std::memory_order_acquire);
-        if (!is_active || (tick - sessions[idx].last_active_tick.load(std::memory_order_relaxed) > 300)) {
-            NatSession& sess = sessions[idx];
-            sess.seq.fetch_add(1, std::memory_order_acq_rel);
-            if (is_active) {
-                const uint16_t old_host = ntohs(sess.external_port);
-                int32_t expect_idx = static_cast<int32_t>(idx);
-                (void)port_to_index[old_host].compare_exchange_strong(
-                    expect_idx, -1, std::memory_order_release, std::memory_order_relaxed);
-            }
-            sess.internal_key = key;
-            const uint16_t ext_nbo = htons(port_cursor++);
-            if (port_cursor > 60000) port_cursor = 10000;
-            sess.external_port = ext_nbo;
-            sess.last_active_tick.store(tick, std::memory_order_relaxed);
-            sess.seq.fetch_add(1, std::memory_order_acq_rel);
-            sess.active.store(true, std::memory_order_release);
-            ext_port = ext_nbo;
-            port_to_index[ntohs(ext_port)].store(static_cast<int32_t>(idx),
-                                                 std::memory_order_release);
-            break;
-        }
-        if (sessions[idx].internal_key == key) {
-            sessions[idx].last_active_tick.store(tick, std::memory_order_relaxed);
-            ext_port = sessions[idx].external_port;
-            break;
+    // A full-cone mapping drops the remote half of the key and hashes on the LAN
+    // endpoint alone, so every destination finds the same session.
+    const uint8_t  proto = ip->protocol;
+    const bool     cone  = proto == 17 && is_cone_flow(ip->saddr, *sport_ptr, dport);
+    const FlowKey  key   = cone ? FlowKey{ip->saddr, Net::IPv4Net{}, *sport_ptr, 0}
+                                : FlowKey{ip->saddr, ip->daddr, *sport_ptr, dport};
+    const uint32_t h     = cone ? pkt.src_hash() : pkt.tuple_hash();
+    const uint32_t home  = h & (SHARD_SESSIONS - 1);
+    const uint32_t tick  = current_tick.load(std::memory_order_relaxed);
+
+    uint16_t ext_port = find_for_worker(worker, key, proto, h, tick);
+    // cpu fanout or rollover can move a flow between upstream workers, and hash
+    // fanout spreads a full-cone endpoint's flows over them: look where each other
+    // worker would have put it before mapping it a second time.
+    if (!ext_port && upstream_workers > 1) ext_port = find_elsewhere(worker, key, proto, h, tick);
+
+    // New flow: keep the LAN source port when this worker can, else any free port
+    // from the hashed shard. A full-cone endpoint is mapped by one worker at a time:
+    // two that missed it together would otherwise give it two external ports.
+    if (!ext_port) {
+        const bool serialise = cone && upstream_workers > 1;
+        if (serialise) {
+            lock_create();
+            ext_port = find_elsewhere(worker, key, proto, h, tick);
         }
+        const size_t pres = preserving_shard(worker, *sport_ptr);
+        if (!ext_port && pres != MAX_SHARDS)
+            ext_port = claim_session(shards[pres], key, proto, home, tick,
+                                     static_cast<int32_t>(ntohs(*sport_ptr) - shards[pres].port_base));
+        if (!ext_port)
+            ext_port = claim_session(shards[owned_shard(worker, h)], key, proto, home, tick, -1);
+        if (serialise) unlock_create();
     }
-
     if (!ext_port) return false;
 
     update_checksum_32(ip->check, ip->saddr, wan_ip);
@@ -301,9 +699,106 @@ bool NatEngine::process_outbound(Net::ParsedPacket& pkt) {
 
     ip->saddr  = wan_ip;
     *sport_ptr = ext_port;
+    pkt.rehash();
     return true;
 }
 
+void NatEngine::prefetch_outbound(const Net::ParsedPacket& pkt, size_t worker) const noexcept {
+    if (!pkt.is_valid_ipv4() || (!pkt.udp() && !pkt.tcp())) return;
+    // The bucket process_outbound() probes: full-cone flows live at the source hash.
+    const auto*    udp = pkt.udp();
+    const uint32_t h   = udp && is_cone_flow(pkt.ipv4->saddr, udp->source, udp->dest)
+                       ? pkt.src_hash() : pkt.tuple_hash();
+    Net::prefetch_read(&shards[owned_shard(worker, h)].sessions[h & (SHARD_SESSIONS - 1)]);
+}
+
+void NatEngine::prefetch_inbound(const Net::ParsedPacket& pkt) const noexcept {
+    if (!pkt.is_valid_ipv4()) return;
+    uint16_t dport;
+    if (auto udp = pkt.udp())      dport = udp->dest;
+    else if (auto tcp = pkt.tcp()) dport = tcp->dest;
+    else return;
+    const uint32_t off = static_cast<uint32_t>(ntohs(dport)) - PORT_FIRST;
+    if (off >= PORTS_PER_SHARD * MAX_SHARDS) return;
+    Net::prefetch_read(&shards[off / PORTS_PER_SHARD]
+                            .port_to_slot[pool_of(pkt.ipv4->protocol)][off % PORTS_PER_SHARD]);
+}
+
+bool NatEngine::accepts_any_remote(const Net::ParsedPacket& pkt) const noexcept {
+    if (!pkt.is_valid_ipv4() || pkt.ipv4->protocol != 17) return false;
+    if (pkt.ipv4->daddr.raw() != wan_ip_nbo.load(std::memory_order_acquire)) return false;
+    auto udp = pkt.udp();
+    if (!udp) return false;
+    const uint32_t off = static_cast<uint32_t>(ntohs(udp->dest)) - PORT_FIRST;
+    if (off >= PORTS_PER_SHARD * MAX_SHARDS) return false;
+    const Shard&  sh  = shards[off / PORTS_PER_SHARD];
+    const int32_t idx = sh.port_to_slot[pool_of(17)][off % PORTS_PER_SHARD].load(
+        std::memory_order_acquire);
+    if (idx < 0 || static_cast<size_t>(idx) >= SHARD_SESSIONS) return false;
+
+    const NatSession& sess = sh.sessions[static_cast<size_t>(idx)];
+    const uint32_t    tick = current_tick.load(std::memory_order_relaxed);
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        uint32_t s0 = sess.seq.load(std::memory_order_acquire);
+        if (s0 & 1u) continue;
+        bool     act    = sess.active.load(std::memory_order_acquire);
+        uint32_t remote = sess.internal_key.daddr.raw();
+        uint16_t ep     = sess.external_port;
+        uint32_t last   = sess.last_active_tick.load(std::memory_order_relaxed);
+        uint32_t s1 = sess.seq.load(std::memory_order_acquire);
+        if (s0 != s1 || (s1 & 1u)) continue;
+        return act && remote == 0 && ep == udp->dest
+            && static_cast<int32_t>(tick - last) <= static_cast<int32_t>(SESSION_TIMEOUT);
+    }
+    return false;
+}
+
+// DNAT target for a packet from (rsaddr, rsport) to external port dport: a UPnP
+// forward, else the live session on that port if the remote passes its filter (a
+// zero rsaddr only passes full-cone sessions). Refreshes the session it uses.
+bool NatEngine::resolve_inbound(uint8_t protocol, uint16_t dport_nbo, Net::IPv4Net rsaddr,
+                                uint16_t rsport_nbo, Net::IPv4Net& int_ip, uint16_t& int_port_nbo) noexcept {
+    if (UpnpMapping r; upnp_count.load(std::memory_order_relaxed) > 0
+                       && upnp_inbound(protocol, dport_nbo, r)) {
+        int_ip       = r.internal_ip;
+        int_port_nbo = r.internal_port;
+        return true;
+    }
+
+    // Route by port range to the owning shard.
+    const uint32_t off = static_cast<uint32_t>(ntohs(dport_nbo)) - PORT_FIRST;
+    if (off >= PORTS_PER_SHARD * MAX_SHARDS) return false;
+    Shard& sh = shards[off / PORTS_PER_SHARD];
+    const int32_t idx = sh.port_to_slot[pool_of(protocol)][off % PORTS_PER_SHARD].load(
+        std::memory_order_acquire);
+    if (idx < 0 || static_cast<size_t>(idx) >= SHARD_SESSIONS) return false;
+
+    const uint32_t tick = current_tick.load(std::memory_order_relaxed);
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        NatSession& sess = sh.sessions[static_cast<size_t>(idx)];
+        uint32_t s0 = sess.seq.load(std::memory_order_acquire);
+        if (s0 & 1u) continue;
+        bool act = sess.active.load(std::memory_order_acquire);
+        FlowKey ik = sess.internal_key;
+        uint16_t ep = sess.external_port;
+        uint8_t  pr = sess.protocol;
+        uint32_t last = sess.last_active_tick.load(std::memory_order_relaxed);
+        uint32_t s1 = sess.seq.load(std::memory_order_acquire);
+        if (s0 != s1 || (s1 & 1u)) continue;
+        if (!act) return false;
+        // Idle past the timeout: dead even if its owner has not collected it yet.
+        if (static_cast<int32_t>(tick - last) > static_cast<int32_t>(SESSION_TIMEOUT)) return false;
+        if (ep != dport_nbo || pr != protocol) return false;
+        // Endpoint-dependent filtering unless the mapping is full cone.
+        if (ik.daddr.raw() != 0 && (ik.daddr != rsaddr || ik.dport != rsport_nbo)) return false;
+        int_ip       = ik.saddr;
+        int_port_nbo = ik.sport;
+        sess.last_active_tick.store(tick, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
 bool NatEngine::process_inbound(Net::ParsedPacket& pkt) {
     if (!pkt.is_valid_ipv4()) return false;
     auto ip = pkt.ipv4;
@@ -327,52 +822,10 @@ bool NatEngine::process_inbound(Net::ParsedPacket& pkt) {
         dport_ptr = &tcp->dest; sport = tcp->source; check_ptr = &tcp->check;
     }
 
-    if (upnp_cursor.load(std::memory_order_relaxed) > 0) for (auto& rule : upnp_rules) {
-        if (!rule.active.load(std::memory_order_acquire)) continue;
-        uint32_t s0 = rule.seq.load(std::memory_order_acquire);
-        if (s0 & 1u) continue;
-        Net::IPv4Net r_int_ip   = rule.internal_ip;
-        uint16_t     r_int_port = rule.internal_port;
-        uint16_t     r_ext_port = rule.external_port;
-        uint8_t      r_prot     = rule.protocol;
-        uint32_t s1 = rule.seq.load(std::memory_order_acquire);
-        if (s0 != s1 || (s1 & 1u)) continue;
-        if (r_prot == ip->protocol && r_ext_port == *dport_ptr) {
-            update_checksum_32(ip->check, ip->daddr, r_int_ip);
-            if (check_ptr && *check_ptr != 0)
-                update_checksum_32(*check_ptr, ip->daddr, r_int_ip);
-            ip->daddr  = r_int_ip;
-            *dport_ptr = r_int_port;
-            return true;
-        }
-    }
-
-    const uint16_t dport_host = ntohs(*dport_ptr);
-    int32_t idx = port_to_index[dport_host].load(std::memory_order_acquire);
-    if (idx < 0 || static_cast<size_t>(idx) >= MAX_SESSIONS) return false;
-
-    bool         resolved = false;
     Net::IPv4Net internal_ip{};
     uint16_t     internal_port = 0;
-    for (int attempt = 0; attempt < 8; ++attempt) {
-        NatSession& sess = sessions[static_cast<size_t>(idx)];
-        uint32_t s0 = sess.seq.load(std::memory_order_acquire);
-        if (s0 & 1u) continue;
-        bool act = sess.active.load(std::memory_order_acquire);
-        FlowKey ik = sess.internal_key;
-        uint16_t ep = sess.external_port;
-        uint32_t s1 = sess.seq.load(std::memory_order_acquire);
-        if (s0 != s1 || (s1 & 1u)) continue;
-        if (!act) return false;
-        if (ik.daddr != ip->saddr || ik.dport != sport || ep != *dport_ptr) return false;
-        internal_ip   = ik.saddr;
-        internal_port = ik.sport;
-        sess.last_active_tick.store(
-            current_tick.load(std::memory_order_relaxed), std::memory_order_relaxed);
-        resolved = true;
-        break;
-    }
-    if (!resolved) return false;
+    if (!resolve_inbound(ip->protocol, *dport_ptr, ip->saddr, sport, internal_ip, internal_port))
+        return false;
 
     update_checksum_32(ip->check, ip->daddr, internal_ip);
     if (check_ptr && *check_ptr != 0) {
@@ -382,6 +835,134 @@ bool NatEngine::process_inbound(Net::ParsedPacket& pkt) {
 
     ip->daddr  = internal_ip;
     *dport_ptr = internal_port;
+    pkt.rehash();
+    return true;
+}
+
+// ── Hairpin (NAT loopback) ───────────────────────────────────────────────────
+
+uint32_t NatEngine::hash_hairpin_flow(Net::IPv4Net client, uint16_t client_port_nbo,
+                                      uint16_t ext_port_nbo, uint8_t protocol) const {
+    return Net::hash_u32(Net::endpoint_hash(client.raw(), client_port_nbo, protocol), ext_port_nbo);
+}
+
+bool NatEngine::process_hairpin(Net::ParsedPacket& pkt, Net::IPv4Net router_ip) {
+    if (!pkt.is_valid_ipv4()) return false;
+    auto ip = pkt.ipv4;
+    if (ip->protocol != 6 && ip->protocol != 17) return false;
+    const Net::IPv4Net wan_ip{wan_ip_nbo.load(std::memory_order_acquire)};
+    if (wan_ip.raw() == 0 || router_ip.raw() == 0) return false;
+    if (ip->daddr != wan_ip && ip->daddr != router_ip) return false;
+
+    uint16_t* sport_ptr = nullptr;
+    uint16_t* dport_ptr = nullptr;
+    uint16_t* check_ptr = nullptr;
+    if (ip->protocol == 17) {
+        auto udp = pkt.udp();
+        if (!udp) return false;
+        sport_ptr = &udp->source; dport_ptr = &udp->dest; check_ptr = &udp->check;
+    } else {
+        auto tcp = pkt.tcp();
+        if (!tcp) return false;
+        sport_ptr = &tcp->source; dport_ptr = &tcp->dest; check_ptr = &tcp->check;
+    }
+
+    const uint8_t  proto = ip->protocol;
+    const uint32_t tick  = current_tick.load(std::memory_order_relaxed);
+    Net::IPv4Net new_saddr{}, new_daddr{};
+    uint16_t     new_sport = 0, new_dport = 0;
+
+    if (ip->daddr == router_ip) {
+        // Server → router: the router-side port names the session.
+        const uint32_t idx = static_cast<uint32_t>(ntohs(*dport_ptr)) - HAIRPIN_PORT_FIRST;
+        if (idx >= MAX_HAIRPIN_SESSIONS) return false;
+        HairpinSession& sess = hairpin_sessions[idx];
+        bool resolved = false;
+        for (int attempt = 0; attempt < 8; ++attempt) {
+            uint32_t s0 = sess.seq.load(std::memory_order_acquire);
+            if (s0 & 1u) continue;
+            const bool         act  = sess.active.load(std::memory_order_acquire);
+            const Net::IPv4Net cip  = sess.client_ip;
+            const Net::IPv4Net sip  = sess.server_ip;
+            const uint16_t     cp   = sess.client_port;
+            const uint16_t     sp   = sess.server_port;
+            const uint16_t     ep   = sess.ext_port;
+            const uint8_t      pr   = sess.protocol;
+            const uint32_t     last = sess.last_active_tick.load(std::memory_order_relaxed);
+            uint32_t s1 = sess.seq.load(std::memory_order_acquire);
+            if (s0 != s1 || (s1 & 1u)) continue;
+            if (!act || pr != proto || sip != ip->saddr || sp != *sport_ptr) return false;
+            if (static_cast<int32_t>(tick - last) > static_cast<int32_t>(SESSION_TIMEOUT)) return false;
+            new_saddr = wan_ip;  new_sport = ep;
+            new_daddr = cip;     new_dport = cp;
+            resolved  = true;
+            break;
+        }
+        if (!resolved) return false;
+        sess.last_active_tick.store(tick, std::memory_order_relaxed);
+    } else {
+        // Client → WAN address: DNAT as if it came from outside, from a remote that
+        // only full-cone sessions accept (the client is not anyone's remote).
+        Net::IPv4Net server_ip{};
+        uint16_t     server_port = 0;
+        if (!resolve_inbound(proto, *dport_ptr, Net::IPv4Net{}, 0, server_ip, server_port))
+            return false;
+
+        const uint32_t h = hash_hairpin_flow(ip->saddr, *sport_ptr, *dport_ptr, proto) % MAX_HAIRPIN_SESSIONS;
+        size_t found = MAX_HAIRPIN_SESSIONS;
+        // LAN-local traffic is light: the whole probe runs under the creation lock.
+        lock_create();
+        for (size_t n = 0; n < 32; ++n) {
+            const size_t    idx  = (h + n) % MAX_HAIRPIN_SESSIONS;
+            HairpinSession& sess = hairpin_sessions[idx];
+            const bool is_active = sess.active.load(std::memory_order_relaxed);
+            const bool expired   =
+                is_active && static_cast<int32_t>(tick - sess.last_active_tick.load(std::memory_order_relaxed))
+                                 > static_cast<int32_t>(SESSION_TIMEOUT);
+            const bool same =
+                is_active && sess.client_ip == ip->saddr && sess.client_port == *sport_ptr
+                && sess.ext_port == *dport_ptr && sess.protocol == proto;
+            if (same && sess.server_ip == server_ip && sess.server_port == server_port) {
+                sess.last_active_tick.store(tick, std::memory_order_relaxed);
+                found = idx;
+                break;
+            }
+            // Free, dead, or this flow with a forward that now points elsewhere.
+            if (!is_active || expired || same) {
+                sess.seq.fetch_add(1, std::memory_order_acq_rel);
+                sess.client_ip   = ip->saddr;
+                sess.client_port = *sport_ptr;
+                sess.server_ip   = server_ip;
+                sess.server_port = server_port;
+                sess.ext_port    = *dport_ptr;
+                sess.protocol    = proto;
+                sess.last_active_tick.store(tick, std::memory_order_relaxed);
+                sess.active.store(true, std::memory_order_relaxed);
+                sess.seq.fetch_add(1, std::memory_order_acq_rel);
+                found = idx;
+                break;
+            }
+        }
+        unlock_create();
+        if (found == MAX_HAIRPIN_SESSIONS) return false;
+
+        new_saddr = router_ip;  new_sport = htons(static_cast<uint16_t>(HAIRPIN_PORT_FIRST + found));
+        new_daddr = server_ip;  new_dport = server_port;
+    }
+
+    update_checksum_32(ip->check, ip->saddr, new_saddr);
+    update_checksum_32(ip->check, ip->daddr, new_daddr);
+    if (check_ptr && *check_ptr != 0) {
+        update_checksum_32(*check_ptr, ip->saddr, new_saddr);
+        update_checksum_32(*check_ptr, ip->daddr, new_daddr);
+        update_checksum_16(*check_ptr, *sport_ptr, new_sport);
+        update_checksum_16(*check_ptr, *dport_ptr, new_dport);
+    }
+    ip->saddr  = new_saddr;
+    ip->daddr  = new_daddr;
+    *sport_ptr = new_sport;
+    *dport_ptr = new_dport;
+    pkt.rehash();
     return true;
 }
 
@@ -13,9 +13,14 @@
 #include <poll.h>
 #include <linux/if_packet.h>
 
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69   // Linux 5.11+; older libc headers lack it
+#endif
+
 namespace HPGTP::Engine {
 
-RawSocketManager::RawSocketManager(std::string_view iface_name) {
+RawSocketManager::RawSocketManager(std::string_view iface_name, RxRingOptions ring_opts)
+    : opts(ring_opts) {
     iface_name.copy(iface.data(), IFACE_NAME_MAX - 1);
 }
 
@@ -46,19 +51,23 @@ std::expected<void, std::string> RawSocketManager::init() {
         return std::unexpected("Failed to set IFF_PROMISC. Check permissions.");
     std::println("[Engine] Interface {} set to promiscuous mode", iface.data());
 
-    tpacket_req req{
-        .tp_block_size = BLOCK_SIZE,
-        .tp_block_nr   = BLOCK_NR,
-        .tp_frame_size = FRAME_SIZE,
-        .tp_frame_nr   = FRAME_NR
-    };
-    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
-        return std::unexpected("Setsockopt RX_RING failed");
+    if (opts.version == RxRingVersion::V3) {
+        if (auto r = setup_ring_v3(); !r) {
+            std::println(stderr, "[Engine] {}: TPACKET_V3 unavailable ({}) — falling back to V1",
+                iface.data(), r.error());
+            opts.version = RxRingVersion::V1;
+        }
+    }
+    if (opts.version == RxRingVersion::V1) {
+        if (auto r = setup_ring_v1(); !r) return r;
+    }
 
-    ring_size = static_cast<size_t>(req.tp_block_size) * req.tp_block_nr;
     ring = static_cast<uint8_t*>(mmap(nullptr, ring_size,
                                        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
     if (ring == MAP_FAILED) return std::unexpected("mmap failed");
+    slot_refs = std::make_unique<std::atomic<uint32_t>[]>(slot_nr);
+    std::println("[Engine] {} RX ring: TPACKET_V{} ({} x {} B)", iface.data(),
+        static_cast<int>(opts.version), slot_nr, slot_size);
 
     sockaddr_ll sll{};
     sll.sll_family   = AF_PACKET;
@@ -67,6 +76,89 @@ std::expected<void, std::string> RawSocketManager::init() {
     if (bind(fd, reinterpret_cast<sockaddr*>(&sll), sizeof(sll)) < 0)
         return std::unexpected("Bind failed");
 
+    if (opts.fanout) {
+        if (auto r = join_fanout(ifr.ifr_ifindex); !r) return r;
+    }
+    if (opts.busy_poll_us) enable_busy_poll();
+
+    return {};
+}
+
+// Non-fatal: without it poll() simply waits for the interrupt path as before.
+void RawSocketManager::enable_busy_poll() {
+    const int us = static_cast<int>(opts.busy_poll_us);
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0) {
+        std::println(stderr, "[Engine] {}: SO_BUSY_POLL unavailable ({})", iface.data(), strerror(errno));
+        return;
+    }
+    const int prefer = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) < 0)
+        std::println(stderr, "[Engine] {}: SO_PREFER_BUSY_POLL unavailable ({})", iface.data(), strerror(errno));
+}
+
+// Fanout must be joined after bind(). Group ids are per network namespace, so mix
+// the pid in to keep two instances on one host from landing in each other's group.
+std::expected<void, std::string> RawSocketManager::join_fanout(int ifindex) {
+    const uint16_t group = static_cast<uint16_t>(
+        (static_cast<uint32_t>(::getpid()) << 4) ^ static_cast<uint32_t>(ifindex));
+    uint16_t type = opts.fanout_mode == RxFanoutMode::Cpu ? PACKET_FANOUT_CPU
+                                                          : PACKET_FANOUT_HASH;
+    if (opts.fanout_rollover) type |= PACKET_FANOUT_FLAG_ROLLOVER;
+    const int arg = static_cast<int>(group) | (static_cast<int>(type) << 16);
+    if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0)
+        return std::unexpected(std::string("PACKET_FANOUT failed: ") + strerror(errno));
+    std::println("[Engine] {} RX fanout group {:#06x} ({}{})", iface.data(), group,
+        opts.fanout_mode == RxFanoutMode::Cpu ? "cpu" : "hash",
+        opts.fanout_rollover ? "+rollover" : "");
+    return {};
+}
+
+std::expected<void, std::string> RawSocketManager::setup_ring_v1() {
+    int ver = TPACKET_V1;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0)
+        return std::unexpected("Setsockopt PACKET_VERSION (V1) failed");
+
+    tpacket_req req{
+        .tp_block_size = BLOCK_SIZE,
+        .tp_block_nr   = BLOCK_NR,
+        .tp_frame_size = FRAME_SIZE,
+        .tp_frame_nr   = FRAME_NR
+    };
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+        return std::unexpected("Setsockopt RX_RING failed");
+
+    ring_size = static_cast<size_t>(req.tp_block_size) * req.tp_block_nr;
+    slot_size = FRAME_SIZE;
+    slot_nr   = FRAME_NR;
+    return {};
+}
+
+std::expected<void, std::string> RawSocketManager::setup_ring_v3() {
+    int ver = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0)
+        return std::unexpected(std::string("PACKET_VERSION: ") + strerror(errno));
+
+    // tp_frame_size only bounds the largest frame in a V3 block; frames are
+    // packed back to back at tp_next_offset, not at fixed strides.
+    tpacket_req3 req{};
+    req.tp_block_size      = V3_BLOCK_SIZE;
+    req.tp_block_nr        = V3_BLOCK_NR;
+    req.tp_frame_size      = FRAME_SIZE;
+    req.tp_frame_nr        = (V3_BLOCK_SIZE / FRAME_SIZE) * V3_BLOCK_NR;
+    req.tp_retire_blk_tov  = opts.block_timeout_ms ? opts.block_timeout_ms : 1;
+    req.tp_sizeof_priv     = 0;
+    req.tp_feature_req_word = 0;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        const int e = errno;
+        // Version can still be changed: no ring is attached yet.
+        int v1 = TPACKET_V1;
+        setsockopt(fd, SOL_PACKET, PACKET_VERSION, &v1, sizeof(v1));
+        return std::unexpected(std::string("RX_RING: ") + strerror(e));
+    }
+
+    ring_size = static_cast<size_t>(req.tp_block_size) * req.tp_block_nr;
+    slot_size = V3_BLOCK_SIZE;
+    slot_nr   = V3_BLOCK_NR;
     return {};
 }
 
@@ -94,9 +186,12 @@ void RawSocketManager::do_poll(int timeout_ms) {
 }
 
 bool RawSocketManager::peek_frame(std::span<uint8_t>& out) {
+    if (opts.version == RxRingVersion::V3) return peek_frame_v3(out);
     while (true) {
+        // A frame still lent to the consumer stays TP_STATUS_USER: not a new one.
+        if (slot_refs[rx_idx].load(std::memory_order_acquire) != 0) return false;
         auto* hdr = reinterpret_cast<tpacket_hdr*>(ring + (rx_idx * FRAME_SIZE));
-        if (!(hdr->tp_status & TP_STATUS_USER)) return false;
+        if (!(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) return false;
 
         auto* sll = reinterpret_cast<sockaddr_ll*>(
             reinterpret_cast<uint8_t*>(hdr) + TPACKET_ALIGN(sizeof(tpacket_hdr)));
@@ -114,9 +209,106 @@ bool RawSocketManager::peek_frame(std::span<uint8_t>& out) {
 }
 
 void RawSocketManager::advance_frame() {
+    if (opts.version == RxRingVersion::V3) { advance_frame_v3(); return; }
     auto* hdr = reinterpret_cast<tpacket_hdr*>(ring + (rx_idx * FRAME_SIZE));
     hdr->tp_status = TP_STATUS_KERNEL;
     rx_idx = (rx_idx + 1) % FRAME_NR;
 }
 
+bool RawSocketManager::acquire_rx_frame(RxFrameRef& out) {
+    std::span<uint8_t> pkt;
+    if (!peek_frame(pkt)) return false;
+    out.data = pkt.data();
+    out.len  = static_cast<uint16_t>(pkt.size() < 0xFFFF ? pkt.size() : 0xFFFF);
+    out.slot = rx_idx;
+    if (opts.version == RxRingVersion::V3) {
+        slot_refs[rx_idx].fetch_add(1, std::memory_order_relaxed);
+        advance_frame_v3();
+    } else {
+        slot_refs[rx_idx].store(1, std::memory_order_relaxed);
+        rx_idx = (rx_idx + 1) % FRAME_NR;
+    }
+    return true;
+}
+
+bool RawSocketManager::rx_waiting_on_release() const {
+    if (blk_pkt) return false;   // V3: frames left in the block being walked
+    // The cursor wrapped onto a slot the consumer still holds.
+    if (slot_refs[rx_idx].load(std::memory_order_acquire) != 0) return true;
+    // Nothing new at the cursor, and the slot behind it is lent: packet_poll() keeps
+    // reporting POLLIN for it.
+    if (slot_filled(rx_idx)) return false;
+    const uint32_t prev = (rx_idx + slot_nr - 1) % slot_nr;
+    return slot_refs[prev].load(std::memory_order_acquire) != 0;
+}
+
+bool RawSocketManager::slot_filled(uint32_t slot) const {
+    const uint8_t* base = ring + static_cast<size_t>(slot) * slot_size;
+    const uint32_t status = opts.version == RxRingVersion::V3
+        ? __atomic_load_n(&reinterpret_cast<const tpacket_block_desc*>(base)->hdr.bh1.block_status,
+                          __ATOMIC_ACQUIRE)
+        : static_cast<uint32_t>(__atomic_load_n(&reinterpret_cast<const tpacket_hdr*>(base)->tp_status,
+                                                __ATOMIC_ACQUIRE));
+    return (status & TP_STATUS_USER) != 0;
+}
+
+void RawSocketManager::return_slot(uint32_t slot) {
+    uint8_t* base = ring + static_cast<size_t>(slot) * slot_size;
+    if (opts.version == RxRingVersion::V3)
+        __atomic_store_n(&reinterpret_cast<tpacket_block_desc*>(base)->hdr.bh1.block_status,
+                         TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    else
+        __atomic_store_n(&reinterpret_cast<tpacket_hdr*>(base)->tp_status,
+                         TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+}
+
+// V3: the block at rx_idx is owned by user space from the moment block_status
+// shows TP_STATUS_USER until its last frame is consumed and every acquired frame
+// has been released; one status store then hands back the whole block. A block
+// the consumer still holds keeps TP_STATUS_USER, so it is only entered once its
+// count is back to zero.
+bool RawSocketManager::peek_frame_v3(std::span<uint8_t>& out) {
+    while (true) {
+        if (!blk_pkt) {
+            if (slot_refs[rx_idx].load(std::memory_order_acquire) != 0) return false;
+            auto* bd = reinterpret_cast<tpacket_block_desc*>(
+                ring + static_cast<size_t>(rx_idx) * V3_BLOCK_SIZE);
+            if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+                return false;
+            blk_pkts_left = bd->hdr.bh1.num_pkts;
+            slot_refs[rx_idx].store(1, std::memory_order_relaxed);   // cursor hold
+            if (blk_pkts_left == 0) {
+                release_rx_frame(rx_idx);
+                rx_idx = (rx_idx + 1) % V3_BLOCK_NR;
+                continue;
+            }
+            blk_pkt = reinterpret_cast<uint8_t*>(bd) + bd->hdr.bh1.offset_to_first_pkt;
+        }
+
+        auto* hdr = reinterpret_cast<tpacket3_hdr*>(blk_pkt);
+        auto* sll = reinterpret_cast<sockaddr_ll*>(
+            blk_pkt + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+
+        if (sll->sll_pkttype != PACKET_OUTGOING) {
+            out = std::span<uint8_t>{ blk_pkt + hdr->tp_mac, hdr->tp_snaplen };
+            return true;
+        }
+
+        // PACKET_OUTGOING: skip within the block
+        advance_frame_v3();
+    }
+}
+
+void RawSocketManager::advance_frame_v3() {
+    auto* hdr = reinterpret_cast<tpacket3_hdr*>(blk_pkt);
+    if (--blk_pkts_left > 0) {
+        blk_pkt += hdr->tp_next_offset;
+        return;
+    }
+    const uint32_t done = rx_idx;
+    blk_pkt = nullptr;
+    rx_idx  = (rx_idx + 1) % V3_BLOCK_NR;
+    release_rx_frame(done);   // drop the cursor hold
+}
+
 } // namespace HPGTP::Engine
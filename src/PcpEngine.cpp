@@ -0,0 +1,330 @@
+#include "PcpEngine.hpp"
+#include "Config.hpp"
+#include "NetworkUtils.hpp"
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <print>
+
+namespace HPGTP::Logic {
+
+// ── Wire format ──────────────────────────────────────────────────────────────
+
+static constexpr uint16_t PCP_PORT = 5351;
+
+// NAT-PMP (RFC 6886 §3.5) result codes.
+static constexpr uint16_t NATPMP_SUCCESS            = 0;
+static constexpr uint16_t NATPMP_NOT_AUTHORIZED     = 2;
+static constexpr uint16_t NATPMP_NETWORK_FAILURE    = 3;
+static constexpr uint16_t NATPMP_OUT_OF_RESOURCES   = 4;
+static constexpr uint16_t NATPMP_UNSUPPORTED_OPCODE = 5;
+
+// PCP (RFC 6887 §7.4) result codes and opcodes.
+static constexpr uint8_t PCP_VERSION           = 2;
+static constexpr uint8_t PCP_OP_ANNOUNCE       = 0;
+static constexpr uint8_t PCP_OP_MAP            = 1;
+static constexpr uint8_t PCP_SUCCESS           = 0;
+static constexpr uint8_t PCP_UNSUPP_VERSION    = 1;
+static constexpr uint8_t PCP_NOT_AUTHORIZED    = 2;
+static constexpr uint8_t PCP_MALFORMED_REQUEST = 3;
+static constexpr uint8_t PCP_UNSUPP_OPCODE     = 4;
+static constexpr uint8_t PCP_UNSUPP_OPTION     = 5;
+static constexpr uint8_t PCP_MALFORMED_OPTION  = 6;
+static constexpr uint8_t PCP_NETWORK_FAILURE   = 7;
+static constexpr uint8_t PCP_NO_RESOURCES      = 8;
+static constexpr uint8_t PCP_UNSUPP_PROTOCOL   = 9;
+static constexpr uint8_t PCP_ADDRESS_MISMATCH  = 12;
+static constexpr size_t  PCP_HEADER_LEN        = 24;
+static constexpr size_t  PCP_MAP_LEN           = PCP_HEADER_LEN + 36;
+// How long a client should treat an error as final (§7.4: long vs short lifetime errors).
+static constexpr uint32_t PCP_ERROR_LONG_S  = 1800;
+static constexpr uint32_t PCP_ERROR_SHORT_S = 30;
+
+static uint16_t get16(std::span<const uint8_t> b, size_t off) {
+    return static_cast<uint16_t>(b[off] << 8 | b[off + 1]);
+}
+static uint32_t get32(std::span<const uint8_t> b, size_t off) {
+    return static_cast<uint32_t>(b[off]) << 24 | static_cast<uint32_t>(b[off + 1]) << 16
+         | static_cast<uint32_t>(b[off + 2]) << 8 | b[off + 3];
+}
+static void put16(std::span<uint8_t> b, size_t off, uint16_t v) {
+    b[off] = static_cast<uint8_t>(v >> 8); b[off + 1] = static_cast<uint8_t>(v);
+}
+static void put32(std::span<uint8_t> b, size_t off, uint32_t v) {
+    put16(b, off, static_cast<uint16_t>(v >> 16)); put16(b, off + 2, static_cast<uint16_t>(v));
+}
+// PCP carries IPv4 addresses as IPv4-mapped IPv6 (::ffff:a.b.c.d).
+static void put_mapped_v4(std::span<uint8_t> b, size_t off, Net::IPv4Net ip) {
+    std::memset(b.data() + off, 0, 10);
+    b[off + 10] = b[off + 11] = 0xFF;
+    const uint32_t raw = ip.raw();
+    std::memcpy(b.data() + off + 12, &raw, 4);
+}
+static bool is_mapped_v4(std::span<const uint8_t> b, size_t off, Net::IPv4Net ip) {
+    uint8_t want[16];
+    put_mapped_v4(want, 0, ip);
+    return std::memcmp(b.data() + off, want, sizeof(want)) == 0;
+}
+
+static const char* proto_name(uint8_t proto) { return proto == 6 ? "TCP" : "UDP"; }
+
+// ── Lifecycle ────────────────────────────────────────────────────────────────
+
+PcpEngine::PcpEngine(std::shared_ptr<NatEngine> nat, const std::string& router_ip, int prefix_len)
+    : nat_engine(std::move(nat)), lan_prefix(prefix_len) {
+    lan_anchor = Net::parse_ipv4(router_ip.c_str());
+    timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    start_s = static_cast<uint64_t>(ts.tv_sec);
+
+    fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::println(stderr, "[PCP] socket failed ({}); NAT-PMP/PCP disabled.", std::strerror(errno));
+        return;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(PCP_PORT);
+    addr.sin_addr.s_addr = lan_anchor.raw();
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        std::println(stderr, "[PCP] bind {}:{} failed ({}); NAT-PMP/PCP disabled.",
+                     router_ip, PCP_PORT, std::strerror(errno));
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    std::println("[PCP Engine] Listening for NAT-PMP/PCP on {}:{}.", router_ip, PCP_PORT);
+}
+
+PcpEngine::~PcpEngine() {
+    if (fd >= 0) { ::close(fd); fd = -1; }
+}
+
+uint32_t PcpEngine::epoch() const noexcept {
+    timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint32_t>(static_cast<uint64_t>(ts.tv_sec) - start_s);
+}
+
+// ── Mapping table ────────────────────────────────────────────────────────────
+
+std::expected<uint16_t, NatEngine::UpnpError> PcpEngine::map(Net::IPv4Net client, uint8_t proto,
+                                                             uint16_t int_port, uint16_t want_ext,
+                                                             uint32_t lifetime, const char* desc) {
+    // Renewal: the client keeps the external port it already holds for this internal port.
+    for (size_t i = 0;; ++i) {
+        auto r = nat_engine->upnp_rule_at(i);
+        if (!r) break;
+        if (r->int_ip == client && r->int_port == int_port && r->proto == proto) {
+            want_ext = r->ext_port;
+            break;
+        }
+    }
+
+    NatEngine::UpnpRule rule{};
+    rule.int_ip   = client;
+    rule.int_port = int_port;
+    rule.proto    = proto;
+    rule.lease_s  = lifetime;
+    std::snprintf(rule.desc.data(), rule.desc.size(), "%s", desc);
+
+    uint16_t port = want_ext != 0 ? want_ext : int_port;
+    for (size_t probe = 0; probe < MAX_PORT_PROBES; ++probe) {
+        // add_upnp_rule renews a port the same client holds, which would silently
+        // repoint another of its mappings: treat that as taken too.
+        auto cur = nat_engine->upnp_rule(port, proto);
+        if (!cur || (cur->int_ip == client && cur->int_port == int_port)) {
+            rule.ext_port = port;
+            auto r = nat_engine->add_upnp_rule(rule);
+            if (r) return port;
+            if (r.error() != NatEngine::UpnpError::ConflictInMapping)
+                return std::unexpected(r.error());
+        }
+        port = port == 65535 ? 1024 : static_cast<uint16_t>(port + 1);
+    }
+    return std::unexpected(NatEngine::UpnpError::ConflictInMapping);
+}
+
+void PcpEngine::unmap(Net::IPv4Net client, uint8_t proto, uint16_t int_port) {
+    for (size_t i = 0;;) {
+        auto r = nat_engine->upnp_rule_at(i);
+        if (!r) break;
+        if (r->int_ip == client && r->proto == proto && (int_port == 0 || r->int_port == int_port)) {
+            // Removal moves the last rule into slot i: look at it again.
+            (void)nat_engine->remove_upnp_rule(r->ext_port, proto);
+            continue;
+        }
+        ++i;
+    }
+}
+
+// ── NAT-PMP (version 0) ──────────────────────────────────────────────────────
+
+size_t PcpEngine::handle_natpmp(Net::IPv4Net client, std::span<const uint8_t> req, std::span<uint8_t> resp) {
+    if (req.size() < 2 || req[1] >= 128) return 0;   // responses are never answered
+    const uint8_t op = req[1];
+    std::fill_n(resp.begin(), 16, uint8_t{0});
+    resp[1] = static_cast<uint8_t>(op + 128);
+    put32(resp, 4, epoch());
+    auto result = [&](uint16_t code, size_t len) { put16(resp, 2, code); return len; };
+
+    const bool authorized = Utils::Network::ipv4_in_subnet(client, lan_prefix, lan_anchor);
+    const Net::IPv4Net wan = nat_engine->wan_ip_snapshot();
+
+    if (op == 0) {   // external address request
+        if (!authorized)   return result(NATPMP_NOT_AUTHORIZED, 12);
+        if (wan.raw() == 0) return result(NATPMP_NETWORK_FAILURE, 12);
+        const uint32_t raw = wan.raw();
+        std::memcpy(resp.data() + 8, &raw, 4);
+        return result(NATPMP_SUCCESS, 12);
+    }
+    if (op != 1 && op != 2) return result(NATPMP_UNSUPPORTED_OPCODE, 8);
+    if (req.size() < 12) return 0;
+
+    const uint8_t  proto    = op == 1 ? 17 : 6;
+    const uint16_t int_port = get16(req, 4);
+    const uint16_t want_ext = get16(req, 6);
+    uint32_t       lifetime = get32(req, 8);
+    put16(resp, 8, int_port);
+
+    if (!authorized || (int_port == 0 && lifetime != 0))
+        return result(NATPMP_NOT_AUTHORIZED, 16);
+    if (lifetime == 0) {   // delete; internal port 0 = all of the client's mappings
+        unmap(client, proto, int_port);
+        return result(NATPMP_SUCCESS, 16);
+    }
+    if (wan.raw() == 0) return result(NATPMP_NETWORK_FAILURE, 16);
+
+    lifetime = std::min(lifetime, NatEngine::UPNP_MAX_LEASE);
+    auto ext = map(client, proto, int_port, want_ext, lifetime, "NAT-PMP");
+    if (!ext) {
+        std::println(stderr, "[PCP] NAT-PMP mapping refused: {}:{} [{}] (error {})",
+                     Config::ip_to_str(client), int_port, proto_name(proto),
+                     static_cast<uint16_t>(ext.error()));
+        return result(NATPMP_OUT_OF_RESOURCES, 16);
+    }
+    put16(resp, 10, *ext);
+    put32(resp, 12, lifetime);
+    return result(NATPMP_SUCCESS, 16);
+}
+
+// ── PCP (version 2) ──────────────────────────────────────────────────────────
+
+size_t PcpEngine::handle_pcp(Net::IPv4Net client, std::span<const uint8_t> req, std::span<uint8_t> resp) {
+    // Too short, too long or itself a response: dropped without an answer (§8.3).
+    if (req.size() < 4 || req.size() > MAX_DATAGRAM || (req[1] & 0x80) != 0) return 0;
+    const uint8_t op = req[1] & 0x7F;
+
+    auto reply = [&](uint8_t code, uint32_t lifetime, size_t len) {
+        resp[0] = PCP_VERSION;
+        resp[1] = static_cast<uint8_t>(0x80 | op);
+        resp[2] = 0;
+        resp[3] = code;
+        put32(resp, 4, lifetime);
+        put32(resp, 8, epoch());
+        std::fill_n(resp.begin() + 12, 12, uint8_t{0});
+        return len;
+    };
+    // Error responses carry the request's opcode data and options back (§7.2).
+    auto fail = [&](uint8_t code, uint32_t lifetime) {
+        const size_t len = std::max(req.size() & ~size_t{3}, PCP_HEADER_LEN);
+        std::fill_n(resp.begin(), PCP_HEADER_LEN, uint8_t{0});
+        std::copy_n(req.begin(), req.size() & ~size_t{3}, resp.begin());
+        return reply(code, lifetime, len);
+    };
+
+    if (req[0] != PCP_VERSION) {
+        std::fill_n(resp.begin(), PCP_HEADER_LEN, uint8_t{0});
+        return reply(PCP_UNSUPP_VERSION, PCP_ERROR_LONG_S, PCP_HEADER_LEN);
+    }
+    if (req.size() < PCP_HEADER_LEN || req.size() % 4 != 0)
+        return fail(PCP_MALFORMED_REQUEST, PCP_ERROR_LONG_S);
+    if (!is_mapped_v4(req, 8, client))   // client behind another NAT
+        return fail(PCP_ADDRESS_MISMATCH, PCP_ERROR_LONG_S);
+    if (!Utils::Network::ipv4_in_subnet(client, lan_prefix, lan_anchor))
+        return fail(PCP_NOT_AUTHORIZED, PCP_ERROR_LONG_S);
+
+    if (op == PCP_OP_ANNOUNCE) {
+        std::fill_n(resp.begin(), PCP_HEADER_LEN, uint8_t{0});
+        return reply(PCP_SUCCESS, 0, PCP_HEADER_LEN);
+    }
+    if (op != PCP_OP_MAP) return fail(PCP_UNSUPP_OPCODE, PCP_ERROR_LONG_S);
+    if (req.size() < PCP_MAP_LEN) return fail(PCP_MALFORMED_REQUEST, PCP_ERROR_LONG_S);
+
+    // Options: none is implemented, so any mandatory one (code < 128) is refused and
+    // the optional ones are ignored.
+    for (size_t off = PCP_MAP_LEN; off < req.size();) {
+        if (off + 4 > req.size()) return fail(PCP_MALFORMED_OPTION, PCP_ERROR_LONG_S);
+        const size_t olen = get16(req, off + 2);
+        if (off + 4 + olen > req.size()) return fail(PCP_MALFORMED_OPTION, PCP_ERROR_LONG_S);
+        if (req[off] < 128) return fail(PCP_UNSUPP_OPTION, PCP_ERROR_LONG_S);
+        off += 4 + ((olen + 3) & ~size_t{3});
+    }
+
+    const uint8_t  proto    = req[36];
+    const uint16_t int_port = get16(req, 40);
+    const uint16_t want_ext = get16(req, 42);
+    uint32_t       lifetime = get32(req, 4);
+    if (proto != 6 && proto != 17) return fail(PCP_UNSUPP_PROTOCOL, PCP_ERROR_LONG_S);
+    if (int_port == 0)             return fail(PCP_MALFORMED_REQUEST, PCP_ERROR_LONG_S);
+
+    std::copy_n(req.begin() + PCP_HEADER_LEN, PCP_MAP_LEN - PCP_HEADER_LEN,
+                resp.begin() + PCP_HEADER_LEN);
+    if (lifetime == 0) {
+        unmap(client, proto, int_port);
+        return reply(PCP_SUCCESS, 0, PCP_MAP_LEN);
+    }
+    const Net::IPv4Net wan = nat_engine->wan_ip_snapshot();
+    if (wan.raw() == 0) return fail(PCP_NETWORK_FAILURE, PCP_ERROR_SHORT_S);
+
+    lifetime = std::min(lifetime, NatEngine::UPNP_MAX_LEASE);
+    auto ext = map(client, proto, int_port, want_ext, lifetime, "PCP");
+    if (!ext) {
+        std::println(stderr, "[PCP] PCP mapping refused: {}:{} [{}] (error {})",
+                     Config::ip_to_str(client), int_port, proto_name(proto),
+                     static_cast<uint16_t>(ext.error()));
+        return fail(PCP_NO_RESOURCES, PCP_ERROR_SHORT_S);
+    }
+    put16(resp, 42, *ext);
+    put_mapped_v4(resp, 44, wan);
+    return reply(PCP_SUCCESS, lifetime, PCP_MAP_LEN);
+}
+
+// ── Event loop hook ──────────────────────────────────────────────────────────
+
+size_t PcpEngine::handle_datagram(Net::IPv4Net client, std::span<const uint8_t> req,
+                                  std::span<uint8_t> resp) {
+    if (req.empty() || resp.size() < MAX_DATAGRAM) return 0;
+    return req[0] == 0 ? handle_natpmp(client, req, resp) : handle_pcp(client, req, resp);
+}
+
+void PcpEngine::on_readable() {
+    if (fd < 0) return;
+    uint8_t req[MAX_DATAGRAM + 4];   // room to tell an oversized datagram apart
+    uint8_t resp[MAX_DATAGRAM];
+    // Bounded so a flood cannot hold up the rest of the loop; the socket stays readable.
+    for (int burst = 0; burst < 64; ++burst) {
+        sockaddr_in src{};
+        socklen_t   slen = sizeof(src);
+        const ssize_t n = recvfrom(fd, req, sizeof(req), 0, reinterpret_cast<sockaddr*>(&src), &slen);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;   // EAGAIN: drained
+        }
+        if (n == 0) continue;
+        const size_t len = handle_datagram(Net::IPv4Net{src.sin_addr.s_addr},
+                                           std::span<const uint8_t>(req, static_cast<size_t>(n)), resp);
+        if (len == 0) continue;
+        (void)sendto(fd, resp, len, 0, reinterpret_cast<sockaddr*>(&src), slen);
+    }
+}
+}
@@ -4,9 +4,9 @@
 
 namespace HPGTP::Traffic {
 
-static TxResult try_hardware_send(int fd, std::span<const uint8_t> pkt) {
+static TxResult to_tx_result(DataPlane::TxFrameOutput::PacketTxTry t) {
     using DataPlane::TxFrameOutput;
-    switch (TxFrameOutput::try_send_packet_nonblocking(fd, pkt)) {
+    switch (t) {
     case TxFrameOutput::PacketTxTry::Complete: return TxResult::Success;
     case TxFrameOutput::PacketTxTry::Busy: return TxResult::Congested;
     case TxFrameOutput::PacketTxTry::Error: return TxResult::Fatal;
@@ -14,6 +14,10 @@ static TxResult try_hardware_send(int fd, std::span<const uint8_t> pkt) {
     return TxResult::Fatal;
 }
 
+static TxResult try_hardware_send(const DataPlane::TxPort& tx, std::span<const uint8_t> pkt) {
+    return to_tx_result(DataPlane::TxFrameOutput::try_send_packet_nonblocking(tx, pkt));
+}
+
 void Shaper::set_rate_limit(Mbps limit) {
     bucket.set_rate(limit);
 }
@@ -30,7 +34,15 @@ void Shaper::enqueue_normal(std::span<const uint8_t> pkt) {
     unlock_spin();
 }
 
-void Shaper::process_queue(int tx_fd) {
+void Shaper::process_queue(const DataPlane::TxPort& tx) {
+    // Workers of one direction share this shaper: the queue front is copied out and
+    // popped in two steps, so only one of them may drain at a time.
+    if (draining_.test_and_set(std::memory_order_acquire)) return;
+    if (!tx.ring) {
+        process_queue_batched(tx.fd);
+        draining_.clear(std::memory_order_release);
+        return;
+    }
     std::array<uint8_t, 2048> pkt_copy{};
     while (true) {
         uint16_t sz = 0;
@@ -49,12 +61,49 @@ void Shaper::process_queue(int tx_fd) {
             std::memcpy(pkt_copy.data(), pkt_span.data(), sz);
             unlock_spin();
         }
-        TxResult res = try_hardware_send(tx_fd, std::span(pkt_copy.data(), sz));
+        TxResult res = try_hardware_send(tx, std::span(pkt_copy.data(), sz));
         lock_spin();
         result_handlers[static_cast<size_t>(res)](this, sz);
         unlock_spin();
         if (res == TxResult::Congested) break;
     }
+    draining_.clear(std::memory_order_release);
+}
+
+// No TX ring: gather up to TX_BATCH token-approved frames from the queue front,
+// send them with one sendmmsg(2), then settle each frame through result_handlers
+// in queue order. Busy is always a suffix, so refunded frames stay queued in order.
+void Shaper::process_queue_batched(int tx_fd) {
+    using DataPlane::TxFrameOutput;
+    std::array<std::array<uint8_t, 2048>, TX_BATCH>   copies;
+    std::array<std::span<const uint8_t>, TX_BATCH>    frames;
+    std::array<TxFrameOutput::PacketTxTry, TX_BATCH> results;
+    while (true) {
+        size_t n = 0;
+        lock_spin();
+        const size_t avail = normal_queue.size();
+        while (n < TX_BATCH && n < avail) {
+            auto pkt_span = normal_queue.peek(n);
+            if (!bucket.try_consume(pkt_span.size())) break;
+            std::memcpy(copies[n].data(), pkt_span.data(), pkt_span.size());
+            frames[n] = std::span<const uint8_t>(copies[n].data(), pkt_span.size());
+            ++n;
+        }
+        unlock_spin();
+        if (n == 0) break;
+
+        TxFrameOutput::send_batch_nonblocking(tx_fd, std::span(frames.data(), n),
+                                              std::span(results.data(), n));
+        bool congested = false;
+        lock_spin();
+        for (size_t i = 0; i < n; ++i) {
+            TxResult res = to_tx_result(results[i]);
+            result_handlers[static_cast<size_t>(res)](this, frames[i].size());
+            congested |= (res == TxResult::Congested);
+        }
+        unlock_spin();
+        if (congested || n < TX_BATCH) break;
+    }
 }
 
 } // namespace HPGTP::Traffic
@@ -310,7 +310,7 @@ void SelfTest::test_dns(Report& r) {
     auto pkt_static = Net::ParsedPacket::parse(
         std::span<uint8_t>{dns_buf.data(), static_cap});
     using enum Logic::DnsQueryDisposition;
-    const auto static_disp = dns_static->process_query(pkt_static, -1);
+    const auto static_disp = dns_static->process_query(pkt_static, -1, -1);
     const bool static_pass = (static_disp == ReplySendFailed);
     r.add("DNS_Static", static_pass,
           static_pass ? "static hit; ReplySendFailed with invalid bounce fd (expected)"
@@ -324,7 +324,7 @@ void SelfTest::test_dns(Report& r) {
     auto miss_buf = make_dns_query(cli, srv, "unknown.invalid", len2);
     auto pkt_miss = Net::ParsedPacket::parse(
         std::span<uint8_t>{miss_buf.data(), len2});
-    const bool miss_pass = (dns_miss->process_query(pkt_miss, -1) == NotHandled);
+    const bool miss_pass = (dns_miss->process_query(pkt_miss, -1, -1) == NotHandled);
     r.add("DNS_CacheMiss", miss_pass,
           miss_pass ? "unknown domain NotHandled (cache miss)" : "unexpected cache hit");
 
@@ -339,7 +339,7 @@ void SelfTest::test_dns(Report& r) {
     auto redir_buf = make_dns_query(cli, gw, "redirect.test", len3);
     auto pkt_redir = Net::ParsedPacket::parse(
         std::span<uint8_t>{redir_buf.data(), len3});
-    const auto redir_disp = dns_redir->process_query(pkt_redir, -1); // Redirected + daddr rewrite
+    const auto redir_disp = dns_redir->process_query(pkt_redir, -1, -1); // Redirected + daddr rewrite
     bool redir_pass = (redir_disp == Redirected) && pkt_redir.is_valid_ipv4()
                       && (pkt_redir.ipv4->daddr == upstream);
     r.add("DNS_Redirect", redir_pass,
@@ -353,7 +353,7 @@ void SelfTest::test_dns(Report& r) {
     size_t len4 = 0;
     auto buf4 = make_dns_query(cli, gw, "secondary.fallback", len4);
     auto pkt_sec = Net::ParsedPacket::parse(std::span<uint8_t>{buf4.data(), len4});
-    const auto disp_sec = dns_secfb->process_query(pkt_sec, -1);
+    const auto disp_sec = dns_secfb->process_query(pkt_sec, -1, -1);
     bool secfb_pass = (disp_sec == Redirected) && pkt_sec.is_valid_ipv4()
                       && (pkt_sec.ipv4->daddr == sec_fb);
     r.add("DNS_RedirectSecondary", secfb_pass,
@@ -1,12 +1,14 @@
 #include "UpnpEngine.hpp"
-#include "DataPlane.hpp"
 #include "SystemOptimizer.hpp"
+#include <algorithm>
+#include <cctype>
 #include <span>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <time.h>
 #include <unistd.h>
 #include <cstring>
 #include <cerrno>
@@ -16,22 +18,165 @@
 
 namespace HPGTP::Logic {
 
+// ── SOAP helpers (WANIPConnection:1) ─────────────────────────────────────────
+
+static std::string_view soap_arg(std::string_view body, std::string_view tag) {
+    if (tag.size() > 60) return {};
+    char start_tag[64], end_tag[64];
+    int sl = snprintf(start_tag, sizeof(start_tag), "<%.*s>", static_cast<int>(tag.size()), tag.data());
+    int el = snprintf(end_tag, sizeof(end_tag), "</%.*s>", static_cast<int>(tag.size()), tag.data());
+    auto s = body.find(std::string_view(start_tag, sl));
+    auto e = body.find(std::string_view(end_tag, el));
+    if (s != std::string_view::npos && e != std::string_view::npos && e >= s + sl)
+        return body.substr(s + sl, e - (s + sl));
+    return {};
+}
+
+template<typename T>
+static bool soap_arg_num(std::string_view body, std::string_view tag, T& out) {
+    auto v = soap_arg(body, tag);
+    return !v.empty() && std::from_chars(v.data(), v.data() + v.size(), out).ec == std::errc{};
+}
+
+static uint8_t soap_protocol(std::string_view v) {
+    return v.find("TCP") != std::string_view::npos ? 6 : 17;
+}
+
+// Response assembled into the connection's send buffer; keep_alive picks the
+// Connection header and whether the server reads the next request afterwards.
+struct HttpReply {
+    std::span<char> buf;
+    size_t          len = 0;
+    bool            keep_alive = true;
+};
+
+static void finish_reply(HttpReply& reply, int n) {
+    reply.len = n < 0 ? 0 : std::min(static_cast<size_t>(n), reply.buf.size() - 1);
+}
+
+static void send_http_xml(HttpReply& reply, const char* status, const char* xml, int xml_len) {
+    finish_reply(reply, snprintf(reply.buf.data(), reply.buf.size(),
+        "HTTP/1.1 %s\r\nContent-Type: text/xml; charset=\"utf-8\"\r\n"
+        "Content-Length: %d\r\nConnection: %s\r\n\r\n%.*s",
+        status, xml_len, reply.keep_alive ? "keep-alive" : "close", xml_len, xml));
+}
+
+static void send_http_empty(HttpReply& reply, const char* status) {
+    finish_reply(reply, snprintf(reply.buf.data(), reply.buf.size(),
+        "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+        status, reply.keep_alive ? "keep-alive" : "close"));
+}
+
+// `args` are the already formatted <NewX>..</NewX> output arguments (may be empty).
+static void send_soap_response(HttpReply& reply, const char* action, const char* args) {
+    char xml[1536];
+    int xml_len = snprintf(xml, sizeof(xml),
+        "<?xml version=\"1.0\"?>"
+        "<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" "
+        "xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+        "<s:Body><u:%sResponse xmlns:u=\"urn:schemas-upnp-org:service:WANIPConnection:1\">"
+        "%s</u:%sResponse></s:Body></s:Envelope>",
+        action, args, action);
+    if (xml_len >= static_cast<int>(sizeof(xml))) xml_len = static_cast<int>(sizeof(xml)) - 1;
+    send_http_xml(reply, "200 OK", xml, xml_len);
+}
+
+static void send_soap_fault(HttpReply& reply, uint16_t code, const char* description) {
+    char xml[768];
+    int xml_len = snprintf(xml, sizeof(xml),
+        "<?xml version=\"1.0\"?>"
+        "<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" "
+        "xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+        "<s:Body><s:Fault><faultcode>s:Client</faultcode><faultstring>UPnPError</faultstring>"
+        "<detail><UPnPError xmlns=\"urn:schemas-upnp-org:control-1-0\">"
+        "<errorCode>%u</errorCode><errorDescription>%s</errorDescription>"
+        "</UPnPError></detail></s:Fault></s:Body></s:Envelope>",
+        code, description);
+    send_http_xml(reply, "500 Internal Server Error", xml, xml_len);
+}
+
+static void send_soap_fault(HttpReply& reply, NatEngine::UpnpError err) {
+    using E = NatEngine::UpnpError;
+    const char* d = "ActionFailed";
+    switch (err) {
+        case E::ArrayIndexInvalid:   d = "SpecifiedArrayIndexInvalid"; break;
+        case E::NoSuchEntry:         d = "NoSuchEntryInArray";         break;
+        case E::ConflictInMapping:   d = "ConflictInMappingEntry";     break;
+        case E::NoPortMapsAvailable: d = "NoPortMapsAvailable";        break;
+    }
+    send_soap_fault(reply, static_cast<uint16_t>(err), d);
+}
+
+// The fields shared by both Get*PortMappingEntry responses.
+static int format_mapping_args(char* out, size_t cap, const NatEngine::UpnpRule& r) {
+    char ip[INET_ADDRSTRLEN]{};
+    in_addr a{};
+    a.s_addr = r.int_ip.raw();
+    ::inet_ntop(AF_INET, &a, ip, sizeof(ip));
+    return snprintf(out, cap,
+        "<NewInternalPort>%u</NewInternalPort><NewInternalClient>%s</NewInternalClient>"
+        "<NewEnabled>1</NewEnabled><NewPortMappingDescription>%s</NewPortMappingDescription>"
+        "<NewLeaseDuration>%u</NewLeaseDuration>",
+        r.int_port, ip, r.desc.data(), r.lease_s);
+}
+
+static uint64_t monotonic_ms() {
+    timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+static bool ci_equal(std::string_view a, std::string_view b) {
+    return a.size() == b.size()
+        && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+// Value of header `name` in a CRLF-separated header block (surrounding blanks
+// trimmed), or empty when absent.
+static std::string_view http_header(std::string_view headers, std::string_view name) {
+    while (!headers.empty()) {
+        const size_t eol = headers.find("\r\n");
+        const std::string_view line = headers.substr(0, eol);
+        headers = eol == std::string_view::npos ? std::string_view{} : headers.substr(eol + 2);
+        const size_t colon = line.find(':');
+        if (colon == std::string_view::npos || !ci_equal(line.substr(0, colon), name)) continue;
+        std::string_view v = line.substr(colon + 1);
+        while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+        while (!v.empty() && (v.back()  == ' ' || v.back()  == '\t')) v.remove_suffix(1);
+        return v;
+    }
+    return {};
+}
+
+// epoll data: a connection index, or one of these.
+static constexpr uint32_t TAG_SSDP     = UINT32_MAX - 2;
+static constexpr uint32_t TAG_LISTEN   = UINT32_MAX - 1;
+static constexpr uint32_t TAG_SHUTDOWN = UINT32_MAX;
+
+static bool epoll_watch(int epfd, int op, int fd, uint32_t events, uint32_t tag) {
+    epoll_event ev{};
+    ev.events   = events;
+    ev.data.u32 = tag;
+    return ::epoll_ctl(epfd, op, fd, &ev) == 0;
+}
+
 UpnpEngine::UpnpEngine(std::shared_ptr<NatEngine> nat, const std::string& ip)
     : nat_engine(nat), router_ip_str(ip) {
-    soap_job_notify_efd = ::eventfd(0, EFD_CLOEXEC);
-    shutdown_efd        = ::eventfd(0, EFD_CLOEXEC);
-    if (soap_job_notify_efd < 0 || shutdown_efd < 0) {
+    shutdown_efd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    epoll_fd     = ::epoll_create1(EPOLL_CLOEXEC);
+    if (shutdown_efd < 0 || epoll_fd < 0
+        || !epoll_watch(epoll_fd, EPOLL_CTL_ADD, shutdown_efd, EPOLLIN, TAG_SHUTDOWN)) {
         std::println(stderr,
-            "[UPnP] eventfd init failed ({}); UPnP disabled.",
+            "[UPnP] epoll/eventfd init failed ({}); UPnP disabled.",
             std::strerror(errno));
-        if (soap_job_notify_efd >= 0) { ::close(soap_job_notify_efd); soap_job_notify_efd = -1; }
-        if (shutdown_efd        >= 0) { ::close(shutdown_efd);        shutdown_efd        = -1; }
+        if (shutdown_efd >= 0) { ::close(shutdown_efd); shutdown_efd = -1; }
+        if (epoll_fd     >= 0) { ::close(epoll_fd);     epoll_fd     = -1; }
         return;
     }
     running.store(true, std::memory_order_relaxed);
-    ssdp_thread        = std::thread([this]() { run_ssdp_server(); });
-    soap_worker_thread = std::thread([this]() { run_soap_worker(); });
-    soap_thread        = std::thread([this]() { run_soap_server(); });
+    server_thread = std::thread([this]() { run(); });
     std::println("[UPnP Engine] Startup complete. Listening for LAN SSDP broadcasts.");
 }
 
@@ -39,105 +184,289 @@ UpnpEngine::~UpnpEngine() {
     running.store(false, std::memory_order_relaxed);
     if (shutdown_efd >= 0)
         (void)::eventfd_write(shutdown_efd, 1);
-    if (soap_job_notify_efd >= 0)
-        (void)::eventfd_write(soap_job_notify_efd, 1);
-    if (soap_thread.joinable())        soap_thread.join();
-    if (soap_worker_thread.joinable()) soap_worker_thread.join();
-    if (ssdp_thread.joinable())        ssdp_thread.join();
-    if (soap_job_notify_efd >= 0) { ::close(soap_job_notify_efd); soap_job_notify_efd = -1; }
-    if (shutdown_efd        >= 0) { ::close(shutdown_efd);        shutdown_efd        = -1; }
+    if (server_thread.joinable()) server_thread.join();
+    if (shutdown_efd >= 0) { ::close(shutdown_efd); shutdown_efd = -1; }
+    if (epoll_fd     >= 0) { ::close(epoll_fd);     epoll_fd     = -1; }
 }
 
-void UpnpEngine::run_ssdp_server() {
+// ── Event loop (Core 1) ──────────────────────────────────────────────────────
+
+void UpnpEngine::run() {
     System::Optimizer::set_current_thread_affinity(1);
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) return;
+    (void)open_ssdp();
+    (void)open_soap();
+
+    std::array<epoll_event, MAX_HTTP_CONNS + 3> events{};
+    while (running.load(std::memory_order_relaxed)) {
+        // 1 s timeout so idle keep-alive connections are reaped without traffic.
+        const int n = ::epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), 1000);
+        if (n < 0) { if (errno == EINTR) continue; break; }
+
+        for (int i = 0; i < n; ++i) {
+            const uint32_t tag = events[i].data.u32;
+            const uint32_t ev  = events[i].events;
+            if (tag == TAG_SHUTDOWN) {
+                running.store(false, std::memory_order_relaxed);
+            } else if (tag == TAG_SSDP) {
+                on_ssdp_readable();
+            } else if (tag == TAG_LISTEN) {
+                on_soap_accept();
+            } else if (tag < conns.size()) {
+                HttpConn& c = conns[tag];
+                if (c.fd >= 0 && (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) on_conn_readable(c);
+                if (c.fd >= 0 && (ev & EPOLLOUT) != 0)                          on_conn_writable(c);
+            }
+        }
+        expire_idle_conns(monotonic_ms());
+    }
+
+    for (HttpConn& c : conns)
+        if (c.fd >= 0) close_conn(c);
+    if (soap_listen_fd >= 0) { ::close(soap_listen_fd); soap_listen_fd = -1; }
+    if (ssdp_fd        >= 0) { ::close(ssdp_fd);        ssdp_fd        = -1; }
+}
+
+bool UpnpEngine::open_ssdp() {
+    ssdp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ssdp_fd < 0) return false;
 
     int opt = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(ssdp_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
     sockaddr_in addr{};
     addr.sin_family      = AF_INET;
     addr.sin_port        = htons(1900);
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    if (bind(ssdp_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
         std::println(stderr, "[UPnP] SSDP bind port 1900 failed ({})", std::strerror(errno));
         bind_errors.fetch_or(1, std::memory_order_relaxed);
-        ::close(fd);
-        return;
+        ::close(ssdp_fd);
+        ssdp_fd = -1;
+        return false;
     }
 
     ip_mreq mreq{};
     mreq.imr_multiaddr.s_addr = inet_addr("239.255.255.250");
     mreq.imr_interface.s_addr = inet_addr(router_ip_str.c_str());
-    setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    setsockopt(ssdp_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    return epoll_watch(epoll_fd, EPOLL_CTL_ADD, ssdp_fd, EPOLLIN, TAG_SSDP);
+}
 
-    char buf[1024];
-    while (running.load(std::memory_order_relaxed)) {
-        struct pollfd pfds[2]{
-            { fd,            POLLIN, 0 },
-            { shutdown_efd,  POLLIN, 0 },
-        };
-        int pr = ::poll(pfds, 2, -1);
-        if (pr < 0) { if (errno == EINTR) continue; break; }
-        if ((pfds[1].revents & POLLIN) != 0) break;
-        if ((pfds[0].revents & POLLIN) == 0) continue;
+bool UpnpEngine::open_soap() {
+    soap_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (soap_listen_fd < 0) return false;
 
+    int opt = 1;
+    setsockopt(soap_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(5000);
+    addr.sin_addr.s_addr = inet_addr(router_ip_str.c_str());
+    if (bind(soap_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        std::println(stderr, "[UPnP] SOAP bind port 5000 failed ({})", std::strerror(errno));
+        bind_errors.fetch_or(2, std::memory_order_relaxed);
+        ::close(soap_listen_fd);
+        soap_listen_fd = -1;
+        return false;
+    }
+    if (listen(soap_listen_fd, 16) < 0) {
+        std::println(stderr, "[UPnP] SOAP listen failed ({})", std::strerror(errno));
+        bind_errors.fetch_or(4, std::memory_order_relaxed);
+        ::close(soap_listen_fd);
+        soap_listen_fd = -1;
+        return false;
+    }
+    return epoll_watch(epoll_fd, EPOLL_CTL_ADD, soap_listen_fd, EPOLLIN, TAG_LISTEN);
+}
+
+void UpnpEngine::on_ssdp_readable() {
+    char buf[1024];
+    // Bounded so an M-SEARCH storm cannot starve the SOAP connections.
+    for (int burst = 0; burst < 32; ++burst) {
         sockaddr_in client{};
         socklen_t clen = sizeof(client);
-        int n = recvfrom(fd, buf, sizeof(buf) - 1, 0,
+        int n = recvfrom(ssdp_fd, buf, sizeof(buf) - 1, 0,
                          reinterpret_cast<sockaddr*>(&client), &clen);
-        if (n > 0) {
-            std::string_view req(buf, n);
-            if (req.find("M-SEARCH") != std::string_view::npos &&
-                (req.find("urn:schemas-upnp-org:device:InternetGatewayDevice") != std::string_view::npos ||
-                 req.find("ssdp:all") != std::string_view::npos)) {
-                char resp[512];
-                int resp_len = snprintf(resp, sizeof(resp),
-                    "HTTP/1.1 200 OK\r\n"
-                    "CACHE-CONTROL: max-age=1800\r\n"
-                    "ST: urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n"
-                    "USN: uuid:12345678-1234-1234-1234-123456789abc::"
-                        "urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n"
-                    "EXT:\r\n"
-                    "Server: HPGTP/1.0 UPnP/1.0 IGD/1.0\r\n"
-                    "Location: http://%s:5000/desc.xml\r\n"
-                    "\r\n", router_ip_str.c_str());
-                sendto(fd, resp, resp_len, 0,
-                       reinterpret_cast<sockaddr*>(&client), clen);
-            }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        std::string_view req(buf, n);
+        if (req.find("M-SEARCH") != std::string_view::npos &&
+            (req.find("urn:schemas-upnp-org:device:InternetGatewayDevice") != std::string_view::npos ||
+             req.find("ssdp:all") != std::string_view::npos)) {
+            char resp[512];
+            int resp_len = snprintf(resp, sizeof(resp),
+                "HTTP/1.1 200 OK\r\n"
+                "CACHE-CONTROL: max-age=1800\r\n"
+                "ST: urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n"
+                "USN: uuid:12345678-1234-1234-1234-123456789abc::"
+                    "urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n"
+                "EXT:\r\n"
+                "Server: HPGTP/1.0 UPnP/1.0 IGD/1.0\r\n"
+                "Location: http://%s:5000/desc.xml\r\n"
+                "\r\n", router_ip_str.c_str());
+            sendto(ssdp_fd, resp, resp_len, 0,
+                   reinterpret_cast<sockaddr*>(&client), clen);
         }
     }
-    close(fd);
 }
 
-void UpnpEngine::run_soap_worker() {
-    System::Optimizer::set_current_thread_affinity(1);
+// ── HTTP/1.1 connections ─────────────────────────────────────────────────────
+
+void UpnpEngine::on_soap_accept() {
     for (;;) {
-        SoapRequestJob job;
-        while (soap_jobs.pop(job))
-            dispatch_soap_http(job.cfd, std::string_view(job.buf.data(), job.len));
-
-        if (!running.load(std::memory_order_relaxed))
-            break;
-
-        struct pollfd pfd{};
-        pfd.fd     = soap_job_notify_efd;
-        pfd.events = POLLIN;
-        int pr     = ::poll(&pfd, 1, -1);
-        if (pr < 0) {
-            if (errno == EINTR) continue;
-            break;
+        int cfd = accept4(soap_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;   // EAGAIN: backlog drained
+        }
+        auto it = std::find_if(conns.begin(), conns.end(), [](const HttpConn& c) { return c.fd < 0; });
+        if (it == conns.end()) {
+            static const char busy[] =
+                "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            (void)::send(cfd, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            ::close(cfd);
+            continue;
+        }
+        HttpConn& c = *it;
+        c.fd             = cfd;
+        c.rx_len         = 0;
+        c.tx_off         = 0;
+        c.tx_len         = 0;
+        c.want_write     = false;
+        c.close_after_tx = false;
+        c.last_active_ms = monotonic_ms();
+        if (!epoll_watch(epoll_fd, EPOLL_CTL_ADD, cfd, EPOLLIN,
+                         static_cast<uint32_t>(it - conns.begin())))
+            close_conn(c);
+    }
+}
+
+void UpnpEngine::watch_conn(const HttpConn& c) {
+    if (!epoll_watch(epoll_fd, EPOLL_CTL_MOD, c.fd, c.want_write ? EPOLLOUT : EPOLLIN,
+                     static_cast<uint32_t>(&c - conns.data())))
+        std::println(stderr, "[UPnP] epoll_ctl failed ({})", std::strerror(errno));
+}
+
+void UpnpEngine::close_conn(HttpConn& c) {
+    ::close(c.fd);   // also leaves the epoll set
+    c.fd     = -1;
+    c.rx_len = c.tx_off = c.tx_len = 0;
+}
+
+void UpnpEngine::expire_idle_conns(uint64_t now_ms) {
+    for (HttpConn& c : conns)
+        if (c.fd >= 0 && now_ms - c.last_active_ms > HTTP_IDLE_MS)
+            close_conn(c);
+}
+
+void UpnpEngine::on_conn_readable(HttpConn& c) {
+    bool eof = false;
+    while (c.rx_len < c.rx.size()) {
+        const ssize_t n = ::recv(c.fd, c.rx.data() + c.rx_len, c.rx.size() - c.rx_len, 0);
+        if (n > 0) { c.rx_len += static_cast<uint32_t>(n); continue; }
+        if (n == 0) { eof = true; break; }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        close_conn(c);
+        return;
+    }
+    c.last_active_ms = monotonic_ms();
+    serve_requests(c);
+    // Peer finished sending: answer what is complete, then close.
+    if (eof && c.fd >= 0) {
+        if (c.tx_len == 0) close_conn(c);
+        else               c.close_after_tx = true;
+    }
+}
+
+void UpnpEngine::on_conn_writable(HttpConn& c) {
+    if (flush(c)) serve_requests(c);
+}
+
+bool UpnpEngine::flush(HttpConn& c) {
+    while (c.tx_off < c.tx_len) {
+        const ssize_t n = ::send(c.fd, c.tx.data() + c.tx_off, c.tx_len - c.tx_off, MSG_NOSIGNAL);
+        if (n > 0) {
+            c.tx_off += static_cast<uint32_t>(n);
+            c.last_active_ms = monotonic_ms();
+            continue;
         }
-        if ((pfd.revents & POLLIN) != 0) {
-            uint64_t v;
-            (void)::eventfd_read(soap_job_notify_efd, &v);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Slow reader: stop reading from it until the response has gone out.
+            if (!c.want_write) { c.want_write = true; watch_conn(c); }
+            return false;
         }
+        close_conn(c);
+        return false;
     }
+    c.tx_off = c.tx_len = 0;
+    if (c.close_after_tx) { close_conn(c); return false; }
+    if (c.want_write) { c.want_write = false; watch_conn(c); }
+    return true;
 }
 
-void UpnpEngine::dispatch_soap_http(int cfd, std::string_view req) {
-    if (req.find("GET /desc.xml") != std::string_view::npos) {
+void UpnpEngine::serve_requests(HttpConn& c) {
+    while (c.fd >= 0 && c.tx_len == 0 && c.rx_len > 0) {
+        const std::string_view buf(c.rx.data(), c.rx_len);
+        HttpReply reply{std::span<char>(c.tx)};
+        size_t consumed = c.rx_len;
+
+        const size_t hdr_end = buf.find("\r\n\r\n");
+        if (hdr_end == std::string_view::npos) {
+            if (c.rx_len < c.rx.size()) return;   // headers still arriving
+            reply.keep_alive = false;
+            send_http_empty(reply, "431 Request Header Fields Too Large");
+        } else {
+            // Request line: METHOD SP target SP version
+            const size_t line_end = buf.find("\r\n");
+            const std::string_view line = buf.substr(0, line_end);
+            const size_t sp1 = line.find(' ');
+            const size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+            const std::string_view headers = buf.substr(line_end + 2, hdr_end - std::min(hdr_end, line_end + 2));
+            const std::string_view version = sp2 == std::string_view::npos ? std::string_view{} : line.substr(sp2 + 1);
+            const std::string_view conn_hdr = http_header(headers, "Connection");
+            const std::string_view len_hdr  = http_header(headers, "Content-Length");
+            size_t body_len = 0;
+            const bool len_ok = len_hdr.empty()
+                || std::from_chars(len_hdr.data(), len_hdr.data() + len_hdr.size(), body_len).ec == std::errc{};
+
+            reply.keep_alive = version == "HTTP/1.1" ? !ci_equal(conn_hdr, "close")
+                                                     : ci_equal(conn_hdr, "keep-alive");
+            if (sp2 == std::string_view::npos || !version.starts_with("HTTP/1.") || !len_ok) {
+                reply.keep_alive = false;
+                send_http_empty(reply, "400 Bad Request");
+            } else if (!http_header(headers, "Transfer-Encoding").empty()) {
+                reply.keep_alive = false;
+                send_http_empty(reply, "411 Length Required");
+            } else if (body_len > c.rx.size() - (hdr_end + 4)) {
+                reply.keep_alive = false;
+                send_http_empty(reply, "413 Content Too Large");
+            } else if (hdr_end + 4 + body_len > c.rx_len) {
+                return;   // body still arriving
+            } else {
+                consumed = hdr_end + 4 + body_len;
+                dispatch_soap_http(reply, line.substr(0, sp1), line.substr(sp1 + 1, sp2 - sp1 - 1),
+                                   buf.substr(hdr_end + 4, body_len));
+                if (reply.len == 0) send_http_empty(reply, "500 Internal Server Error");
+            }
+        }
+
+        std::memmove(c.rx.data(), c.rx.data() + consumed, c.rx_len - consumed);
+        c.rx_len        -= static_cast<uint32_t>(consumed);
+        c.tx_off         = 0;
+        c.tx_len         = static_cast<uint32_t>(reply.len);
+        c.close_after_tx = !reply.keep_alive;
+        if (!flush(c)) return;
+    }
+}
+
+void UpnpEngine::dispatch_soap_http(HttpReply& reply, std::string_view method, std::string_view target,
+                                    std::string_view body) {
+    if (method == "GET" && target == "/desc.xml") {
         const char* xml_template =
             "<?xml version=\"1.0\"?>\r\n<root xmlns=\"urn:schemas-upnp-org:device-1-0\">\r\n"
             "  <specVersion><major>1</major><minor>0</minor></specVersion>\r\n"
@@ -155,151 +484,79 @@ void UpnpEngine::dispatch_soap_http(int cfd, std::string_view req) {
         int xml_len = snprintf(xml_buf, sizeof(xml_buf), xml_template, router_ip_str.c_str());
         if (xml_len >= static_cast<int>(sizeof(xml_buf)))
             xml_len = static_cast<int>(sizeof(xml_buf)) - 1;
-
-        char resp[1500];
-        int resp_len = snprintf(resp, sizeof(resp),
-            "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\n"
-            "Content-Length: %d\r\nConnection: close\r\n\r\n%s",
-            xml_len, xml_buf);
-        DataPlane::TxFrameOutput::send_stream_blocking(
-            cfd,
-            std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(resp),
-                                      static_cast<size_t>(resp_len)));
-    } else if (req.find("POST /control") != std::string_view::npos) {
-        auto body_idx = req.find("\r\n\r\n");
-        if (body_idx != std::string_view::npos && body_idx + 4 < req.size()) {
-            std::string_view body = req.substr(body_idx + 4);
-            if (body.find("AddPortMapping") != std::string_view::npos) {
-                auto get_tag = [&](std::string_view t) -> std::string_view {
-                    if (t.size() > 60) return {};
-                    char start_tag[64], end_tag[64];
-                    int sl = snprintf(start_tag, sizeof(start_tag), "<%.*s>",
-                                     static_cast<int>(t.size()), t.data());
-                    int el = snprintf(end_tag, sizeof(end_tag), "</%.*s>",
-                                     static_cast<int>(t.size()), t.data());
-                    auto s = body.find(std::string_view(start_tag, sl));
-                    auto e = body.find(std::string_view(end_tag, el));
-                    if (s != std::string_view::npos && e != std::string_view::npos)
-                        return body.substr(s + sl, e - (s + sl));
-                    return {};
-                };
-
-                auto ext_port   = get_tag("NewExternalPort");
-                auto int_port   = get_tag("NewInternalPort");
-                auto int_client = get_tag("NewInternalClient");
-                auto protocol   = get_tag("NewProtocol");
-
-                if (!ext_port.empty() && !int_client.empty()) {
-                    uint16_t eP = 0;
-                    std::from_chars(ext_port.data(), ext_port.data() + ext_port.size(), eP);
-                    uint16_t iP = eP;
-                    if (!int_port.empty())
-                        std::from_chars(int_port.data(), int_port.data() + int_port.size(), iP);
-                    uint8_t proto = (protocol.find("TCP") != std::string_view::npos) ? 6 : 17;
-
-                    char ip_buf[32]{};
-                    std::memcpy(ip_buf, int_client.data(),
-                                std::min(int_client.size(), size_t(31)));
-                    Net::IPv4Net cIP = Net::parse_ipv4(ip_buf);
-                    nat_engine->add_upnp_rule({eP, cIP, iP, proto});
-                    std::println("[UPnP] Port mapping accepted: {} [{}] -> {}:{} forwarded to data plane.",
-                                 ext_port, protocol, int_client, iP);
-
-                    const char* resp_xml =
-                        "<?xml version=\"1.0\"?>"
-                        "<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" "
-                        "xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">"
-                        "<s:Body><u:AddPortMappingResponse "
-                        "xmlns:u=\"urn:schemas-upnp-org:service:WANIPConnection:1\"/>"
-                        "</s:Body></s:Envelope>";
-                    char resp_buf[512];
-                    int resp_len = snprintf(resp_buf, sizeof(resp_buf),
-                        "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\n"
-                        "Content-Length: %zu\r\nConnection: close\r\n\r\n%s",
-                        std::strlen(resp_xml), resp_xml);
-                    DataPlane::TxFrameOutput::send_stream_blocking(
-                        cfd,
-                        std::span<const uint8_t>(
-                            reinterpret_cast<const uint8_t*>(resp_buf),
-                            static_cast<size_t>(resp_len)));
-                }
-            }
-        }
+        send_http_xml(reply, "200 OK", xml_buf, xml_len);
+    } else if (method == "POST" && target == "/control") {
+        if (body.empty()) send_http_empty(reply, "400 Bad Request");
+        else              dispatch_soap_action(reply, body);
+    } else {
+        send_http_empty(reply, "404 Not Found");
     }
-    ::close(cfd);
 }
 
-void UpnpEngine::run_soap_server() {
-    System::Optimizer::set_current_thread_affinity(1);
-    soap_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (soap_listen_fd < 0) return;
-
-    int opt = 1;
-    setsockopt(soap_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    sockaddr_in addr{};
-    addr.sin_family      = AF_INET;
-    addr.sin_port        = htons(5000);
-    addr.sin_addr.s_addr = inet_addr(router_ip_str.c_str());
-    if (bind(soap_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-        std::println(stderr, "[UPnP] SOAP bind port 5000 failed ({})", std::strerror(errno));
-        bind_errors.fetch_or(2, std::memory_order_relaxed);
-        ::close(soap_listen_fd);
-        soap_listen_fd = -1;
-        return;
-    }
-    if (listen(soap_listen_fd, 10) < 0) {
-        std::println(stderr, "[UPnP] SOAP listen failed ({})", std::strerror(errno));
-        bind_errors.fetch_or(4, std::memory_order_relaxed);
-        ::close(soap_listen_fd);
-        soap_listen_fd = -1;
-        return;
-    }
-
-    while (running.load(std::memory_order_relaxed)) {
-        struct pollfd pfds[2]{
-            { soap_listen_fd, POLLIN, 0 },
-            { shutdown_efd,   POLLIN, 0 },
-        };
-        int pr = ::poll(pfds, 2, -1);
-        if (pr < 0) { if (errno == EINTR) continue; break; }
-        if ((pfds[1].revents & POLLIN) != 0) break;
-        if ((pfds[0].revents & POLLIN) == 0) continue;
-
-        sockaddr_in client{};
-        socklen_t clen = sizeof(client);
-        int cfd = accept(soap_listen_fd, reinterpret_cast<sockaddr*>(&client), &clen);
-        if (cfd < 0) {
-            if (errno == EINTR) continue;
-            break;
+void UpnpEngine::dispatch_soap_action(HttpReply& reply, std::string_view body) {
+    if (body.find("DeletePortMapping") != std::string_view::npos) {
+        uint16_t eP = 0;
+        if (!soap_arg_num(body, "NewExternalPort", eP)) { send_soap_fault(reply, 402, "Invalid Args"); return; }
+        const uint8_t proto = soap_protocol(soap_arg(body, "NewProtocol"));
+        if (auto r = nat_engine->remove_upnp_rule(eP, proto); !r) { send_soap_fault(reply, r.error()); return; }
+        std::println("[UPnP] Port mapping deleted: {} [{}]", eP, proto == 6 ? "TCP" : "UDP");
+        send_soap_response(reply, "DeletePortMapping", "");
+    } else if (body.find("GetSpecificPortMappingEntry") != std::string_view::npos) {
+        uint16_t eP = 0;
+        if (!soap_arg_num(body, "NewExternalPort", eP)) { send_soap_fault(reply, 402, "Invalid Args"); return; }
+        auto r = nat_engine->upnp_rule(eP, soap_protocol(soap_arg(body, "NewProtocol")));
+        if (!r) { send_soap_fault(reply, r.error()); return; }
+        char args[512];
+        format_mapping_args(args, sizeof(args), *r);
+        send_soap_response(reply, "GetSpecificPortMappingEntry", args);
+    } else if (body.find("GetGenericPortMappingEntry") != std::string_view::npos) {
+        size_t index = 0;
+        if (!soap_arg_num(body, "NewPortMappingIndex", index)) { send_soap_fault(reply, 402, "Invalid Args"); return; }
+        auto r = nat_engine->upnp_rule_at(index);
+        if (!r) { send_soap_fault(reply, r.error()); return; }
+        char args[640];
+        int n = snprintf(args, sizeof(args),
+            "<NewRemoteHost></NewRemoteHost><NewExternalPort>%u</NewExternalPort>"
+            "<NewProtocol>%s</NewProtocol>",
+            r->ext_port, r->proto == 6 ? "TCP" : "UDP");
+        format_mapping_args(args + n, sizeof(args) - static_cast<size_t>(n), *r);
+        send_soap_response(reply, "GetGenericPortMappingEntry", args);
+    } else if (body.find("AddPortMapping") != std::string_view::npos) {
+        auto ext_port   = soap_arg(body, "NewExternalPort");
+        auto int_client = soap_arg(body, "NewInternalClient");
+        auto protocol   = soap_arg(body, "NewProtocol");
+        NatEngine::UpnpRule rule{};
+        if (ext_port.empty() || int_client.empty() || int_client.size() > 15
+            || std::from_chars(ext_port.data(), ext_port.data() + ext_port.size(), rule.ext_port).ec != std::errc{}) {
+            send_soap_fault(reply, 402, "Invalid Args");
+            return;
         }
+        rule.int_port = rule.ext_port;
+        soap_arg_num(body, "NewInternalPort", rule.int_port);
+        soap_arg_num(body, "NewLeaseDuration", rule.lease_s);
+        rule.proto = soap_protocol(protocol);
 
-        struct timeval ctv{ .tv_sec = 1, .tv_usec = 0 };
-        setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &ctv, sizeof(ctv));
-
-        char buf[2048];
-        int n = recv(cfd, buf, sizeof(buf) - 1, 0);
-        if (n <= 0) {
-            ::close(cfd);
-            continue;
-        }
+        char ip_buf[16]{};
+        std::memcpy(ip_buf, int_client.data(), int_client.size());
+        rule.int_ip = Net::parse_ipv4(ip_buf);
+        // Description is echoed back inside XML: keep it short and markup-free.
+        auto desc = soap_arg(body, "NewPortMappingDescription");
+        for (size_t i = 0; i < desc.size() && i + 1 < rule.desc.size(); ++i)
+            rule.desc[i] = (desc[i] == '<' || desc[i] == '>' || desc[i] == '&') ? '_' : desc[i];
 
-        SoapRequestJob job{};
-        job.cfd = cfd;
-        job.len = static_cast<uint16_t>(n);
-        std::memcpy(job.buf.data(), buf, static_cast<size_t>(n));
-        if (!soap_jobs.push(job)) {
-            static const char busy[] =
-                "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n";
-            (void)::send(cfd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
-            ::close(cfd);
-        } else {
-            (void)::eventfd_write(soap_job_notify_efd, 1);
+        if (auto r = nat_engine->add_upnp_rule(rule); !r) {
+            std::println(stderr, "[UPnP] Port mapping refused: {} [{}] -> {}:{} (error {})",
+                         ext_port, protocol, int_client, rule.int_port, static_cast<uint16_t>(r.error()));
+            send_soap_fault(reply, r.error());
+            return;
         }
-    }
-    if (soap_listen_fd >= 0) {
-        ::close(soap_listen_fd);
-        soap_listen_fd = -1;
+        std::println("[UPnP] Port mapping accepted: {} [{}] -> {}:{}, lease {}s.",
+                     ext_port, protocol, int_client, rule.int_port,
+                     rule.lease_s == 0 ? NatEngine::UPNP_MAX_LEASE
+                                       : std::min(rule.lease_s, NatEngine::UPNP_MAX_LEASE));
+        send_soap_response(reply, "AddPortMapping", "");
+    } else {
+        send_soap_fault(reply, 401, "Invalid Action");
     }
 }
 